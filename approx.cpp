@@ -0,0 +1,604 @@
+#include "approx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "kernels.h"
+#include "pipeline.h"
+
+using namespace std;
+
+static const int CHANNELS = 3;
+
+// one pass of a float (or for the stack blur byte) image, rows or columns [begin, end) of it per thread
+template <typename T>
+struct PassParams {
+    const T *src;
+    T *dst;
+    int width, height;
+    int radius;  // box radius, or Kawase offset
+    EdgeMode edge;
+    int begin, end;
+    JobControl *control;
+};
+
+// row y of an image with the edge mode applied, NULL for a row of zeros
+template <typename T>
+static inline const T *edge_row(const T *src, int y, int height, size_t stride, EdgeMode edge) {
+    if (y < 0 || y >= height) {
+        if (edge == EDGE_ZERO) {
+            return NULL;
+        }
+        y = min(max(y, 0), height - 1);
+    }
+    return src + y * stride;
+}
+
+// copies a row into padded with pad pixels of edge on both sides, so the loops over it need no bounds checks
+template <typename T, int C = CHANNELS>
+static void pad_row(const T *src, T *padded, int width, int pad, EdgeMode edge) {
+    memcpy(padded + pad * C, src, sizeof(T) * width * C);
+    for (int x = 0; x < pad; x++) {
+        for (int c = 0; c < C; c++) {
+            padded[x * C + c] = edge == EDGE_ZERO ? T() : src[c];
+            padded[(pad + width + x) * C + c] = edge == EDGE_ZERO ? T() : src[(width - 1) * C + c];
+        }
+    }
+}
+
+// The running sums are floats. The first pass reads whole numbers, which float sums hold exactly, and later
+// passes drift by well under a thousandth of a level over the longest rows. C is the channels per pixel.
+template <int C>
+static void *box_rows(void *arg) {
+    PassParams<float> *p = (PassParams<float> *)arg;
+    int width = p->width, r = p->radius;
+    float scale = 1.0f / (2 * r + 1);
+    vector<float> padded((size_t)(width + 2 * r + 2) * C);
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        pad_row<float, C>(p->src + (size_t)y * width * C, padded.data(), width, r + 1, p->edge);
+        const float *row = padded.data() + C;  // the leftmost tap of output 0
+        float *dst = p->dst + (size_t)y * width * C;
+
+        float sum[C] = {};
+        for (int k = 0; k < 2 * r + 1; k++) {
+            for (int c = 0; c < C; c++) {
+                sum[c] += row[k * C + c];
+            }
+        }
+        // the difference is taken first so the sum only waits on one add per pixel
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < C; c++) {
+                dst[x * C + c] = sum[c] * scale;
+                sum[c] += row[(x + 2 * r + 1) * C + c] - row[x * C + c];
+            }
+        }
+        if (p->control) {
+            p->control->add_done(width);
+        }
+    }
+    return NULL;
+}
+
+// walks down the columns [begin, end) together, whole row segments at a time through the vector kernels
+template <int C>
+static void *box_columns(void *arg) {
+    PassParams<float> *p = (PassParams<float> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int height = p->height, r = p->radius;
+    int count = (p->end - p->begin) * C;
+    size_t stride = (size_t)p->width * C;
+    float scale = 1.0f / (2 * r + 1);
+
+    const float *src = p->src + (size_t)p->begin * C;
+    float *dst = p->dst + (size_t)p->begin * C;
+    vector<float> sums(count, 0.0f);
+
+    for (int k = -r; k <= r; k++) {
+        const float *row = edge_row(src, k, height, stride, p->edge);
+        if (row) {
+            kernels.add_scaled(sums.data(), row, 1.0f, count);
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        float *out = dst + y * stride;
+        memset(out, 0, sizeof(float) * count);
+        kernels.add_scaled(out, sums.data(), scale, count);
+
+        // scaling by 1 and -1 is exact, these are plain adds and subtracts
+        const float *entering = edge_row(src, y + r + 1, height, stride, p->edge);
+        const float *leaving = edge_row(src, y - r, height, stride, p->edge);
+        if (entering) {
+            kernels.add_scaled(sums.data(), entering, 1.0f, count);
+        }
+        if (leaving) {
+            kernels.add_scaled(sums.data(), leaving, -1.0f, count);
+        }
+        if (p->control) {
+            p->control->add_done(p->end - p->begin);
+        }
+    }
+    return NULL;
+}
+
+// runs one pass with rows (or columns) [0, count) split evenly over the threads
+template <typename T>
+static void run_pass(void *(*worker)(void *), const T *src, T *dst, int width, int height, int radius, EdgeMode edge,
+                     int count, int num_threads, JobControl *control) {
+    num_threads = max(min(num_threads, count), 1);
+    vector<PassParams<T>> params(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        params[i] = {src, dst, width, height, radius, edge, (int)((long long)count * i / num_threads),
+                     (int)((long long)count * (i + 1) / num_threads), control};
+    }
+    run_threads(params, worker);
+}
+
+vector<int> box_radii(double sigma) {
+    const int n = 3;
+    double ideal = sqrt(12 * sigma * sigma / n + 1);
+    int lower = (int)floor(ideal);
+    if (lower % 2 == 0) {
+        lower--;
+    }
+    int upper = lower + 2;
+
+    // the first m boxes are the narrower width, the rest the wider one
+    double m = (12 * sigma * sigma - n * lower * lower - 4 * n * lower - 3 * n) / (-4 * lower - 4);
+    int narrow = (int)lround(m);
+
+    vector<int> radii;
+    for (int i = 0; i < n; i++) {
+        radii.push_back(((i < narrow ? lower : upper) - 1) / 2);
+    }
+    return radii;
+}
+
+bool box_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+              EdgeMode edge, JobControl *control) {
+    size_t count = (size_t)width * height * CHANNELS;
+    vector<float> a(count), b(count);
+    row_kernels().bytes_to_floats((const uint8_t *)image, a.data(), count);
+
+    vector<int> radii = box_radii(sigma);
+    if (control) {
+        control->set_total(2LL * radii.size() * width * height);
+    }
+
+    for (int radius : radii) {
+        if (control && control->cancelled()) {
+            return false;
+        }
+        run_pass(box_rows<CHANNELS>, a.data(), b.data(), width, height, radius, edge, height, num_threads, control);
+        run_pass(box_columns<CHANNELS>, b.data(), a.data(), width, height, radius, edge, width, num_threads, control);
+    }
+
+    row_kernels().floats_to_bytes(a.data(), (uint8_t *)output, count);
+    return control == NULL || !control->cancelled();
+}
+
+// The stack blur divides by (r + 1)^2 with a 32 bit multiply and shift. The sums stay under 256 (r + 1)^2, so
+// mul = 2^24 / (r + 1)^2 can't overflow, and up to this radius mul is big enough that a flat area keeps its
+// value through the rounding.
+static const int MAX_STACK_RADIUS = 127;
+static const int STACK_SHIFT = 24;
+
+static inline int32_t stack_divisor(int r) { return (r + 1) * (r + 1); }
+static inline int32_t stack_mul(int r) { return (1 << STACK_SHIFT) / stack_divisor(r); }
+
+vector<int> stack_radii(double sigma) {
+    // a stack blur of radius r weighs its taps r + 1 - |k|, two boxes of r + 1 taps with variance r (r + 2) / 6
+    double variance = sigma * sigma;
+    int passes = 1;
+    while (sqrt(1 + 6 * variance / passes) - 1 > MAX_STACK_RADIUS + 0.5) {
+        passes++;
+    }
+    int radius = (int)lround(sqrt(1 + 6 * variance / passes) - 1);
+    return radius > 0 ? vector<int>(passes, radius) : vector<int>();
+}
+
+// http://underdestruction.com/2004/02/25/stackblur-2004/
+// Rather than keep the stack itself, the sums in and out of it are moved on from the source: S moves by
+// In - Out, In gains the pixel r + 2 ahead and Out the one just passed, and the pixel in between goes from
+// In to Out. Sums start half a divisor up so the shift rounds to nearest. C is the channels per pixel.
+template <int C>
+static void *stack_rows(void *arg) {
+    PassParams<uint8_t> *p = (PassParams<uint8_t> *)arg;
+    int width = p->width, r = p->radius;
+    int32_t mul = stack_mul(r);
+    vector<uint8_t> padded((size_t)(width + 2 * r + 4) * C);
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        pad_row<uint8_t, C>(p->src + (size_t)y * width * C, padded.data(), width, r + 2, p->edge);
+        const uint8_t *row = padded.data() + (r + 2) * C;  // pixel 0
+        uint8_t *dst = p->dst + (size_t)y * width * C;
+
+        int32_t sum[C], sum_in[C] = {}, sum_out[C] = {};
+        for (int c = 0; c < C; c++) {
+            sum[c] = stack_divisor(r) / 2;
+            for (int k = -r; k <= r; k++) {
+                sum[c] += (r + 1 - abs(k)) * row[k * C + c];
+            }
+            for (int k = 0; k <= r; k++) {
+                sum_in[c] += row[(k + 1) * C + c];
+                sum_out[c] += row[-k * C + c];
+            }
+        }
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < C; c++) {
+                int middle = row[(x + 1) * C + c];
+                dst[x * C + c] = ((uint32_t)sum[c] * mul) >> STACK_SHIFT;
+                sum[c] += sum_in[c] - sum_out[c];
+                sum_in[c] += row[(x + r + 2) * C + c] - middle;
+                sum_out[c] += middle - row[(x - r) * C + c];
+            }
+        }
+        if (p->control) {
+            p->control->add_done(width);
+        }
+    }
+    return NULL;
+}
+
+// the same recurrence down the columns [begin, end) together, every channel of every column a vector lane
+template <int C>
+static void *stack_columns(void *arg) {
+    PassParams<uint8_t> *p = (PassParams<uint8_t> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int height = p->height, r = p->radius;
+    int count = (p->end - p->begin) * C;
+    size_t stride = (size_t)p->width * C;
+
+    const uint8_t *src = p->src + (size_t)p->begin * C;
+    uint8_t *dst = p->dst + (size_t)p->begin * C;
+    vector<uint8_t> zeros(count, 0);
+    auto row = [&](int y) {
+        const uint8_t *found = edge_row(src, y, height, stride, p->edge);
+        return found ? found : zeros.data();
+    };
+
+    vector<int32_t> sum(count, stack_divisor(r) / 2), sum_in(count, 0), sum_out(count, 0);
+    for (int k = -r; k <= r; k++) {
+        const uint8_t *s = row(k);
+        int weight = r + 1 - abs(k);
+        for (int i = 0; i < count; i++) {
+            sum[i] += weight * s[i];
+        }
+    }
+    for (int k = 0; k <= r; k++) {
+        const uint8_t *entering = row(k + 1), *leaving = row(-k);
+        for (int i = 0; i < count; i++) {
+            sum_in[i] += entering[i];
+            sum_out[i] += leaving[i];
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        kernels.stack_step(row(y + r + 2), row(y + 1), row(y - r), sum.data(), sum_in.data(), sum_out.data(),
+                           dst + y * stride, count, stack_mul(r), STACK_SHIFT);
+        if (p->control) {
+            p->control->add_done(p->end - p->begin);
+        }
+    }
+    return NULL;
+}
+
+// every pass ends in output, the rows go through a scratch frame
+template <int C>
+static bool stack_passes(int width, int height, const uint8_t *image, uint8_t *output, double sigma, int num_threads,
+                         EdgeMode edge, JobControl *control) {
+    vector<int> radii = stack_radii(sigma);
+    if (control) {
+        control->set_total(max(2LL * (long long)radii.size(), 1LL) * width * height);
+    }
+    if (control && control->cancelled()) {
+        return false;
+    }
+    if (radii.empty()) {
+        memcpy(output, image, (size_t)width * height * C);
+        if (control) {
+            control->add_done((long long)width * height);
+        }
+        return true;
+    }
+
+    vector<uint8_t> scratch((size_t)width * height * C);
+    const uint8_t *src = image;
+    for (int radius : radii) {
+        if (control && control->cancelled()) {
+            return false;
+        }
+        run_pass(stack_rows<C>, src, scratch.data(), width, height, radius, edge, height, num_threads, control);
+        run_pass(stack_columns<C>, (const uint8_t *)scratch.data(), output, width, height, radius, edge, width,
+                 num_threads, control);
+        src = output;
+    }
+    return control == NULL || !control->cancelled();
+}
+
+bool stack_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                EdgeMode edge, JobControl *control) {
+    return stack_passes<CHANNELS>(width, height, (const uint8_t *)image, (uint8_t *)output, sigma, num_threads, edge,
+                                  control);
+}
+
+bool stack_blur_plane(int width, int height, const uint8_t *plane, uint8_t *output, double sigma, int num_threads,
+                      EdgeMode edge, JobControl *control) {
+    return stack_passes<1>(width, height, plane, output, sigma, num_threads, edge, control);
+}
+
+template <int C>
+static bool box_passes(int width, int height, const float *src, float *dst, int radius, int num_threads,
+                       EdgeMode edge, JobControl *control) {
+    vector<float> scratch((size_t)width * height * C);
+    run_pass(box_rows<C>, src, scratch.data(), width, height, radius, edge, height, num_threads, control);
+    run_pass(box_columns<C>, (const float *)scratch.data(), dst, width, height, radius, edge, width, num_threads,
+             control);
+    return control == NULL || !control->cancelled();
+}
+
+bool box_mean(int width, int height, int channels, const float *src, float *dst, int radius, int num_threads,
+              EdgeMode edge, JobControl *control) {
+    switch (channels) {
+        case 1:
+            return box_passes<1>(width, height, src, dst, radius, num_threads, edge, control);
+        case 2:
+            return box_passes<2>(width, height, src, dst, radius, num_threads, edge, control);
+        case 3:
+            return box_passes<3>(width, height, src, dst, radius, num_threads, edge, control);
+        case 4:
+            return box_passes<4>(width, height, src, dst, radius, num_threads, edge, control);
+        case 6:
+            return box_passes<6>(width, height, src, dst, radius, num_threads, edge, control);
+        case 8:
+            return box_passes<8>(width, height, src, dst, radius, num_threads, edge, control);
+    }
+    return false;
+}
+
+int binomial_radius(double sigma) { return (int)lround(2 * sigma * sigma); }
+
+static void *binomial_rows(void *arg) {
+    PassParams<uint8_t> *p = (PassParams<uint8_t> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int width = p->width, r = p->radius;
+    vector<uint8_t> padded((size_t)(width + 2 * r) * CHANNELS);
+    vector<uint16_t> scratch(padded.size());
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        pad_row(p->src + (size_t)y * width * CHANNELS, padded.data(), width, r, p->edge);
+        kernels.binomial_row(padded.data(), p->dst + (size_t)y * width * CHANNELS, scratch.data(), width * CHANNELS,
+                             r, CHANNELS);
+        if (p->control) {
+            p->control->add_done(width);
+        }
+    }
+    return NULL;
+}
+
+// feeds rows -r .. height + r - 1 down the columns [begin, end), each output comes out r rows after its own
+static void *binomial_columns(void *arg) {
+    PassParams<uint8_t> *p = (PassParams<uint8_t> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int height = p->height, r = p->radius;
+    int count = (p->end - p->begin) * CHANNELS;
+    size_t stride = (size_t)p->width * CHANNELS;
+
+    const uint8_t *src = p->src + (size_t)p->begin * CHANNELS;
+    uint8_t *dst = p->dst + (size_t)p->begin * CHANNELS;
+    vector<uint8_t> zeros(count, 0);
+    vector<uint16_t> levels((size_t)2 * r * count, 0);
+
+    for (int y = -r; y < height + r; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        const uint8_t *row = edge_row(src, y, height, stride, p->edge);
+        kernels.binomial_step(row ? row : zeros.data(), levels.data(), y >= r ? dst + (y - r) * stride : NULL,
+                              count, r);
+        if (p->control && y >= r) {
+            p->control->add_done(p->end - p->begin);
+        }
+    }
+    return NULL;
+}
+
+bool binomial_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                   EdgeMode edge, JobControl *control) {
+    int radius = min(binomial_radius(sigma), MAX_BINOMIAL_RADIUS);
+    if (control) {
+        control->set_total(2LL * width * height);
+        if (control->cancelled()) {
+            return false;
+        }
+    }
+
+    vector<uint8_t> scratch((size_t)width * height * CHANNELS);
+    run_pass(binomial_rows, (const uint8_t *)image, scratch.data(), width, height, radius, edge, height, num_threads,
+             control);
+    run_pass(binomial_columns, (const uint8_t *)scratch.data(), (uint8_t *)output, width, height, radius, edge, width,
+             num_threads, control);
+    return control == NULL || !control->cancelled();
+}
+
+int pyramid_factor(double sigma, double min_sigma) {
+    int factor = 1;
+    while (factor < 64 && sigma / (factor * 2) >= min_sigma) {
+        factor *= 2;
+    }
+    return factor;
+}
+
+double shrunk_sigma(double sigma, int factor) {
+    double box_variance = (factor * factor - 1) / 12.0;
+    return sqrt(max(sigma * sigma - box_variance, 0.0)) / factor;
+}
+
+bool pyramid_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                  int band_height, EdgeMode edge, JobControl *control) {
+    int factor = pyramid_factor(sigma, 2.0);
+    double small_sigma = shrunk_sigma(sigma, factor);
+    int small_radius = max((int)ceil(3 * small_sigma), 1);
+    int small_width = max(width / factor, 1), small_height = max(height / factor, 1);
+    size_t small_pixels = (size_t)small_width * small_height;
+
+    if (control) {
+        control->set_total(factor > 1 ? 2LL * small_pixels + (long long)width * height : (long long)width * height);
+    }
+
+    Pipeline blur(small_width, small_height);
+    blur.edge(edge).threads(num_threads).band_height(band_height).control(control).blur(small_radius, small_sigma);
+    if (factor == 1) {
+        return blur.run(image, output);
+    }
+
+    // three sweeps and not one fused chain, fused bands would redo the blur's apron for every band of the
+    // full size output and that costs more than the trip through the small frame
+    vector<Pixel> shrunk(small_pixels), blurred(small_pixels);
+    Pipeline shrink(width, height), grow(small_width, small_height);
+    shrink.threads(num_threads).band_height(band_height).control(control).resize(small_width, small_height,
+                                                                                  FILTER_AREA, 0.0);
+    grow.threads(num_threads).band_height(band_height).control(control).resize(width, height, FILTER_BICUBIC, 0.0);
+
+    return shrink.run(image, shrunk.data()) && blur.run(shrunk.data(), blurred.data()) &&
+           grow.run(blurred.data(), output);
+}
+
+vector<int> kawase_offsets(double sigma) {
+    // a pass at offset d reads -(d + 1), -d, d and d + 1 along each axis with equal weights
+    vector<int> offsets;
+    double remaining = sigma * sigma;
+    int d = 0;
+    while (remaining >= 0.25) {
+        double variance = (d * d + (d + 1) * (d + 1)) / 2.0;
+        if (d > 0 && variance > remaining + 0.25) {
+            d--;  // too wide for what is left, finish with narrower passes
+            continue;
+        }
+        offsets.push_back(d);
+        remaining -= variance;
+        d++;
+    }
+    return offsets;
+}
+
+// A Kawase pass averages four bilinear taps at (+-(d + 0.5), +-(d + 0.5)), which is 16 pixels at columns
+// and rows -(d + 1), -d, d and d + 1 with equal weights. That is separable, so it runs as a 4 tap row pass
+// and a 4 tap column pass, each a few calls to the vector kernels.
+static void *kawase_rows(void *arg) {
+    PassParams<float> *p = (PassParams<float> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int width = p->width, d = p->radius;
+    int count = width * CHANNELS;
+    vector<float> padded((size_t)(width + 2 * d + 2) * CHANNELS);
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        pad_row(p->src + (size_t)y * count, padded.data(), width, d + 1, p->edge);
+        const float *row = padded.data() + (d + 1) * CHANNELS;
+        float *dst = p->dst + (size_t)y * count;
+
+        memset(dst, 0, sizeof(float) * count);
+        for (int tap : {-d - 1, -d, d, d + 1}) {
+            kernels.add_scaled(dst, row + tap * CHANNELS, 0.25f, count);
+        }
+    }
+    return NULL;
+}
+
+static void *kawase_columns(void *arg) {
+    PassParams<float> *p = (PassParams<float> *)arg;
+    const RowKernels &kernels = row_kernels();
+    int height = p->height, d = p->radius;
+    int count = p->width * CHANNELS;
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        float *dst = p->dst + (size_t)y * count;
+        memset(dst, 0, sizeof(float) * count);
+        for (int tap : {-d - 1, -d, d, d + 1}) {
+            const float *row = edge_row(p->src, y + tap, height, count, p->edge);
+            if (row) {
+                kernels.add_scaled(dst, row, 0.25f, count);
+            }
+        }
+        if (p->control) {
+            p->control->add_done(p->width);
+        }
+    }
+    return NULL;
+}
+
+bool kawase_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                 EdgeMode edge, JobControl *control) {
+    int factor = pyramid_factor(sigma, 1.0);
+    int small_width = max(width / factor, 1), small_height = max(height / factor, 1);
+    vector<int> offsets = kawase_offsets(shrunk_sigma(sigma, factor));
+    size_t small_pixels = (size_t)small_width * small_height;
+
+    if (control) {
+        control->set_total((long long)small_pixels * (offsets.size() + 1) + (long long)width * height);
+    }
+
+    // without a shrink the passes read the image directly and the way back up is a plain conversion
+    vector<Pixel> small;
+    const Pixel *passes_input = image;
+    if (factor > 1) {
+        small.resize(small_pixels);
+        Pipeline shrink(width, height);
+        shrink.threads(num_threads).control(control).resize(small_width, small_height, FILTER_AREA, 0.0);
+        if (!shrink.run(image, small.data())) {
+            return false;
+        }
+        passes_input = small.data();
+    } else if (control) {
+        control->add_done(small_pixels);
+    }
+
+    vector<float> a(small_pixels * CHANNELS), b(small_pixels * CHANNELS);
+    row_kernels().bytes_to_floats((const uint8_t *)passes_input, a.data(), a.size());
+    for (int offset : offsets) {
+        if (control && control->cancelled()) {
+            return false;
+        }
+        run_pass(kawase_rows, a.data(), b.data(), small_width, small_height, offset, edge, small_height, num_threads,
+                 control);
+        run_pass(kawase_columns, b.data(), a.data(), small_width, small_height, offset, edge, small_height,
+                 num_threads, control);
+    }
+
+    if (factor == 1) {
+        row_kernels().floats_to_bytes(a.data(), (uint8_t *)output, a.size());
+        if (control) {
+            control->add_done(small_pixels);
+        }
+        return control == NULL || !control->cancelled();
+    }
+
+    row_kernels().floats_to_bytes(a.data(), (uint8_t *)small.data(), a.size());
+    Pipeline grow(small_width, small_height);
+    grow.threads(num_threads).control(control).resize(width, height, FILTER_BICUBIC, 0.0);
+    return grow.run(small.data(), output);
+}
@@ -0,0 +1,70 @@
+#ifndef APPROX_H
+#define APPROX_H
+
+#include <vector>
+
+#include "blur.h"
+
+// Cheaper stand-ins for the gaussian, for when a blur has to be on time rather than exact. Like the other
+// engines each output pixel is computed in a fixed order, so the bytes don't depend on the thread count.
+// Progress counts the pixels written by every pass, so each function sets the total itself.
+
+// three box blurs whose widths add up to the gaussian's variance
+// http://blog.ivank.net/fastest-gaussian-blur.html
+std::vector<int> box_radii(double sigma);
+
+// O(1) per pixel whatever the radius, a running sum along the rows and then down the columns
+bool box_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+              EdgeMode edge, JobControl *control = NULL);
+
+// One box pass of a float image with 1, 2, 3, 4, 6 or 8 interleaved channels: the mean of every channel over
+// the (2 radius + 1)^2 window, from running sums along the rows and then down the columns, so O(1) per pixel.
+// Progress counts 2 * width * height.
+bool box_mean(int width, int height, int channels, const float *src, float *dst, int radius, int num_threads,
+              EdgeMode edge, JobControl *control = NULL);
+
+// radii of the stack blur passes for sigma, one pass unless it is too wide for the integer sums
+std::vector<int> stack_radii(double sigma);
+
+// Klingemann's stack blur, a triangle filter (two boxes in one) in integers, O(1) per pixel like the box blur
+// and with bytes in between. The rows are scalar, the column pass runs down all the columns at once in vectors.
+bool stack_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                EdgeMode edge, JobControl *control = NULL);
+
+// the same stack blur of a single 8-bit plane, a third of the work of blurring pixels
+bool stack_blur_plane(int width, int height, const uint8_t *plane, uint8_t *output, double sigma, int num_threads,
+                      EdgeMode edge, JobControl *control = NULL);
+
+// Binomial weights C(2m, k) / 4^m are a gaussian of variance m / 2 sampled closely, and 2m [1 1] sums build
+// them with adds alone. Up to m = 4 the sums fit the 16 bit lanes of the vector kernels.
+static const int MAX_BINOMIAL_RADIUS = 4;
+
+// the m whose binomial is closest to sigma, it fits the gaussians of blur radius 2 to 4. Radius 1 gets m = 0,
+// no blur at all.
+int binomial_radius(double sigma);
+
+// row and column binomial passes with bytes in between, m is capped at MAX_BINOMIAL_RADIUS
+bool binomial_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                   EdgeMode edge, JobControl *control = NULL);
+
+// power of two the image is shrunk by so the blur at the small size still has sigma >= min_sigma
+int pyramid_factor(double sigma, double min_sigma);
+
+// the area filter already spreads a pixel over factor inputs, this is what is left of sigma at 1 / factor
+double shrunk_sigma(double sigma, int factor);
+
+// shrinks the image, blurs it at the small size and scales it back up with a bicubic filter, each step a
+// pipeline sweep
+bool pyramid_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                  int band_height, EdgeMode edge, JobControl *control = NULL);
+
+// offsets of the Kawase passes that add up to a gaussian of the given sigma, each pass averages four
+// bilinear taps at (+-(d + 0.5), +-(d + 0.5))
+std::vector<int> kawase_offsets(double sigma);
+
+// Kawase passes on a shrunk copy of the image, the cheapest and roughest of the blurs
+// https://www.intel.com/content/www/us/en/developer/articles/technical/an-investigation-of-fast-real-time-gpu-based-image-blur-algorithms.html
+bool kawase_blur(int width, int height, const Pixel *image, Pixel *output, double sigma, int num_threads,
+                 EdgeMode edge, JobControl *control = NULL);
+
+#endif
@@ -0,0 +1,263 @@
+#include "backends.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "approx.h"
+#include "pipeline.h"
+
+using namespace std;
+
+static const char *const BACKEND_NAMES[BACKEND_COUNT] = {"exact", "separable", "binomial", "box",
+                                                          "stack", "pyramid",   "kawase"};
+
+const char *backend_name(Backend backend) { return BACKEND_NAMES[backend]; }
+
+bool parse_backend(const char *name, Backend &backend) {
+    for (int i = 0; i < BACKEND_COUNT; i++) {
+        if (strcmp(name, BACKEND_NAMES[i]) == 0) {
+            backend = (Backend)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool backend_supports(Backend backend, int radius) {
+    if (backend != BACKEND_BINOMIAL) {
+        return true;
+    }
+    // m = 0 is a copy, radius 1's sigma of 1/3 rounds to it
+    int m = binomial_radius(default_sigma(radius));
+    return m >= 1 && m <= MAX_BINOMIAL_RADIUS;
+}
+
+Backend default_backend(int radius) {
+    return backend_supports(BACKEND_BINOMIAL, radius) ? BACKEND_BINOMIAL : BACKEND_EXACT;
+}
+
+bool run_backend(Backend backend, int width, int height, const Pixel *image, Pixel *output, int radius,
+                 int num_threads, int band_height, EdgeMode edge, JobControl *control, BlurStats *stats) {
+    double sigma = default_sigma(radius);
+
+    switch (backend) {
+        case BACKEND_EXACT: {
+            BMPHeader header = make_bmp_header(width, height);
+            auto kernel = gen_gaussian_kernel(radius, num_threads);
+            if (control) {
+                control->set_total((long long)width * height);
+            }
+            return blur_image(header, (Pixel *)image, output, kernel, num_threads, edge, control, stats);
+        }
+        case BACKEND_SEPARABLE: {
+            Pipeline pipeline(width, height);
+            pipeline.edge(edge).threads(num_threads).band_height(band_height).control(control).blur(radius);
+            if (control) {
+                control->set_total((long long)width * height);
+            }
+            return pipeline.run(image, output);
+        }
+        case BACKEND_BINOMIAL:
+            return binomial_blur(width, height, image, output, sigma, num_threads, edge, control);
+        case BACKEND_BOX:
+            return box_blur(width, height, image, output, sigma, num_threads, edge, control);
+        case BACKEND_STACK:
+            return stack_blur(width, height, image, output, sigma, num_threads, edge, control);
+        case BACKEND_PYRAMID:
+            return pyramid_blur(width, height, image, output, sigma, num_threads, band_height, edge, control);
+        case BACKEND_KAWASE:
+            return kawase_blur(width, height, image, output, sigma, num_threads, edge, control);
+    }
+    return false;
+}
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// best of two, so a page fault or a preemption doesn't skew it
+template <typename Body>
+static double best_time(const Body &body) {
+    double best = 1e9;
+    for (int run = 0; run < 2; run++) {
+        double start = now_seconds();
+        body();
+        best = min(best, now_seconds() - start);
+    }
+    return best;
+}
+
+// 1D taps per pixel of a separable blur in the pipeline. Every band runs the row pass over its own rows and
+// the radius above and below, so narrow bands and wide blurs redo a good share of the row pass.
+static double separable_taps(int radius, int height, int band_height) {
+    int band = min(band_height, height);
+    double row_passes = (double)min(band + 2 * radius, height) / band;
+    return (2 * radius + 1) * (row_passes + 1);
+}
+
+// radius of the blur the pyramid runs on its shrunk frame, as pyramid_blur picks it
+static int pyramid_small_radius(double sigma, int factor) { return max((int)ceil(3 * shrunk_sigma(sigma, factor)), 1); }
+
+CostModel calibrate_cost_model(int num_threads) {
+    double start = now_seconds();
+
+    // single threaded on frames big enough that starting the threads doesn't show, a few ms in all
+    const int size = 128;
+    vector<Pixel> input((size_t)size * size), output(input.size()), small(input.size());
+    uint32_t state = 12345;
+    for (Pixel &p : input) {
+        state = state * 1664525u + 1013904223u;
+        p.red = state >> 24;
+        p.green = state >> 16;
+        p.blue = state >> 8;
+    }
+    double pixels = (double)size * size;
+
+    CostModel model;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    model.parallelism = max(1, (int)min((long)num_threads, max(cores, 1L)));
+
+    // the exact blur on a 32 row strip, it is by far the slowest per pixel
+    int strip = 32;
+    model.exact_tap = best_time([&] {
+                          run_backend(BACKEND_EXACT, size, strip, input.data(), output.data(), 2, 1, 32, EDGE_CLAMP);
+                      }) / ((double)size * strip * 25);
+
+    // two radii, one mostly conversions and one mostly taps
+    double narrow = best_time([&] {
+        run_backend(BACKEND_SEPARABLE, size, size, input.data(), output.data(), 0, 1, 32, EDGE_CLAMP);
+    });
+    double wide = best_time([&] {
+        run_backend(BACKEND_SEPARABLE, size, size, input.data(), output.data(), 12, 1, 32, EDGE_CLAMP);
+    });
+    double narrow_taps = separable_taps(0, size, 32), wide_taps = separable_taps(12, size, 32);
+    model.separable_tap = max(wide - narrow, 0.0) / (pixels * (wide_taps - narrow_taps));
+    model.separable_pixel = max(narrow / pixels - narrow_taps * model.separable_tap, 0.0);
+
+    // radius 4 is the widest binomial, 8 sums plus the two conversions
+    model.binomial_level = best_time([&] {
+                               run_backend(BACKEND_BINOMIAL, size, size, input.data(), output.data(), 4, 1, 32,
+                                           EDGE_CLAMP);
+                           }) / (pixels * (2 * binomial_radius(default_sigma(4)) + 2));
+
+    model.box_pixel = best_time([&] {
+                          run_backend(BACKEND_BOX, size, size, input.data(), output.data(), 12, 1, 32, EDGE_CLAMP);
+                      }) / pixels;
+
+    model.stack_pixel = best_time([&] {
+                            run_backend(BACKEND_STACK, size, size, input.data(), output.data(), 12, 1, 32,
+                                        EDGE_CLAMP);
+                        }) / pixels;
+
+    int factor = 4, small_size = size / factor;
+    Pipeline shrink(size, size), grow(small_size, small_size);
+    shrink.threads(1).resize(small_size, small_size, FILTER_AREA, 0.0);
+    grow.threads(1).resize(size, size, FILTER_BICUBIC, 0.0);
+    model.resize_pixel = best_time([&] {
+                             shrink.run(input.data(), small.data());
+                             grow.run(small.data(), output.data());
+                         }) / pixels;
+
+    // radius 5 is a sigma small enough that Kawase runs unshrunk, so this is all passes
+    int passes = kawase_offsets(default_sigma(5)).size();
+    model.kawase_pass_pixel = best_time([&] {
+                                  run_backend(BACKEND_KAWASE, size, size, input.data(), output.data(), 5, 1, 32,
+                                              EDGE_CLAMP);
+                              }) / (pixels * max(passes, 1));
+
+    // a buffer too big for malloc to recycle, so every run maps and faults in new pages
+    const size_t fresh_bytes = 1 << 20;
+    model.fresh_byte = best_time([&] {
+                           vector<uint8_t> fresh(fresh_bytes);
+                           memset(fresh.data(), 1, fresh_bytes);
+                       }) / fresh_bytes;
+
+    model.calibration_seconds = now_seconds() - start;
+    return model;
+}
+
+double predict_seconds(const CostModel &model, Backend backend, int width, int height, int radius,
+                       int band_height) {
+    double pixels = (double)width * height;
+    double sigma = default_sigma(radius);
+    double taps = 2 * radius + 1;
+    double seconds = 0;
+
+    switch (backend) {
+        case BACKEND_EXACT:
+            seconds = pixels * taps * taps * model.exact_tap;
+            break;
+        case BACKEND_SEPARABLE:
+            seconds = pixels * model.separable_pixel;
+            seconds += pixels * model.separable_tap * separable_taps(radius, height, band_height);
+            break;
+        case BACKEND_BINOMIAL:
+            seconds = pixels * (2 * binomial_radius(sigma) + 2) * model.binomial_level;
+            break;
+        case BACKEND_BOX:
+            seconds = pixels * model.box_pixel;
+            break;
+        case BACKEND_STACK:
+            seconds = pixels * stack_radii(sigma).size() * model.stack_pixel;
+            break;
+        case BACKEND_PYRAMID: {
+            int factor = pyramid_factor(sigma, 2.0);
+            double small = pixels / (factor * factor);
+            int small_radius = pyramid_small_radius(sigma, factor);
+            seconds = small * model.separable_pixel;
+            seconds += small * model.separable_tap * separable_taps(small_radius, max(height / factor, 1), band_height);
+            if (factor > 1) {
+                seconds += pixels * model.resize_pixel;
+            }
+            break;
+        }
+        case BACKEND_KAWASE: {
+            int factor = pyramid_factor(sigma, 1.0);
+            double small = pixels / (factor * factor);
+            seconds = small * kawase_offsets(shrunk_sigma(sigma, factor)).size() * model.kawase_pass_pixel;
+            if (factor > 1) {
+                seconds += pixels * model.resize_pixel;
+            }
+            break;
+        }
+    }
+    // the output frame and the float copies are new memory, the small frames above are reused and never
+    // pay for it
+    double fresh = pixels * sizeof(Pixel);
+    if (backend == BACKEND_BOX) {
+        fresh += pixels * 2 * 3 * sizeof(float);
+    } else if (backend == BACKEND_STACK || backend == BACKEND_BINOMIAL) {
+        fresh += pixels * sizeof(Pixel);
+    } else if (backend == BACKEND_KAWASE || backend == BACKEND_PYRAMID) {
+        int factor = pyramid_factor(sigma, backend == BACKEND_KAWASE ? 1.0 : 2.0);
+        fresh += pixels / (factor * factor) * (backend == BACKEND_KAWASE ? 2 * 3 * sizeof(float) : 2 * sizeof(Pixel));
+    }
+    return seconds / model.parallelism + fresh * model.fresh_byte;
+}
+
+Backend choose_backend(const CostModel &model, int width, int height, int radius, int band_height,
+                       double budget_seconds) {
+    Backend fastest = BACKEND_KAWASE;
+    double fastest_seconds = 1e30;
+    for (int i = 0; i < BACKEND_COUNT; i++) {
+        if (!backend_supports((Backend)i, radius)) {
+            continue;
+        }
+        double seconds = predict_seconds(model, (Backend)i, width, height, radius, band_height);
+        if (seconds <= budget_seconds) {
+            return (Backend)i;
+        }
+        if (seconds < fastest_seconds) {
+            fastest = (Backend)i;
+            fastest_seconds = seconds;
+        }
+    }
+    return fastest;
+}
@@ -0,0 +1,62 @@
+#ifndef BACKENDS_H
+#define BACKENDS_H
+
+#include "blur.h"
+
+// every whole-image blur the CLI can run, from the best quality to the roughest
+enum Backend {
+    BACKEND_EXACT,      // full 2D kernel, apply_blur
+    BACKEND_SEPARABLE,  // row and column passes through the pipeline engine
+    BACKEND_BINOMIAL,   // integer binomial weights for radius 2 to 4, adds and shifts only
+    BACKEND_BOX,        // three box blurs, O(1) per pixel
+    BACKEND_STACK,      // stack blur, a triangle filter in integers, O(1) per pixel
+    BACKEND_PYRAMID,    // separable blur of a shrunk copy, scaled back up
+    BACKEND_KAWASE,     // Kawase passes on a shrunk copy
+};
+
+static const int BACKEND_COUNT = BACKEND_KAWASE + 1;
+
+const char *backend_name(Backend backend);
+bool parse_backend(const char *name, Backend &backend);
+
+// whether the backend can blur this radius, the binomial one only radius 2 to 4
+bool backend_supports(Backend backend, int radius);
+
+// the backend without --backend or --budget-ms: the binomial fast path where it blurs the radius, exact
+// otherwise
+Backend default_backend(int radius);
+
+// blurs width x height pixels with radius and sigma default_sigma(radius), returns false if cancelled.
+// stats is only filled in by the exact backend, the one that skips uniform tiles.
+bool run_backend(Backend backend, int width, int height, const Pixel *image, Pixel *output, int radius,
+                 int num_threads, int band_height, EdgeMode edge, JobControl *control = NULL,
+                 BlurStats *stats = NULL);
+
+// Seconds for each piece of work the backends are made of, measured on this machine by timing the pieces
+// on small frames. Predictions add up the pieces a backend runs for the given size and radius, so the
+// shrinking backends' fixed cost and the others' per tap cost are each taken from a run where it dominates.
+struct CostModel {
+    double exact_tap;          // one 2D kernel tap of one pixel, all channels
+    double separable_pixel;    // converting a pixel in and out of the pipeline's float rows
+    double separable_tap;      // one 1D tap of one pixel
+    double binomial_level;     // one [1 1] sum of one pixel in both passes, widening and narrowing are one each
+    double box_pixel;          // all three box passes of one pixel
+    double stack_pixel;        // one stack blur pass, rows and columns, of one pixel
+    double resize_pixel;       // shrinking to a small frame and growing back, per full size pixel
+    double kawase_pass_pixel;  // one Kawase pass of one pixel of the small frame
+    double fresh_byte;         // first touch of newly allocated memory, the page faults and the zeroing
+    int parallelism;           // threads that actually run at once
+    double calibration_seconds;
+};
+
+CostModel calibrate_cost_model(int num_threads);
+
+double predict_seconds(const CostModel &model, Backend backend, int width, int height, int radius,
+                       int band_height);
+
+// the best quality backend for the radius predicted to finish within budget_seconds, or the fastest one if
+// none is
+Backend choose_backend(const CostModel &model, int width, int height, int radius, int band_height,
+                       double budget_seconds);
+
+#endif
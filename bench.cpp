@@ -0,0 +1,312 @@
+/*
+Benchmarks
+----------
+Times every backend over a small corpus of synthetic frames (plus cat.bmp when it is there) and prints
+the median of a few runs. This is also the training run for the PGO build.
+
+Usage: ./blur_bench [repeats] [filter]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "approx.h"
+#include "backends.h"
+#include "blur.h"
+#include "bmp.h"
+#include "codec.h"
+#include "effects.h"
+#include "kernels.h"
+#include "pipeline.h"
+#include "resize.h"
+
+using namespace std;
+
+struct Frame {
+    string name;
+    int width, height;
+    vector<Pixel> pixels;
+};
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Frame synthetic_frame(const string &name, int width, int height) {
+    Frame frame = {name, width, height, vector<Pixel>((size_t)width * height)};
+    uint32_t state = width * 7919 + height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            state = state * 1664525u + 1013904223u;
+            Pixel &p = frame.pixels[(size_t)y * width + x];
+            p.red = (x * 255) / width;
+            p.green = ((x / 16 + y / 16) % 2) ? 200 : 40;
+            p.blue = state >> 24;
+        }
+    }
+    return frame;
+}
+
+static bool load_frame(const char *path, Frame &frame) {
+    ifstream file(path, ios::binary);
+    BMPHeader header;
+    if (!file || !read_bmp_file(file, header)) {
+        return false;
+    }
+    frame.name = path;
+    frame.width = header.biWidth;
+    frame.height = header.biHeight;
+    frame.pixels.resize((size_t)frame.width * frame.height);
+    load_image(file, header, frame.pixels.data());
+    return true;
+}
+
+// runs body `repeats` times and prints the median, in ms and megapixels per second
+static void bench(const string &name, const Frame &frame, int repeats, const string &filter,
+                  const function<void()> &body) {
+    string label = name + " " + frame.name;
+    if (!filter.empty() && label.find(filter) == string::npos) {
+        return;
+    }
+
+    vector<double> times;
+    for (int i = 0; i < repeats; i++) {
+        double start = now_seconds();
+        body();
+        times.push_back(now_seconds() - start);
+    }
+    sort(times.begin(), times.end());
+    double median = times[times.size() / 2];
+
+    printf("%-40s %10.2f ms %10.1f MP/s\n", label.c_str(), median * 1e3,
+           (double)frame.width * frame.height / 1e6 / median);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    int repeats = argc > 1 ? max(atoi(argv[1]), 1) : 5;
+    string filter = argc > 2 ? argv[2] : "";
+    const int threads = 4;
+
+    vector<Frame> corpus;
+    corpus.push_back(synthetic_frame("640x480", 640, 480));
+    corpus.push_back(synthetic_frame("1921x1081", 1921, 1081));
+    Frame cat;
+    if (load_frame("cat.bmp", cat)) {
+        corpus.push_back(cat);
+    }
+
+    // kernel setup on its own, the frame is the kernel so MP/s counts taps
+    for (int radius : {20, 200}) {
+        Frame taps;
+        taps.name = "taps";
+        taps.width = taps.height = 2 * radius + 1;
+        bench("kernel 2d r=" + to_string(radius), taps, repeats, filter, [&] { gen_gaussian_kernel(radius); });
+        bench("kernel 2d threaded r=" + to_string(radius), taps, repeats, filter,
+              [&] { gen_gaussian_kernel(radius, threads); });
+        taps.height = 1;
+        bench("kernel 1d r=" + to_string(radius), taps, repeats, filter,
+              [&] { gen_gaussian_kernel_1d(radius, default_sigma(radius)); });
+    }
+
+    // a mostly flat page, the exact blur fills its uniform tiles instead of running the kernel over them
+    {
+        Frame page = synthetic_frame("page 1921x1081", 1921, 1081);
+        for (int y = 0; y < page.height; y++) {
+            for (int x = 0; x < page.width; x++) {
+                if (y < 400 || y >= 500 || x >= 1200) {
+                    page.pixels[(size_t)y * page.width + x] = {240, 238, 232};
+                }
+            }
+        }
+        vector<Pixel> output(page.pixels.size());
+        BMPHeader header = make_bmp_header(page.width, page.height);
+        auto kernel = gen_gaussian_kernel(5);
+        bench("exact r=5", page, repeats, filter,
+              [&] { blur_image(header, page.pixels.data(), output.data(), kernel, threads, EDGE_ZERO); });
+    }
+
+    for (const Frame &frame : corpus) {
+        vector<Pixel> input = frame.pixels;
+        vector<Pixel> output(input.size());
+        BMPHeader header = make_bmp_header(frame.width, frame.height);
+
+        for (int radius : {2, 5}) {
+            auto kernel = gen_gaussian_kernel(radius);
+            bench("exact r=" + to_string(radius), frame, repeats, filter,
+                  [&] { blur_image(header, input.data(), output.data(), kernel, threads, EDGE_ZERO); });
+        }
+
+        // the separable passes once per instruction set, to compare the vector widths
+        for (SimdLevel level : {SIMD_SCALAR, SIMD_SSE, SIMD_AVX2, SIMD_AVX512}) {
+            if (!simd_supported(level)) {
+                continue;
+            }
+            set_simd_level(level);
+            for (int radius : {2, 5, 20, 60}) {
+                Pipeline pipeline(frame.width, frame.height);
+                pipeline.threads(threads).blur(radius);
+                bench("separable r=" + to_string(radius) + " " + simd_level_name(level), frame, repeats, filter,
+                      [&] { pipeline.run(input.data(), output.data()); });
+            }
+        }
+        set_simd_level(best_simd_level());
+
+        // a rotated gaussian costs about what the separable one of its larger sigma does
+        {
+            Pipeline pipeline(frame.width, frame.height);
+            pipeline.threads(threads).rotated_blur(6.0, 2.0, 30.0);
+            bench("rotated 6x2 at 30", frame, repeats, filter, [&] { pipeline.run(input.data(), output.data()); });
+        }
+
+        // the mask rides along as a fourth channel, against separable r=20 above
+        {
+            vector<uint8_t> mask(input.size());
+            for (size_t i = 0; i < mask.size(); i++) {
+                mask[i] = (i / 64) % 3 ? 255 : 0;
+            }
+            Pipeline pipeline(frame.width, frame.height);
+            pipeline.threads(threads).masked_blur(20, mask.data());
+            bench("masked r=20", frame, repeats, filter, [&] { pipeline.run(input.data(), output.data()); });
+        }
+
+        // a subject over the middle third, its tiles are copied rather than blurred
+        {
+            vector<uint8_t> subject(input.size());
+            for (int y = 0; y < frame.height; y++) {
+                for (int x = 0; x < frame.width; x++) {
+                    bool inside = 3 * x > frame.width && 3 * x < 2 * frame.width;
+                    subject[(size_t)y * frame.width + x] = inside ? 255 : 0;
+                }
+            }
+            Pipeline pipeline(frame.width, frame.height);
+            pipeline.threads(threads).background_blur(20, subject.data(), 4);
+            bench("background r=20", frame, repeats, filter, [&] { pipeline.run(input.data(), output.data()); });
+        }
+
+        // a glow of radius 60 costs a few small blurs, against separable r=60 above for one
+        bench("bloom r=60", frame, repeats, filter, [&] {
+            bloom(frame.width, frame.height, input.data(), output.data(), 60, 180.0f, 1.0f, threads, 32, EDGE_CLAMP);
+        });
+
+        // the guided filter is a few box passes over eight channels, its cost shouldn't grow with the radius
+        for (int radius : {4, 60}) {
+            bench("guided r=" + to_string(radius), frame, repeats, filter, [&] {
+                guided_filter(frame.width, frame.height, input.data(), input.data(), output.data(), radius, 0.01f,
+                              threads);
+            });
+        }
+
+        // non-local means is O(search window) per pixel, the larger patch should cost about the same
+        for (int patch : {1, 3}) {
+            bench("nl means 7x7 patch=" + to_string(patch), frame, repeats, filter, [&] {
+                nl_means(frame.width, frame.height, input.data(), output.data(), 10.0f, 3, patch, threads);
+            });
+        }
+
+        // shadows blur only the alpha, against stack r=20 below for all three channels
+        {
+            vector<uint8_t> alpha(input.size()), shadow(input.size());
+            for (size_t i = 0; i < alpha.size(); i++) {
+                alpha[i] = input[i].green;
+            }
+            bench("shadow plane r=20", frame, repeats, filter, [&] {
+                stack_blur_plane(frame.width, frame.height, alpha.data(), shadow.data(), default_sigma(20), threads,
+                                 EDGE_ZERO);
+            });
+        }
+
+        // the integer fast path for the small radii, against exact and separable r=2 above
+        for (int radius : {2, 4}) {
+            bench("binomial r=" + to_string(radius), frame, repeats, filter, [&] {
+                run_backend(BACKEND_BINOMIAL, frame.width, frame.height, input.data(), output.data(), radius, threads,
+                            32, EDGE_ZERO);
+            });
+        }
+
+        // the approximate backends, their cost should hardly grow with the radius
+        for (Backend backend : {BACKEND_BOX, BACKEND_STACK, BACKEND_PYRAMID, BACKEND_KAWASE}) {
+            for (int radius : {5, 20, 60}) {
+                bench(string(backend_name(backend)) + " r=" + to_string(radius), frame, repeats, filter, [&] {
+                    run_backend(backend, frame.width, frame.height, input.data(), output.data(), radius, threads, 32,
+                                EDGE_ZERO);
+                });
+            }
+        }
+
+        // single threaded pixel format conversions, these must stay well ahead of the blur
+        {
+            size_t pixels = input.size();
+            const uint8_t *packed = (const uint8_t *)input.data();
+            vector<float> floats(pixels * 3);
+            vector<uint8_t> bytes(pixels * 3), planes(pixels * 3);
+            uint8_t *c0 = planes.data(), *c1 = c0 + pixels, *c2 = c1 + pixels;
+
+            for (SimdLevel level : {SIMD_SCALAR, SIMD_SSE, SIMD_AVX2, SIMD_AVX512}) {
+                if (!simd_supported(level)) {
+                    continue;
+                }
+                const RowKernels &k = row_kernels(level);
+                string suffix = string(" ") + simd_level_name(level);
+
+                bench("u8 -> f32" + suffix, frame, repeats, filter,
+                      [&] { k.bytes_to_floats(packed, floats.data(), pixels * 3); });
+                bench("f32 -> u8" + suffix, frame, repeats, filter,
+                      [&] { k.floats_to_bytes(floats.data(), bytes.data(), pixels * 3); });
+                bench("rgb -> planar" + suffix, frame, repeats, filter,
+                      [&] { k.rgb_to_planar(packed, c0, c1, c2, pixels); });
+                bench("planar -> rgb" + suffix, frame, repeats, filter,
+                      [&] { k.planar_to_rgb(c0, c1, c2, (uint8_t *)output.data(), pixels); });
+            }
+        }
+
+        {
+            Pipeline pipeline(frame.width, frame.height);
+            pipeline.threads(threads).blur(5).unsharp(2, 0.8f).downscale(2).adjust(5, 1.1f, 1.2f);
+            vector<Pixel> small((size_t)pipeline.output_width() * pipeline.output_height());
+            bench("pipeline blur+unsharp+down+adjust", frame, repeats, filter,
+                  [&] { pipeline.run(input.data(), small.data()); });
+        }
+
+        for (ResizeFilter resize_filter : {FILTER_AREA, FILTER_BICUBIC, FILTER_LANCZOS}) {
+            const char *names[] = {"area", "bicubic", "lanczos"};
+            Pipeline pipeline(frame.width, frame.height);
+            pipeline.threads(threads).resize(frame.width / 3, frame.height / 3, resize_filter, 2.0);
+            vector<Pixel> small((size_t)pipeline.output_width() * pipeline.output_height());
+            bench(string("resize 1/3 ") + names[resize_filter], frame, repeats, filter,
+                  [&] { pipeline.run(input.data(), small.data()); });
+        }
+
+        {
+            StreamEncoder encoder(FORMAT_QOI, frame.width, frame.height);
+            string encoded;
+            encoder.header(encoded);
+            encoder.rows(input.data(), 0, frame.height, encoded);
+            encoder.finish(encoded);
+
+            bench("qoi decode", frame, repeats, filter, [&] {
+                StreamDecoder decoder([&](int, int) { return output.data(); });
+                decoder.feed((const uint8_t *)encoded.data(), encoded.size());
+            });
+            bench("qoi encode", frame, repeats, filter, [&] {
+                StreamEncoder again(FORMAT_QOI, frame.width, frame.height);
+                string out;
+                again.header(out);
+                again.rows(input.data(), 0, frame.height, out);
+                again.finish(out);
+            });
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include "blur.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+UniformTiles find_uniform_tiles(const Pixel *image, int width, int height, int radius, EdgeMode edge,
+                                int tile_size) {
+    UniformTiles tiles;
+    tiles.size = tile_size;
+    tiles.columns = (width + tile_size - 1) / tile_size;
+    tiles.rows = (height + tile_size - 1) / tile_size;
+    tiles.uniform.assign((size_t)tiles.columns * tiles.rows, 0);
+    tiles.skipped_pixels = 0;
+
+    // each tile's own colour packed into 24 bits, or -1 when it has detail
+    vector<int32_t> colour(tiles.uniform.size());
+    for (int ty = 0; ty < tiles.rows; ty++) {
+        int y0 = ty * tile_size, y1 = min(y0 + tile_size, height);
+        for (int tx = 0; tx < tiles.columns; tx++) {
+            int x0 = tx * tile_size, x1 = min(x0 + tile_size, width);
+            const Pixel first = image[(size_t)y0 * width + x0];
+            bool flat = true;
+            for (int y = y0; y < y1 && flat; y++) {
+                const Pixel *row = image + (size_t)y * width;
+                for (int x = x0; x < x1; x++) {
+                    if (row[x].red != first.red || row[x].green != first.green || row[x].blue != first.blue) {
+                        flat = false;
+                        break;
+                    }
+                }
+            }
+            colour[(size_t)ty * tiles.columns + tx] = flat ? first.red | first.green << 8 | first.blue << 16 : -1;
+        }
+    }
+
+    for (int ty = 0; ty < tiles.rows; ty++) {
+        int y0 = ty * tile_size, y1 = min(y0 + tile_size, height);
+        for (int tx = 0; tx < tiles.columns; tx++) {
+            int x0 = tx * tile_size, x1 = min(x0 + tile_size, width);
+            int32_t own = colour[(size_t)ty * tiles.columns + tx];
+            if (own < 0) {
+                continue;
+            }
+            if (edge == EDGE_ZERO && (x0 - radius < 0 || y0 - radius < 0 || x1 + radius > width ||
+                                      y1 + radius > height)) {
+                continue;
+            }
+
+            // the tiles under the apron, clamped taps only ever read pixels inside it
+            int first_column = max(x0 - radius, 0) / tile_size, last_column = (min(x1 + radius, width) - 1) / tile_size;
+            int first_row = max(y0 - radius, 0) / tile_size, last_row = (min(y1 + radius, height) - 1) / tile_size;
+            bool uniform = true;
+            for (int ay = first_row; ay <= last_row && uniform; ay++) {
+                for (int ax = first_column; ax <= last_column; ax++) {
+                    if (colour[(size_t)ay * tiles.columns + ax] != own) {
+                        uniform = false;
+                        break;
+                    }
+                }
+            }
+            if (uniform) {
+                tiles.uniform[(size_t)ty * tiles.columns + tx] = 1;
+                tiles.skipped_pixels += (long long)(x1 - x0) * (y1 - y0);
+            }
+        }
+    }
+    return tiles;
+}
+
+bool blur_image(BMPHeader &header, Pixel *image, Pixel *blurred_image, vector<vector<double>> &kernel,
+                int num_threads, EdgeMode edge, JobControl *control, BlurStats *stats) {
+    long long total = (long long)header.biWidth * header.biHeight;
+    int radius = kernel.size() / 2;
+
+    UniformTiles tiles = find_uniform_tiles(image, header.biWidth, header.biHeight, radius, edge);
+
+    // A uniform tile's pixels all see every tap at the same value v, so they get what apply_blur sums for v in
+    // its own tap order, byte for byte. Only the values that actually fill a tile are worked out.
+    bool needed[256] = {};
+    for (int ty = 0; ty < tiles.rows; ty++) {
+        for (int tx = 0; tx < tiles.columns; tx++) {
+            if (tiles.uniform[(size_t)ty * tiles.columns + tx]) {
+                const Pixel &p = image[(size_t)ty * tiles.size * header.biWidth + tx * tiles.size];
+                needed[p.red] = needed[p.green] = needed[p.blue] = true;
+            }
+        }
+    }
+    uint8_t flat_values[256] = {};
+    for (int v = 0; v < 256; v++) {
+        if (!needed[v]) {
+            continue;
+        }
+        double sum = 0;
+        for (const vector<double> &row : kernel) {
+            for (double weight : row) {
+                sum += v * weight;
+            }
+        }
+        flat_values[v] = sum;
+    }
+
+    vector<BlurParams> params(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        params[i] = {header, image, blurred_image, kernel, (int)(total * i / num_threads),
+                     (int)(total * (i + 1) / num_threads), edge, control, &tiles, flat_values};
+    }
+
+    run_threads(params, apply_blur);
+
+    if (stats) {
+        stats->pixels = total;
+        stats->skipped_pixels = tiles.skipped_pixels;
+    }
+    return control == NULL || !control->cancelled();
+}
+
+HOT_KERNEL void *apply_blur(void *params) {
+    BlurParams *blur_params = (BlurParams *)params;
+    BMPHeader header = blur_params->header;
+    Pixel *image = blur_params->image;
+    Pixel *blurred_image = blur_params->blurred_image;
+    const vector<vector<double>> &kernel = blur_params->kernel;
+    const UniformTiles *tiles = blur_params->tiles;
+    const uint8_t *flat_values = blur_params->flat_values;
+
+    int kernel_size = kernel.size();
+    int radius = kernel_size / 2;
+
+    int width = header.biWidth;
+    int height = header.biHeight;
+
+    JobControl *control = blur_params->control;
+
+    // a thread's segment is cut into row pieces, so the cancel check and progress happen once per row
+    for (int row_start = blur_params->start; row_start < blur_params->end;) {
+        int row_end = min((row_start / width + 1) * width, blur_params->end);
+        if (control && control->cancelled()) {
+            break;
+        }
+
+        // and the row pieces into tile spans, a uniform one is filled without looking at the kernel
+        for (int i = row_start; i < row_end;) {
+            int span_end = row_end;
+            if (tiles) {
+                int x = i % width, y = i / width;
+                int column = x / tiles->size;
+                span_end = min(row_end, i - x + (column + 1) * tiles->size);
+                if (tiles->uniform[(size_t)(y / tiles->size) * tiles->columns + column]) {
+                    Pixel filled = {flat_values[image[i].red], flat_values[image[i].green],
+                                    flat_values[image[i].blue]};
+                    fill(blurred_image + i, blurred_image + span_end, filled);
+                    i = span_end;
+                    continue;
+                }
+            }
+
+            for (; i < span_end; i++) {
+                double red = 0, green = 0, blue = 0;
+
+                for (int r = -radius; r <= radius; r++) {
+                    for (int c = -radius; c <= radius; c++) {
+                        int x = i % width + c, y = i / width + r;
+                        if (x < 0 || x >= width || y < 0 || y >= height) {
+                            if (blur_params->edge == EDGE_ZERO) {
+                                continue;
+                            }
+                            x = min(max(x, 0), width - 1);
+                            y = min(max(y, 0), height - 1);
+                        }
+
+                        Pixel *sample = image + y * width + x;
+
+                        double weight = kernel[r + radius][c + radius];
+
+                        red += sample->red * weight;
+                        green += sample->green * weight;
+                        blue += sample->blue * weight;
+                    }
+                }
+
+                Pixel *blurred_pixel = blurred_image + i;
+                blurred_pixel->red = red;
+                blurred_pixel->green = green;
+                blurred_pixel->blue = blue;
+            }
+        }
+
+        if (control) {
+            control->add_done(row_end - row_start);
+        }
+        row_start = row_end;
+    }
+
+    pthread_exit(0);
+}
+
+double default_sigma(int radius) {
+    // https://stackoverflow.com/questions/17841098/gaussian-blur-standard-deviation-radius-and-kernel-size
+    // https://developer.nvidia.com/gpugems/gpugems3/part-vi-gpu-computing/chapter-40-incremental-computation-gaussian
+    return radius / 3.0;
+}
+
+// GPU Gems 3 ch. 40: exp(-(x + 1)^2 / 2 sigma^2) = exp(-x^2 / 2 sigma^2) * g1 * g2^x with
+// g1 = exp(-1 / 2 sigma^2) and g2 = g1^2, so the whole row of weights costs one exp() and two multiplies a tap
+vector<double> gaussian_weights(int radius, double sigma) {
+    vector<double> weights(2 * radius + 1);
+    double g0 = 1.0, g1 = exp(-1.0 / (2 * sigma * sigma)), g2 = g1 * g1;
+
+    for (int i = 0; i <= radius; i++) {
+        weights[radius + i] = weights[radius - i] = g0;
+        g0 *= g1;
+        g1 *= g2;
+    }
+    return weights;
+}
+
+struct KernelRowsParams {
+    const vector<double> *weights;
+    vector<vector<double>> *kernel;
+    int begin, end;
+};
+
+static void *fill_kernel_rows(void *params) {
+    KernelRowsParams *p = (KernelRowsParams *)params;
+    const vector<double> &weights = *p->weights;
+    for (int i = p->begin; i < p->end; i++) {
+        vector<double> &row = (*p->kernel)[i];
+        row.resize(weights.size());
+        for (size_t j = 0; j < weights.size(); j++) {
+            row[j] = weights[i] * weights[j];
+        }
+    }
+    return NULL;
+}
+
+// the 2D gaussian is the outer product of the normalised 1D weights, which also makes it sum to one
+vector<vector<double>> gen_gaussian_kernel(int radius, int num_threads) {
+    int kernel_size = 2 * radius + 1;
+
+    // a radius 0 blur is the identity, sigma = 0 would divide by zero below
+    if (radius == 0) {
+        return vector<vector<double>>(1, vector<double>(1, 1.0));
+    }
+
+    vector<double> weights = gaussian_weights(radius, default_sigma(radius));
+    double sum = 0;
+    for (double weight : weights) {
+        sum += weight;
+    }
+    for (double &weight : weights) {
+        weight /= sum;
+    }
+
+    // small kernels aren't worth starting threads for, a radius 200 one is 160k taps
+    vector<vector<double>> kernel(kernel_size);
+    num_threads = kernel_size * kernel_size < 64 * 1024 ? 1 : min(num_threads, kernel_size);
+    vector<KernelRowsParams> params(max(num_threads, 1));
+    for (size_t i = 0; i < params.size(); i++) {
+        params[i] = {&weights, &kernel, (int)(kernel_size * i / params.size()),
+                     (int)(kernel_size * (i + 1) / params.size())};
+    }
+    if (params.size() == 1) {
+        fill_kernel_rows(&params[0]);
+    } else {
+        run_threads(params, fill_kernel_rows);
+    }
+    return kernel;
+}
+
+vector<float> gen_gaussian_kernel_1d(int radius, double sigma) {
+    vector<float> kernel(2 * radius + 1, 0.0f);
+    if (radius == 0 || sigma <= 0) {
+        kernel[radius] = 1.0f;
+        return kernel;
+    }
+
+    vector<double> weights = gaussian_weights(radius, sigma);
+
+    // the 2D kernel is the outer product of this one, so normalising both gives the same weights
+    double sum = 0;
+    for (double weight : weights) {
+        sum += weight;
+    }
+
+    for (int i = 0; i < 2 * radius + 1; i++) {
+        kernel[i] = weights[i] / sum;
+    }
+    return kernel;
+}
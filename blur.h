@@ -0,0 +1,103 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <pthread.h>
+
+#include <vector>
+
+#include "bmp.h"
+#include "job.h"
+
+// Every engine computes each output pixel from its own inputs in a fixed tap order, so the result is
+// byte for byte the same whatever the thread count or band size. Reassociating float math breaks that.
+#if defined(__FAST_MATH__)
+#error "the blur engines must not be built with -ffast-math, it makes the output depend on the partitioning"
+#endif
+
+// Hot kernels are compiled for AVX-512, AVX2 and plain x86-64 and the loader picks the widest one the CPU
+// has, so distributed binaries use the wide units without -march=native. Only the vector width changes,
+// the arithmetic (and so the output) is the same in every clone.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define HOT_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define HOT_KERNEL
+#endif
+
+// what a kernel tap reads when it falls outside the image
+enum EdgeMode {
+    EDGE_ZERO,   // outside pixels are black (the original behaviour, darkens the border)
+    EDGE_CLAMP,  // outside pixels repeat the nearest edge pixel
+};
+
+// Output tiles whose pixels, and every pixel the kernel reaches from them, are one colour. Blurring such a
+// tile only reproduces that colour (through the kernel's rounding), so the exact backend fills them instead.
+static const int UNIFORM_TILE_SIZE = 32;
+
+struct UniformTiles {
+    int size, columns, rows;
+    std::vector<uint8_t> uniform;  // columns * rows flags, row major
+    long long skipped_pixels;      // output pixels inside the uniform tiles
+};
+
+// one pass over the image for the colour of each tile, then each tile looks at the tiles its apron covers.
+// With EDGE_ZERO the black outside counts as detail, so tiles within radius of the border are never uniform.
+UniformTiles find_uniform_tiles(const Pixel *image, int width, int height, int radius, EdgeMode edge,
+                                int tile_size = UNIFORM_TILE_SIZE);
+
+// what a blur_image call skipped, for reporting
+struct BlurStats {
+    long long pixels;
+    long long skipped_pixels;
+};
+
+struct BlurParams {
+    BMPHeader header;
+    Pixel *image;
+    Pixel *blurred_image;
+    std::vector<std::vector<double>> kernel;
+    int start;
+    int end;
+    EdgeMode edge;
+    JobControl *control;         // NULL when nobody is watching
+    const UniformTiles *tiles;   // NULL blurs every pixel
+    const uint8_t *flat_values;  // what a channel of value v blurs to in a uniform tile
+};
+
+// exp(-x^2 / 2 sigma^2) for x in [-radius, radius], not normalised, from one exp() call
+std::vector<double> gaussian_weights(int radius, double sigma);
+
+// normalised (2 * radius + 1)^2 kernel with sigma default_sigma(radius), large ones are filled by num_threads
+std::vector<std::vector<double>> gen_gaussian_kernel(int radius, int num_threads = 1);
+
+// normalised 1D gaussian with 2 * radius + 1 taps, the separable half of gen_gaussian_kernel
+std::vector<float> gen_gaussian_kernel_1d(int radius, double sigma);
+
+// nvidia uses sigma = radius / 3.0
+double default_sigma(int radius);
+
+void *apply_blur(void *params);
+
+// splits the image into num_threads equal segments and runs apply_blur on each, returns false if control
+// was cancelled before every row was done. Uniform tiles are filled rather than blurred, stats (when given)
+// says how much of the frame that was.
+bool blur_image(BMPHeader &header, Pixel *image, Pixel *blurred_image, std::vector<std::vector<double>> &kernel,
+                int num_threads, EdgeMode edge, JobControl *control = NULL, BlurStats *stats = NULL);
+
+// runs worker once per element of params, each on its own thread, and waits for all of them
+template <typename Params>
+void run_threads(std::vector<Params> &params, void *(*worker)(void *)) {
+    std::vector<pthread_t> threads(params.size());
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    for (size_t i = 0; i < params.size(); i++) {
+        pthread_create(&threads[i], &attr, worker, &params[i]);
+    }
+    for (size_t i = 0; i < params.size(); i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+#endif
@@ -0,0 +1,370 @@
+#include "bmp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// rows per read or write when going through a stream, so the I/O is a few large calls and not one per row
+static const int SLAB_ROWS = 64;
+
+// the header as it is written, the pixel array always follows the 54 byte header directly
+static BMPHeader file_header(const BMPHeader &header) {
+    BMPHeader out = header;
+    out.bfOffBits = sizeof(BMPHeader);
+    out.biSize = 40;
+    out.biSizeImage = bmp_row_stride(header.biWidth) * header.biHeight;
+    out.bfSize = out.bfOffBits + out.biSizeImage;
+    return out;
+}
+
+int bmp_row_stride(int width) { return (width * 3 + 3) & ~3; }
+
+void unpad_rows(const uint8_t *src, Pixel *dst, int width, int height) {
+    size_t row_size = (size_t)width * sizeof(Pixel);
+    int stride = bmp_row_stride(width);
+
+    // without padding the pixel array already is the packed image
+    if ((int)row_size == stride) {
+        memcpy(dst, src, row_size * height);
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(dst + (size_t)y * width, src + (size_t)y * stride, row_size);
+    }
+}
+
+void pad_rows(const Pixel *src, uint8_t *dst, int width, int height) {
+    size_t row_size = (size_t)width * sizeof(Pixel);
+    int stride = bmp_row_stride(width);
+
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = dst + (size_t)y * stride;
+        memcpy(row, src + (size_t)y * width, row_size);
+        memset(row + row_size, 0, stride - row_size);  // BMP padding is zeroed
+    }
+}
+
+void save_image(ofstream &file, BMPHeader &header, Pixel *image) {
+    BMPHeader out = file_header(header);
+    file.write(reinterpret_cast<char *>(&out), sizeof(BMPHeader));
+
+    int width = header.biWidth, height = header.biHeight;
+    int stride = bmp_row_stride(width);
+    vector<uint8_t> slab((size_t)stride * min(height, SLAB_ROWS));
+
+    for (int y = 0; y < height; y += SLAB_ROWS) {
+        int rows = min(SLAB_ROWS, height - y);
+        pad_rows(image + (size_t)y * width, slab.data(), width, rows);
+        file.write((char *)slab.data(), (size_t)stride * rows);
+    }
+}
+
+void load_image(ifstream &file, BMPHeader &header, Pixel *image) {
+    file.seekg(header.bfOffBits, ios::beg);
+
+    // https://en.wikipedia.org/wiki/BMP_file_format#Pixel_storage
+    // http://www.dragonwins.com/domains/getteched/bmp/bmpfileformat.htm#The%20Pixel%20Data
+    int width = header.biWidth, height = header.biHeight;
+    int stride = bmp_row_stride(width);
+    vector<uint8_t> slab((size_t)stride * min(height, SLAB_ROWS));
+
+    for (int y = 0; y < height; y += SLAB_ROWS) {
+        int rows = min(SLAB_ROWS, height - y);
+        file.read((char *)slab.data(), (size_t)stride * rows);
+        unpad_rows(slab.data(), image + (size_t)y * width, width, rows);
+    }
+}
+
+bool read_bmp_file(ifstream &file, BMPHeader &header) {
+    // Read the BMP header
+    file.read(reinterpret_cast<char *>(&header), sizeof(BMPHeader));
+
+    if (!file) {
+        cerr << "Error: Unable to read BMP header.\n";
+        return false;
+    }
+
+    // Validate BMP file type
+    // BM in little-endian
+    if (header.bfType != 0x4D42) {
+        cerr << "Error: Not a valid BMP file.\n";
+        return false;
+    }
+
+    if (header.biBitCount != 24) {
+        cerr << "We only support 24-bit BMP files!\n";
+        return false;
+    }
+
+    return true;
+}
+
+MappedFile::MappedFile(const string &path) : data_(NULL), size_(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+            data_ = (const uint8_t *)mapping;
+            size_ = info.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap((void *)data_, size_);
+    }
+}
+
+bool read_bmp_file(const MappedFile &file, BMPHeader &header) {
+    if (file.data() == NULL || file.size() < sizeof(BMPHeader)) {
+        cerr << "Error: Unable to read BMP header.\n";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(BMPHeader));
+
+    if (header.bfType != 0x4D42) {
+        cerr << "Error: Not a valid BMP file.\n";
+        return false;
+    }
+
+    if (header.biBitCount != 24) {
+        cerr << "We only support 24-bit BMP files!\n";
+        return false;
+    }
+
+    if (header.bfOffBits + (unsigned long long)bmp_row_stride(header.biWidth) * header.biHeight > file.size()) {
+        cerr << "Error: BMP pixel data is truncated.\n";
+        return false;
+    }
+
+    return true;
+}
+
+void load_image(const MappedFile &file, const BMPHeader &header, Pixel *image) {
+    unpad_rows(file.data() + header.bfOffBits, image, header.biWidth, header.biHeight);
+}
+
+bool save_image(const string &path, const BMPHeader &header, const Pixel *image) {
+    BMPHeader out = file_header(header);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, out.bfSize) < 0) {
+        cerr << "Error: Unable to write " << path << ": " << strerror(errno) << '\n';
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    void *mapping = mmap(NULL, out.bfSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Error: Unable to map " << path << ": " << strerror(errno) << '\n';
+        return false;
+    }
+
+    uint8_t *data = (uint8_t *)mapping;
+    memcpy(data, &out, sizeof(BMPHeader));
+    pad_rows(image, data + out.bfOffBits, header.biWidth, header.biHeight);
+    munmap(mapping, out.bfSize);
+    return true;
+}
+
+bool load_mask(const MappedFile &file, int width, int height, vector<uint8_t> &mask) {
+    BMPHeader header;
+    if (file.data() == NULL || file.size() < sizeof(BMPHeader)) {
+        cerr << "Error: Unable to read the mask's BMP header.\n";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(BMPHeader));
+
+    if (header.bfType != 0x4D42 || header.biCompression != 0 ||
+        (header.biBitCount != 8 && header.biBitCount != 24)) {
+        cerr << "Error: The mask must be an uncompressed 8-bit or 24-bit BMP.\n";
+        return false;
+    }
+    if ((int)header.biWidth != width || (int)header.biHeight != height) {
+        cerr << "Error: The mask is " << header.biWidth << "x" << header.biHeight << ", the image " << width << "x"
+             << height << ".\n";
+        return false;
+    }
+
+    int bytes = header.biBitCount / 8;
+    int stride = (width * bytes + 3) & ~3;
+    if (header.bfOffBits + (unsigned long long)stride * height > file.size()) {
+        cerr << "Error: The mask's pixel data is truncated.\n";
+        return false;
+    }
+
+    // 8-bit rows index a palette of BGRX entries that follows the info header
+    uint8_t grey[256];
+    for (int i = 0; i < 256; i++) {
+        grey[i] = i;
+    }
+    if (bytes == 1) {
+        size_t palette = 14 + header.biSize;
+        int entries = header.biClrUsed ? min(header.biClrUsed, 256u) : 256;
+        if (palette + entries * 4 > header.bfOffBits) {
+            cerr << "Error: The mask's palette is truncated.\n";
+            return false;
+        }
+        for (int i = 0; i < entries; i++) {
+            const uint8_t *entry = file.data() + palette + i * 4;
+            grey[i] = (entry[0] + entry[1] + entry[2]) / 3;
+        }
+    }
+
+    mask.resize((size_t)width * height);
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = file.data() + header.bfOffBits + (size_t)y * stride;
+        uint8_t *dst = mask.data() + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            const uint8_t *p = row + x * bytes;
+            dst[x] = bytes == 1 ? grey[p[0]] : (p[0] + p[1] + p[2]) / 3;
+        }
+    }
+    return true;
+}
+
+bool load_alpha(const MappedFile &file, BMPHeader &header, vector<uint8_t> &alpha) {
+    if (file.data() == NULL || file.size() < sizeof(BMPHeader)) {
+        cerr << "Error: Unable to read BMP header.\n";
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(BMPHeader));
+
+    if (header.bfType != 0x4D42) {
+        cerr << "Error: Not a valid BMP file.\n";
+        return false;
+    }
+    if (header.biBitCount != 32 || (header.biCompression != 0 && header.biCompression != 3)) {
+        cerr << "Error: Shadows need an uncompressed 32-bit BMP with alpha.\n";
+        return false;
+    }
+
+    // the V4 and V5 headers hold the red, green, blue and alpha masks right after the 40 byte part
+    uint32_t alpha_mask = 0xFF000000u;
+    if (header.biCompression == 3 && header.biSize >= 56 && file.size() >= sizeof(BMPHeader) + 16) {
+        memcpy(&alpha_mask, file.data() + sizeof(BMPHeader) + 12, sizeof(alpha_mask));
+    }
+    int shift = 0;
+    while (shift < 32 && ((alpha_mask >> shift) & 0xFF) != 0xFF) {
+        shift += 8;
+    }
+    if (shift == 32 || alpha_mask >> shift != 0xFF) {
+        cerr << "Error: The BMP's alpha isn't one whole byte of each pixel.\n";
+        return false;
+    }
+
+    size_t stride = (size_t)header.biWidth * 4;
+    if (header.bfOffBits + (unsigned long long)stride * header.biHeight > file.size()) {
+        cerr << "Error: BMP pixel data is truncated.\n";
+        return false;
+    }
+
+    alpha.resize((size_t)header.biWidth * header.biHeight);
+    const uint8_t *pixels = file.data() + header.bfOffBits + shift / 8;
+    for (size_t i = 0; i < alpha.size(); i++) {
+        alpha[i] = pixels[i * 4];
+    }
+    return true;
+}
+
+bool save_mask(const string &path, int width, int height, const uint8_t *mask) {
+    int stride = (width + 3) & ~3;
+    BMPHeader header = make_bmp_header(width, height);
+    header.biBitCount = 8;
+    header.biClrUsed = 256;
+    header.bfOffBits = sizeof(BMPHeader) + 256 * 4;
+    header.biSizeImage = stride * height;
+    header.bfSize = header.bfOffBits + header.biSizeImage;
+
+    string data((size_t)header.bfSize, '\0');
+    memcpy(&data[0], &header, sizeof(header));
+    for (int i = 0; i < 256; i++) {
+        memset(&data[sizeof(header) + i * 4], i, 3);
+    }
+    for (int y = 0; y < height; y++) {
+        memcpy(&data[header.bfOffBits + (size_t)y * stride], mask + (size_t)y * width, width);
+    }
+
+    ofstream file(path, ios::binary);
+    if (!file.write(data.data(), data.size())) {
+        cerr << "Error: Unable to write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool save_tinted(const string &path, int width, int height, const uint8_t *alpha, Pixel tint) {
+    // the V4 fields past the 40 byte header: four masks, the colour space and unused endpoints and gammas
+    const int v4_extra = 68;
+    BMPHeader header = make_bmp_header(width, height);
+    header.biSize = 40 + v4_extra;
+    header.biBitCount = 32;
+    header.biCompression = 3;
+    header.bfOffBits = sizeof(BMPHeader) + v4_extra;
+    header.biSizeImage = (uint32_t)width * height * 4;
+    header.bfSize = header.bfOffBits + header.biSizeImage;
+
+    string data((size_t)header.bfSize, '\0');
+    memcpy(&data[0], &header, sizeof(header));
+    const uint32_t masks[5] = {0x00FF0000u, 0x0000FF00u, 0x000000FFu, 0xFF000000u, 0x73524742u};  // 'sRGB'
+    memcpy(&data[sizeof(header)], masks, sizeof(masks));
+
+    uint8_t *pixels = (uint8_t *)&data[header.bfOffBits];
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        memcpy(pixels + i * 4, &tint, sizeof(Pixel));
+        pixels[i * 4 + 3] = alpha[i];
+    }
+
+    ofstream file(path, ios::binary);
+    if (!file.write(data.data(), data.size())) {
+        cerr << "Error: Unable to write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool is_valid_file(string &filename) {
+    const string suffix = ".bmp";
+
+    if (filename.size() < suffix.size()) {
+        return false;
+    }
+    return filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+BMPHeader make_bmp_header(int width, int height) {
+    BMPHeader header = {};
+    header.bfType = 0x4D42;
+    header.bfOffBits = sizeof(BMPHeader);
+    header.biSize = 40;
+    header.biWidth = width;
+    header.biHeight = height;
+    header.biPlanes = 1;
+    header.biBitCount = 24;
+    header.biSizeImage = bmp_row_stride(width) * height;
+    header.bfSize = header.bfOffBits + header.biSizeImage;
+    header.biXPelsPerMeter = 2834;  // 72 DPI
+    header.biYPelsPerMeter = 2834;
+    return header;
+}
@@ -0,0 +1,95 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// http://www.dragonwins.com/domains/getteched/bmp/bmpfileformat.htm
+#pragma pack(push, 1)
+struct BMPHeader {
+    uint16_t bfType;
+    uint32_t bfSize;
+    uint32_t reserved;
+    uint32_t bfOffBits;        // offset of the start of the Pixel Data section relative to the start of the file
+    uint32_t biSize;           // Header Size - Must be at least 40
+    uint32_t biWidth;          // Image width in pixels
+    uint32_t biHeight;         // Image height in pixels
+    uint16_t biPlanes;         // Must be 1
+    uint16_t biBitCount;       // Bits per pixel - 1, 4, 8, 16, 24, or 32
+    uint32_t biCompression;    // Compression type (0 = uncompressed)
+    uint32_t biSizeImage;      // Image Size - may be zero for uncompressed images
+    uint32_t biXPelsPerMeter;  // Preferred resolution in pixels per meter
+    uint32_t biYPelsPerMeter;  // Preferred resolution in pixels per meter
+    uint32_t biClrUsed;        // Number Color Map entries that are actually used
+    uint32_t biClrImportant;   // Number of significant colors
+};
+#pragma pack(pop)
+
+// NOTE: the fields are in file order, BMP stores pixels as BGR so `red` actually holds blue.
+// Everything in the engine treats the three bytes as opaque channels, so this never mattered.
+struct Pixel {
+    uint8_t red, green, blue;
+};
+
+// check if it ends in .bmp
+bool is_valid_file(std::string &filename);
+
+bool read_bmp_file(std::ifstream &file, BMPHeader &header);
+
+void load_image(std::ifstream &file, BMPHeader &header, Pixel *image);
+
+void save_image(std::ofstream &file, BMPHeader &header, Pixel *image);
+
+// bytes per row of the pixel array, rows are padded to a multiple of 4
+int bmp_row_stride(int width);
+
+// One linear pass between the padded pixel array of a 24-bit BMP and packed pixels. The padding is
+// skipped on the way in and zeroed on the way out as part of the same row copy.
+void unpad_rows(const uint8_t *src, Pixel *dst, int width, int height);
+void pad_rows(const Pixel *src, uint8_t *dst, int width, int height);
+
+// read-only mmap of a whole file, data() is NULL if it couldn't be opened or mapped
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    const uint8_t *data_;
+    size_t size_;
+};
+
+// the same checks as read_bmp_file, plus that the whole pixel array is in the file
+bool read_bmp_file(const MappedFile &file, BMPHeader &header);
+
+void load_image(const MappedFile &file, const BMPHeader &header, Pixel *image);
+
+// maps the new file and writes the header and padded rows straight into it
+bool save_image(const std::string &path, const BMPHeader &header, const Pixel *image);
+
+// Reads a validity mask the size of the image from an 8-bit palette or a 24-bit BMP. A pixel's weight is
+// its grey level, 0 (black) leaves it out of a masked blur and 255 counts it fully.
+bool load_mask(const MappedFile &file, int width, int height, std::vector<uint8_t> &mask);
+
+// The alpha plane of a 32-bit BMP, from the alpha mask of a V4 or V5 header or else the fourth byte of each
+// pixel. header is filled in like read_bmp_file does.
+bool load_alpha(const MappedFile &file, BMPHeader &header, std::vector<uint8_t> &alpha);
+
+// an 8-bit BMP with a grey palette, what load_mask reads
+bool save_mask(const std::string &path, int width, int height, const uint8_t *mask);
+
+// a 32-bit BMP (V4 header, so readers know the fourth byte is alpha) of one colour, with alpha from the plane
+bool save_tinted(const std::string &path, int width, int height, const uint8_t *alpha, Pixel tint);
+
+// builds a header for a bottom-up 24-bit image, used when the output size differs from the input
+BMPHeader make_bmp_header(int width, int height);
+
+#endif
@@ -0,0 +1,412 @@
+#include "codec.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+// refuse anything bigger than this before allocating, the server takes untrusted headers
+static const long long MAX_PIXELS = 1LL << 27;
+
+static const int QOI_HEADER_SIZE = 14;
+static const uint8_t QOI_OP_INDEX = 0x00, QOI_OP_DIFF = 0x40, QOI_OP_LUMA = 0x80, QOI_OP_RUN = 0xc0;
+static const uint8_t QOI_OP_RGB = 0xfe, QOI_OP_RGBA = 0xff;
+static const uint8_t QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+const char *format_mime_type(ImageFormat format) {
+    switch (format) {
+        case FORMAT_BMP:
+            return "image/bmp";
+        case FORMAT_PPM:
+            return "image/x-portable-pixmap";
+        case FORMAT_QOI:
+            return "image/qoi";
+        default:
+            return "application/octet-stream";
+    }
+}
+
+static int qoi_hash(const uint8_t *rgba) { return (rgba[0] * 3 + rgba[1] * 5 + rgba[2] * 7 + rgba[3] * 11) % 64; }
+
+static uint32_t read_be32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static void write_be32(string &out, uint32_t value) {
+    out += (char)(value >> 24);
+    out += (char)(value >> 16);
+    out += (char)(value >> 8);
+    out += (char)value;
+}
+
+StreamDecoder::StreamDecoder(PixelAllocator allocate)
+    : allocate_(allocate),
+      state_(STATE_HEADER),
+      format_(FORMAT_UNKNOWN),
+      width_(0),
+      height_(0),
+      pixels_(NULL),
+      next_pixel_(0),
+      row_(0),
+      row_padding_(0),
+      row_offset_(0),
+      skip_(0),
+      pending_size_(0) {
+    memset(index_, 0, sizeof(index_));
+    previous_[0] = previous_[1] = previous_[2] = 0;
+    previous_[3] = 255;
+}
+
+bool StreamDecoder::fail(const string &message) {
+    state_ = STATE_ERROR;
+    error_ = message;
+    return false;
+}
+
+bool StreamDecoder::start_pixels(int width, int height) {
+    if (width <= 0 || height <= 0 || (long long)width * height > MAX_PIXELS) {
+        return fail("unsupported image size");
+    }
+
+    width_ = width;
+    height_ = height;
+    pixels_ = allocate_(width, height);
+    if (pixels_ == NULL) {
+        return fail("out of memory");
+    }
+    state_ = STATE_PIXELS;
+    return true;
+}
+
+// reads the next whitespace separated PPM token, skipping # comments. Returns false if the header
+// doesn't hold a whole token yet.
+static bool ppm_token(const string &header, size_t &pos, long &value) {
+    while (pos < header.size()) {
+        if (header[pos] == '#') {
+            while (pos < header.size() && header[pos] != '\n') {
+                pos++;
+            }
+        } else if (isspace((unsigned char)header[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+
+    size_t start = pos;
+    while (pos < header.size() && isdigit((unsigned char)header[pos])) {
+        pos++;
+    }
+    // the token must be followed by something, or more digits may still be on their way
+    if (pos == start || pos >= header.size()) {
+        return false;
+    }
+    value = strtol(header.c_str() + start, NULL, 10);
+    return true;
+}
+
+// returns true once the header is complete and the pixels have been allocated. header_ then holds
+// only the bytes that followed the header.
+bool StreamDecoder::parse_header() {
+    const uint8_t *bytes = (const uint8_t *)header_.data();
+
+    if (format_ == FORMAT_UNKNOWN && header_.size() >= 2) {
+        if (bytes[0] == 'B' && bytes[1] == 'M') {
+            format_ = FORMAT_BMP;
+        } else if (bytes[0] == 'P' && bytes[1] == '6') {
+            format_ = FORMAT_PPM;
+        } else if (header_.size() >= 4 && memcmp(bytes, "qoif", 4) == 0) {
+            format_ = FORMAT_QOI;
+        } else if (header_.size() >= 4 || bytes[0] != 'q') {
+            return fail("unknown image format, expected BMP, PPM (P6) or QOI");
+        }
+    }
+
+    size_t used = 0;
+
+    if (format_ == FORMAT_BMP) {
+        if (header_.size() < sizeof(BMPHeader)) {
+            return false;
+        }
+        BMPHeader header;
+        memcpy(&header, bytes, sizeof(BMPHeader));
+        if (header.biBitCount != 24 || header.biCompression != 0) {
+            return fail("only uncompressed 24-bit BMP files are supported");
+        }
+        if ((int32_t)header.biHeight < 0 || header.bfOffBits < sizeof(BMPHeader)) {
+            return fail("top-down BMP files are not supported");
+        }
+        if (!start_pixels(header.biWidth, header.biHeight)) {
+            return false;
+        }
+        row_padding_ = (4 - (width_ * 3) % 4) % 4;
+        skip_ = header.bfOffBits - sizeof(BMPHeader);
+        used = sizeof(BMPHeader);
+    } else if (format_ == FORMAT_PPM) {
+        size_t pos = 2;
+        long width, height, maxval;
+        if (!ppm_token(header_, pos, width) || !ppm_token(header_, pos, height) || !ppm_token(header_, pos, maxval)) {
+            if (header_.size() > 1024) {
+                return fail("PPM header is too long");
+            }
+            return false;
+        }
+        if (maxval != 255) {
+            return fail("only 8-bit PPM files are supported");
+        }
+        if (!start_pixels(width, height)) {
+            return false;
+        }
+        // exactly one whitespace byte separates the header from the raster
+        used = pos + 1;
+    } else if (format_ == FORMAT_QOI) {
+        if (header_.size() < (size_t)QOI_HEADER_SIZE) {
+            return false;
+        }
+        if (bytes[12] != 3 && bytes[12] != 4) {
+            return fail("QOI channel count must be 3 or 4");
+        }
+        uint32_t width = read_be32(bytes + 4), height = read_be32(bytes + 8);
+        if (width > (uint32_t)MAX_PIXELS || height > (uint32_t)MAX_PIXELS) {
+            return fail("unsupported image size");
+        }
+        if (!start_pixels(width, height)) {
+            return false;
+        }
+        used = QOI_HEADER_SIZE;
+    } else {
+        return false;
+    }
+
+    header_.erase(0, used);
+    return true;
+}
+
+bool StreamDecoder::feed(const uint8_t *data, size_t size) {
+    if (state_ == STATE_ERROR) {
+        return false;
+    }
+
+    if (state_ == STATE_HEADER) {
+        header_.append((const char *)data, size);
+        if (!parse_header()) {
+            return state_ != STATE_ERROR;
+        }
+
+        // whatever came after the header is the start of the pixels
+        string rest;
+        rest.swap(header_);
+        return feed((const uint8_t *)rest.data(), rest.size());
+    }
+
+    if (state_ == STATE_PIXELS) {
+        if (format_ == FORMAT_QOI) {
+            feed_qoi(data, size);
+        } else {
+            feed_raw(data, size);
+        }
+    }
+
+    // anything after the last pixel (QOI end marker, trailing BMP bytes) is ignored
+    return state_ != STATE_ERROR;
+}
+
+size_t StreamDecoder::feed_raw(const uint8_t *data, size_t size) {
+    int payload = width_ * 3;
+    size_t used = 0;
+
+    while (used < size && state_ == STATE_PIXELS) {
+        if (skip_ > 0) {
+            size_t n = min(skip_, size - used);
+            skip_ -= n;
+            used += n;
+            continue;
+        }
+
+        if (row_offset_ < payload) {
+            int n = (int)min((size_t)(payload - row_offset_), size - used);
+            uint8_t *row = (uint8_t *)(pixels_ + (size_t)row_ * width_);
+
+            if (format_ == FORMAT_BMP) {
+                memcpy(row + row_offset_, data + used, n);
+            } else {
+                // PPM is RGB, the pixels are kept in BMP order
+                for (int i = 0; i < n; i++) {
+                    int pos = row_offset_ + i;
+                    int channel = pos % 3;
+                    row[pos - channel + 2 - channel] = data[used + i];
+                }
+            }
+            row_offset_ += n;
+            used += n;
+        } else {
+            int n = (int)min((size_t)(payload + row_padding_ - row_offset_), size - used);
+            row_offset_ += n;
+            used += n;
+        }
+
+        if (row_offset_ == payload + row_padding_) {
+            row_offset_ = 0;
+            if (++row_ == height_) {
+                state_ = STATE_DONE;
+            }
+        }
+    }
+
+    return used;
+}
+
+size_t StreamDecoder::feed_qoi(const uint8_t *data, size_t size) {
+    size_t total = (size_t)width_ * height_;
+    size_t used = 0;
+
+    while (used < size && next_pixel_ < total) {
+        pending_[pending_size_++] = data[used++];
+
+        uint8_t op = pending_[0];
+        int needed = op == QOI_OP_RGBA ? 5 : op == QOI_OP_RGB ? 4 : (op & 0xc0) == QOI_OP_LUMA ? 2 : 1;
+        if (pending_size_ < needed) {
+            continue;
+        }
+        pending_size_ = 0;
+
+        uint8_t *px = previous_;
+        int run = 1;
+
+        if (op == QOI_OP_RGB) {
+            memcpy(px, pending_ + 1, 3);
+        } else if (op == QOI_OP_RGBA) {
+            memcpy(px, pending_ + 1, 4);
+        } else if ((op & 0xc0) == QOI_OP_INDEX) {
+            memcpy(px, index_[op & 0x3f], 4);
+        } else if ((op & 0xc0) == QOI_OP_DIFF) {
+            px[0] += ((op >> 4) & 3) - 2;
+            px[1] += ((op >> 2) & 3) - 2;
+            px[2] += (op & 3) - 2;
+        } else if ((op & 0xc0) == QOI_OP_LUMA) {
+            int dg = (op & 0x3f) - 32;
+            px[0] += dg - 8 + ((pending_[1] >> 4) & 0x0f);
+            px[1] += dg;
+            px[2] += dg - 8 + (pending_[1] & 0x0f);
+        } else {
+            run = (op & 0x3f) + 1;
+        }
+
+        memcpy(index_[qoi_hash(px)], px, 4);
+
+        for (; run > 0 && next_pixel_ < total; run--) {
+            Pixel &out = pixels_[next_pixel_++];
+            out.red = px[2];
+            out.green = px[1];
+            out.blue = px[0];
+        }
+    }
+
+    if (next_pixel_ == total) {
+        state_ = STATE_DONE;
+    }
+    return used;
+}
+
+StreamEncoder::StreamEncoder(ImageFormat format, int width, int height)
+    : format_(format), width_(width), height_(height), run_(0) {
+    memset(index_, 0, sizeof(index_));
+    previous_[0] = previous_[1] = previous_[2] = 0;
+    previous_[3] = 255;
+}
+
+void StreamEncoder::header(string &out) {
+    if (format_ == FORMAT_BMP) {
+        BMPHeader header = make_bmp_header(width_, height_);
+        out.append((const char *)&header, sizeof(header));
+    } else if (format_ == FORMAT_PPM) {
+        out += "P6\n" + to_string(width_) + " " + to_string(height_) + "\n255\n";
+    } else if (format_ == FORMAT_QOI) {
+        out += "qoif";
+        write_be32(out, width_);
+        write_be32(out, height_);
+        out += (char)3;  // RGB
+        out += (char)0;  // sRGB with linear alpha
+    }
+}
+
+void StreamEncoder::rows(const Pixel *pixels, int begin, int end, string &out) {
+    if (format_ == FORMAT_BMP) {
+        int payload = width_ * 3;
+        int padding = (4 - payload % 4) % 4;
+        for (int y = begin; y < end; y++) {
+            out.append((const char *)(pixels + (size_t)y * width_), payload);
+            out.append(padding, '\0');
+        }
+        return;
+    }
+
+    if (format_ == FORMAT_PPM) {
+        for (int y = begin; y < end; y++) {
+            const Pixel *row = pixels + (size_t)y * width_;
+            size_t offset = out.size();
+            out.resize(offset + width_ * 3);
+            for (int x = 0; x < width_; x++) {
+                out[offset + x * 3] = row[x].blue;
+                out[offset + x * 3 + 1] = row[x].green;
+                out[offset + x * 3 + 2] = row[x].red;
+            }
+        }
+        return;
+    }
+
+    // QOI, the run, index and previous pixel carry over between calls
+    for (int y = begin; y < end; y++) {
+        const Pixel *row = pixels + (size_t)y * width_;
+        for (int x = 0; x < width_; x++) {
+            uint8_t px[4] = {row[x].blue, row[x].green, row[x].red, 255};
+
+            if (memcmp(px, previous_, 4) == 0) {
+                if (++run_ == 62) {
+                    out += (char)(QOI_OP_RUN | (run_ - 1));
+                    run_ = 0;
+                }
+                continue;
+            }
+
+            if (run_ > 0) {
+                out += (char)(QOI_OP_RUN | (run_ - 1));
+                run_ = 0;
+            }
+
+            int hash = qoi_hash(px);
+            if (memcmp(index_[hash], px, 4) == 0) {
+                out += (char)(QOI_OP_INDEX | hash);
+            } else {
+                memcpy(index_[hash], px, 4);
+
+                int8_t dr = px[0] - previous_[0], dg = px[1] - previous_[1], db = px[2] - previous_[2];
+                int8_t dr_dg = dr - dg, db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out += (char)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    out += (char)(QOI_OP_LUMA | (dg + 32));
+                    out += (char)((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    out += (char)QOI_OP_RGB;
+                    out += (char)px[0];
+                    out += (char)px[1];
+                    out += (char)px[2];
+                }
+            }
+            memcpy(previous_, px, 4);
+        }
+    }
+}
+
+void StreamEncoder::finish(string &out) {
+    if (format_ == FORMAT_QOI) {
+        if (run_ > 0) {
+            out += (char)(QOI_OP_RUN | (run_ - 1));
+            run_ = 0;
+        }
+        out.append((const char *)QOI_END_MARKER, sizeof(QOI_END_MARKER));
+    }
+}
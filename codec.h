@@ -0,0 +1,90 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+#include "bmp.h"
+
+enum ImageFormat {
+    FORMAT_UNKNOWN,
+    FORMAT_BMP,  // 24-bit uncompressed
+    FORMAT_PPM,  // binary P6 with maxval 255
+    FORMAT_QOI,  // https://qoiformat.org/qoi-specification.pdf
+};
+
+const char *format_mime_type(ImageFormat format);
+
+// Called once the header has been parsed, must return room for width * height pixels (or NULL to abort).
+typedef std::function<Pixel *(int width, int height)> PixelAllocator;
+
+// Decodes an image from bytes as they arrive, without ever holding the encoded file. The format is
+// sniffed from the first bytes. Rows are written in stream order and channels in BMP order (blue first),
+// which is all the engines care about. The matching StreamEncoder writes them back the same way.
+class StreamDecoder {
+   public:
+    explicit StreamDecoder(PixelAllocator allocate);
+
+    // returns false once the stream is malformed, error() says why
+    bool feed(const uint8_t *data, size_t size);
+
+    bool done() const { return state_ == STATE_DONE; }
+    ImageFormat format() const { return format_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    Pixel *pixels() const { return pixels_; }
+    const std::string &error() const { return error_; }
+
+   private:
+    enum State { STATE_HEADER, STATE_PIXELS, STATE_DONE, STATE_ERROR };
+
+    bool fail(const std::string &message);
+    bool parse_header();
+    bool start_pixels(int width, int height);
+    size_t feed_raw(const uint8_t *data, size_t size);
+    size_t feed_qoi(const uint8_t *data, size_t size);
+
+    PixelAllocator allocate_;
+    State state_;
+    ImageFormat format_;
+    std::string header_;
+    std::string error_;
+
+    int width_, height_;
+    Pixel *pixels_;
+    size_t next_pixel_;
+
+    // raw rows (BMP / PPM), position inside the current row including its padding
+    int row_, row_padding_;
+    int row_offset_;
+    size_t skip_;  // header bytes to discard before the pixel data
+
+    // QOI state
+    uint8_t pending_[5];
+    int pending_size_;
+    uint8_t index_[64][4];
+    uint8_t previous_[4];
+};
+
+// Encodes rows as they become available, so the caller can send each piece as soon as it is produced.
+class StreamEncoder {
+   public:
+    StreamEncoder(ImageFormat format, int width, int height);
+
+    void header(std::string &out);
+    // appends rows [begin, end) in stream order, they must be given in order
+    void rows(const Pixel *pixels, int begin, int end, std::string &out);
+    void finish(std::string &out);
+
+   private:
+    ImageFormat format_;
+    int width_, height_;
+
+    uint8_t index_[64][4];
+    uint8_t previous_[4];
+    int run_;
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include "effects.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "approx.h"
+#include "kernels.h"
+#include "pipeline.h"
+
+using namespace std;
+
+static const int CHANNELS = 3;
+
+// where each output column or row samples the smaller frame, centres aligned, and the weight of the far pixel
+struct LinearTaps {
+    vector<int> first;
+    vector<float> fraction;
+};
+
+static LinearTaps linear_taps(int small_size, int size) {
+    LinearTaps taps;
+    taps.first.resize(size);
+    taps.fraction.resize(size);
+    double scale = (double)small_size / size;
+    for (int i = 0; i < size; i++) {
+        double position = min(max((i + 0.5) * scale - 0.5, 0.0), (double)(small_size - 1));
+        int first = min((int)position, max(small_size - 2, 0));
+        taps.first[i] = first;
+        taps.fraction[i] = small_size > 1 ? position - first : 0.0f;
+    }
+    return taps;
+}
+
+// dst = base_weight * base + small_weight * small scaled up bilinearly, rows [begin, end) per thread. dst may
+// be base, every pixel reads its own base pixel before writing it.
+struct UpsampleParams {
+    const Pixel *base;
+    const Pixel *small;
+    Pixel *dst;
+    int width, small_width, small_height;
+    const LinearTaps *x_taps, *y_taps;
+    float base_weight, small_weight;
+    int begin, end;
+    JobControl *control;
+};
+
+static void *upsample_add_rows(void *arg) {
+    UpsampleParams *p = (UpsampleParams *)arg;
+    const LinearTaps &xs = *p->x_taps, &ys = *p->y_taps;
+    int next_column = p->small_width > 1 ? 1 : 0;
+
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        int sy = ys.first[y];
+        float fy = ys.fraction[y];
+        const uint8_t *top = (const uint8_t *)(p->small + (size_t)sy * p->small_width);
+        const uint8_t *bottom = (const uint8_t *)(p->small + (size_t)min(sy + 1, p->small_height - 1) * p->small_width);
+        const uint8_t *base = (const uint8_t *)(p->base + (size_t)y * p->width);
+        uint8_t *dst = (uint8_t *)(p->dst + (size_t)y * p->width);
+
+        for (int x = 0; x < p->width; x++) {
+            int left = xs.first[x] * CHANNELS, right = (xs.first[x] + next_column) * CHANNELS;
+            float fx = xs.fraction[x];
+            for (int c = 0; c < CHANNELS; c++) {
+                float upper = top[left + c] + (top[right + c] - top[left + c]) * fx;
+                float lower = bottom[left + c] + (bottom[right + c] - bottom[left + c]) * fx;
+                float scaled = upper + (lower - upper) * fy;
+                float value = p->base_weight * base[x * CHANNELS + c] + p->small_weight * scaled;
+                dst[x * CHANNELS + c] = (uint8_t)min(value + 0.5f, 255.0f);
+            }
+        }
+        if (p->control) {
+            p->control->add_done(p->width);
+        }
+    }
+    return NULL;
+}
+
+static bool upsample_add(const Pixel *base, const Pixel *small, Pixel *dst, int width, int height, int small_width,
+                         int small_height, float base_weight, float small_weight, int num_threads,
+                         JobControl *control) {
+    LinearTaps x_taps = linear_taps(small_width, width), y_taps = linear_taps(small_height, height);
+    vector<UpsampleParams> params(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        params[i] = {base, small, dst, width, small_width, small_height, &x_taps, &y_taps, base_weight, small_weight,
+                     (int)((long long)height * i / num_threads), (int)((long long)height * (i + 1) / num_threads),
+                     control};
+    }
+    run_threads(params, upsample_add_rows);
+    return control == NULL || !control->cancelled();
+}
+
+int bloom_levels(int width, int height, int radius) {
+    // the first level is there even for a tiny frame, later ones only while they are at least 2 pixels
+    int levels = 1;
+    while (BLOOM_LEVEL_RADIUS << levels < radius && min(width, height) >> (levels + 1) >= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+// Level k is the frame at 1 / 2^(k + 1) blurred with BLOOM_LEVEL_RADIUS, so every level has the same few taps
+// and reaches twice as far as the one before. The first sweep thresholds, halves and blurs the input in one
+// go, every later one halves and blurs the level above. On the way up each level is scaled up onto the next
+// larger one and averaged with it in the same pass, and the last pass adds the average onto the image.
+bool bloom(int width, int height, const Pixel *image, Pixel *output, int radius, float threshold, float intensity,
+           int num_threads, int band_height, EdgeMode edge, JobControl *control) {
+    int levels = bloom_levels(width, height, radius);
+    vector<int> widths(levels), heights(levels);
+    long long total = (long long)width * height;
+    for (int k = 0; k < levels; k++) {
+        widths[k] = max((k == 0 ? width : widths[k - 1]) / 2, 1);
+        heights[k] = max((k == 0 ? height : heights[k - 1]) / 2, 1);
+        total += 2LL * widths[k] * heights[k];
+    }
+    if (control) {
+        control->set_total(total);
+    }
+
+    vector<vector<Pixel>> pyramid(levels);
+    for (int k = 0; k < levels; k++) {
+        int in_width = k == 0 ? width : widths[k - 1], in_height = k == 0 ? height : heights[k - 1];
+        Pipeline sweep(in_width, in_height);
+        sweep.edge(edge).threads(num_threads).band_height(band_height).control(control);
+        if (k == 0) {
+            sweep.threshold(threshold);
+        }
+        sweep.downscale(2).blur(BLOOM_LEVEL_RADIUS);
+
+        pyramid[k].resize((size_t)widths[k] * heights[k]);
+        if (!sweep.run(k == 0 ? image : pyramid[k - 1].data(), pyramid[k].data())) {
+            return false;
+        }
+    }
+
+    // a running average, so the sums stay in bytes however many levels there are
+    for (int k = levels - 2; k >= 0; k--) {
+        float below = levels - 1 - k;
+        if (!upsample_add(pyramid[k].data(), pyramid[k + 1].data(), pyramid[k].data(), widths[k], heights[k],
+                          widths[k + 1], heights[k + 1], 1 / (below + 1), below / (below + 1), num_threads, control)) {
+            return false;
+        }
+    }
+    if (control) {
+        control->add_done((long long)widths[levels - 1] * heights[levels - 1]);
+    }
+    return upsample_add(image, pyramid[0].data(), output, width, height, widths[0], heights[0], 1.0f, intensity,
+                        num_threads, control);
+}
+
+// Per pixel state of the guided filter, with P input channels. The statistics are I, I^2, p and I p, the
+// coefficients a and b, and both are box filtered in one box_mean each so the guide and the input are read
+// once per pass. Values are centred on mid grey, which keeps the squares and products small enough for the
+// float running sums.
+struct GuidedParams {
+    const uint8_t *input;
+    const Pixel *guide;
+    uint8_t *output;
+    float *values;       // statistics in the first pass, coefficients in the second
+    const float *means;  // box filtered statistics, then box filtered coefficients
+    int width;
+    float eps;
+    int begin, end;
+    JobControl *control;
+};
+
+static float guide_value(const Pixel &p) {
+    const uint8_t *c = (const uint8_t *)&p;
+    return (0.114f * c[0] + 0.587f * c[1] + 0.299f * c[2]) / 255 - 0.5f;
+}
+
+template <int P>
+static void *guided_statistics(void *arg) {
+    GuidedParams *p = (GuidedParams *)arg;
+    for (size_t i = (size_t)p->begin * p->width; i < (size_t)p->end * p->width; i++) {
+        float guide = guide_value(p->guide[i]);
+        float *stats = p->values + i * (2 + 2 * P);
+        stats[0] = guide;
+        stats[1] = guide * guide;
+        for (int c = 0; c < P; c++) {
+            float input = p->input[i * P + c] / 255.0f - 0.5f;
+            stats[2 + c] = input;
+            stats[2 + P + c] = guide * input;
+        }
+    }
+    return NULL;
+}
+
+// a = cov(I, p) / (var(I) + eps) and b = mean(p) - a mean(I), over each pixel's window
+template <int P>
+static void *guided_coefficients(void *arg) {
+    GuidedParams *p = (GuidedParams *)arg;
+    for (size_t i = (size_t)p->begin * p->width; i < (size_t)p->end * p->width; i++) {
+        const float *mean = p->means + i * (2 + 2 * P);
+        float *coefficients = p->values + i * 2 * P;
+        float variance = mean[1] - mean[0] * mean[0];
+        for (int c = 0; c < P; c++) {
+            float a = (mean[2 + P + c] - mean[0] * mean[2 + c]) / (variance + p->eps);
+            coefficients[c] = a;
+            coefficients[P + c] = mean[2 + c] - a * mean[0];
+        }
+    }
+    return NULL;
+}
+
+// q = mean(a) I + mean(b), every window a pixel is in has its say
+template <int P>
+static void *guided_output(void *arg) {
+    GuidedParams *p = (GuidedParams *)arg;
+    for (int y = p->begin; y < p->end; y++) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        for (size_t i = (size_t)y * p->width; i < (size_t)(y + 1) * p->width; i++) {
+            float guide = guide_value(p->guide[i]);
+            const float *mean = p->means + i * 2 * P;
+            for (int c = 0; c < P; c++) {
+                float value = (mean[c] * guide + mean[P + c] + 0.5f) * 255;
+                p->output[i * P + c] = (uint8_t)min(max(value + 0.5f, 0.0f), 255.0f);
+            }
+        }
+        if (p->control) {
+            p->control->add_done(p->width);
+        }
+    }
+    return NULL;
+}
+
+template <int P>
+static bool guided(int width, int height, const uint8_t *input, const Pixel *guide, uint8_t *output, int radius,
+                   float eps, int num_threads, JobControl *control) {
+    size_t pixels = (size_t)width * height;
+    if (control) {
+        control->set_total(5LL * width * height);
+    }
+    vector<float> values(pixels * (2 + 2 * P)), means(values.size());
+    vector<GuidedParams> params(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        params[i] = {input, guide, output, values.data(), means.data(), width, eps,
+                     (int)((long long)height * i / num_threads), (int)((long long)height * (i + 1) / num_threads),
+                     control};
+    }
+
+    run_threads(params, guided_statistics<P>);
+    if (!box_mean(width, height, 2 + 2 * P, values.data(), means.data(), radius, num_threads, EDGE_CLAMP, control)) {
+        return false;
+    }
+    run_threads(params, guided_coefficients<P>);
+    if (!box_mean(width, height, 2 * P, values.data(), means.data(), radius, num_threads, EDGE_CLAMP, control)) {
+        return false;
+    }
+    run_threads(params, guided_output<P>);
+    return control == NULL || !control->cancelled();
+}
+
+bool guided_filter(int width, int height, const Pixel *image, const Pixel *guide, Pixel *output, int radius,
+                   float eps, int num_threads, JobControl *control) {
+    return guided<CHANNELS>(width, height, (const uint8_t *)image, guide, (uint8_t *)output, radius, eps,
+                            num_threads, control);
+}
+
+bool guided_filter_plane(int width, int height, const uint8_t *plane, const Pixel *guide, uint8_t *output,
+                         int radius, float eps, int num_threads, JobControl *control) {
+    return guided<1>(width, height, plane, guide, output, radius, eps, num_threads, control);
+}
+
+// rows denoised together, their sums and patch distances stay in cache across all the offsets
+static const int NL_MEANS_BAND = 32;
+
+struct NlMeansParams {
+    const float *planes;  // one float plane per channel, padded by search + patch radius with clamped edges
+    size_t plane_size;
+    int padded_width;
+    Pixel *output;
+    int width, search_radius, patch_radius;
+    float sigma;
+    int begin, end;
+    JobControl *control;
+};
+
+// Rows [begin, end) a band at a time. For every offset in the search window the band gets a summed area table
+// of the squared differences between the image and its shifted copy, any patch distance is then four
+// lookups. The table is in integers, so a distance doesn't depend on where the band starts. The weighted
+// sums go through the vector kernels a row at a time, every pixel adds its offsets in the same order.
+static void *nl_means_rows(void *arg) {
+    NlMeansParams *p = (NlMeansParams *)arg;
+    const RowKernels &kernels = row_kernels();
+    int width = p->width, search = p->search_radius, patch = p->patch_radius, side = 2 * patch + 1;
+    int pad = search + patch, stride = p->padded_width, table_width = width + 2 * patch + 1;
+
+    float patch_size = (float)CHANNELS * side * side;
+    float h = NL_MEANS_H * p->sigma, bias = 2 * p->sigma * p->sigma;
+    float scale = h > 0 ? 1 / (h * h) : 1e30f;
+
+    // row 0 and column 0 of the table stay zero
+    vector<int64_t> table((size_t)(NL_MEANS_BAND + 2 * patch + 1) * table_width, 0);
+    vector<float> sums((size_t)NL_MEANS_BAND * width * (CHANNELS + 1)), weights(width);
+    vector<uint8_t> levels((size_t)CHANNELS * width);
+
+    for (int band = p->begin; band < p->end; band += NL_MEANS_BAND) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+        int rows = min(NL_MEANS_BAND, p->end - band);
+        fill(sums.begin(), sums.end(), 0.0f);
+
+        for (int dy = -search; dy <= search; dy++) {
+            for (int dx = -search; dx <= search; dx++) {
+                for (int r = 0; r < rows + 2 * patch; r++) {
+                    size_t at = (size_t)(band - patch + r + pad) * stride + pad - patch;
+                    size_t shifted = at + (ptrdiff_t)dy * stride + dx;
+                    const int64_t *above = &table[(size_t)r * table_width];
+                    int64_t *line = &table[(size_t)(r + 1) * table_width];
+                    int64_t row_sum = 0;
+                    for (int x = 0; x < width + 2 * patch; x++) {
+                        float distance = 0;
+                        for (int c = 0; c < CHANNELS; c++) {
+                            const float *plane = p->planes + c * p->plane_size;
+                            float difference = plane[at + x] - plane[shifted + x];
+                            distance += difference * difference;
+                        }
+                        row_sum += (int64_t)distance;
+                        line[x + 1] = above[x + 1] + row_sum;
+                    }
+                }
+
+                for (int r = 0; r < rows; r++) {
+                    const int64_t *top = &table[(size_t)r * table_width];
+                    const int64_t *bottom = &table[(size_t)(r + side) * table_width];
+                    for (int x = 0; x < width; x++) {
+                        int64_t distance = bottom[x + side] - bottom[x] - top[x + side] + top[x];
+                        weights[x] = expf(-max(distance / patch_size - bias, 0.0f) * scale);
+                    }
+                    size_t source = (size_t)(band + r + pad + dy) * stride + pad + dx;
+                    float *row_sums = &sums[(size_t)r * width * (CHANNELS + 1)];
+                    for (int c = 0; c < CHANNELS; c++) {
+                        kernels.multiply_add(row_sums + c * width, p->planes + c * p->plane_size + source,
+                                             weights.data(), width);
+                    }
+                    kernels.add_scaled(row_sums + CHANNELS * width, weights.data(), 1.0f, width);
+                }
+            }
+        }
+
+        // the offset (0, 0) always has weight 1, so no total is 0. The averages are planar like the sums and
+        // are interleaved back into pixels on the way out.
+        for (int r = 0; r < rows; r++) {
+            float *row_sums = &sums[(size_t)r * width * (CHANNELS + 1)];
+            const float *total = row_sums + CHANNELS * width;
+            for (int c = 0; c < CHANNELS; c++) {
+                for (int x = 0; x < width; x++) {
+                    row_sums[c * width + x] /= total[x];
+                }
+            }
+            kernels.floats_to_bytes(row_sums, levels.data(), CHANNELS * width);
+            kernels.planar_to_rgb(levels.data(), levels.data() + width, levels.data() + 2 * width,
+                                  (uint8_t *)(p->output + (size_t)(band + r) * width), width);
+        }
+        if (p->control) {
+            p->control->add_done((long long)rows * width);
+        }
+    }
+    return NULL;
+}
+
+bool nl_means(int width, int height, const Pixel *image, Pixel *output, float sigma, int search_radius,
+              int patch_radius, int num_threads, JobControl *control) {
+    if (control) {
+        control->set_total((long long)width * height);
+    }
+
+    // planar floats with the edges clamped out to every offset and patch the bands look at
+    int pad = search_radius + patch_radius;
+    int padded_width = width + 2 * pad, padded_height = height + 2 * pad;
+    size_t plane_size = (size_t)padded_width * padded_height;
+    vector<float> planes(plane_size * CHANNELS);
+    vector<uint8_t> levels((size_t)CHANNELS * width);
+    const RowKernels &kernels = row_kernels();
+    for (int y = 0; y < height; y++) {
+        kernels.rgb_to_planar((const uint8_t *)(image + (size_t)y * width), levels.data(), levels.data() + width,
+                              levels.data() + 2 * width, width);
+        for (int c = 0; c < CHANNELS; c++) {
+            float *row = &planes[c * plane_size + (size_t)(y + pad) * padded_width];
+            kernels.bytes_to_floats(levels.data() + c * width, row + pad, width);
+            fill(row, row + pad, row[pad]);
+            fill(row + pad + width, row + padded_width, row[pad + width - 1]);
+        }
+    }
+    for (int c = 0; c < CHANNELS; c++) {
+        float *plane = &planes[c * plane_size];
+        for (int y = 0; y < pad; y++) {
+            copy_n(plane + (size_t)pad * padded_width, padded_width, plane + (size_t)y * padded_width);
+            copy_n(plane + (size_t)(pad + height - 1) * padded_width, padded_width,
+                   plane + (size_t)(pad + height + y) * padded_width);
+        }
+    }
+
+    vector<NlMeansParams> params(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        params[i] = {planes.data(), plane_size, padded_width, output, width, search_radius, patch_radius, sigma,
+                     (int)((long long)height * i / num_threads), (int)((long long)height * (i + 1) / num_threads),
+                     control};
+    }
+    run_threads(params, nl_means_rows);
+    return control == NULL || !control->cancelled();
+}
@@ -0,0 +1,44 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "blur.h"
+
+// Effects and edge-aware filters built out of the engines' passes, most of them a few fused pipeline sweeps
+// plus a final composite. As everywhere else the output bytes don't depend on the thread count or band height.
+
+// pyramid levels bloom runs for a glow of the given radius, each level blurs BLOOM_LEVEL_RADIUS at its scale.
+// Levels past the first stop before one would be smaller than 2 pixels either way.
+static const int BLOOM_LEVEL_RADIUS = 4;
+int bloom_levels(int width, int height, int radius);
+
+// Glow around the bright parts: everything with luma above threshold is kept, blurred at every scale from
+// 2x to reach the radius and added back onto the image, intensity times the average of the scales.
+bool bloom(int width, int height, const Pixel *image, Pixel *output, int radius, float threshold, float intensity,
+           int num_threads, int band_height, EdgeMode edge, JobControl *control = NULL);
+
+// He, Sun and Tang's guided filter. Every (2 radius + 1)^2 window of the output is a * guide + b fitted to the
+// image by least squares, so edges in the guide stay sharp and detail whose variance is below eps, in [0, 1]
+// units, is smoothed away. The guide is the luma of guide, the image itself for edge-preserving smoothing.
+// Built on box_mean, so the cost doesn't depend on the radius. Edges are always clamped.
+// https://kaiminghe.github.io/publications/eccv10guidedfilter.pdf
+bool guided_filter(int width, int height, const Pixel *image, const Pixel *guide, Pixel *output, int radius,
+                   float eps, int num_threads, JobControl *control = NULL);
+
+// the same fit of an 8-bit plane, to refine an alpha matte along the edges of the image it was cut from
+bool guided_filter_plane(int width, int height, const uint8_t *plane, const Pixel *guide, uint8_t *output,
+                         int radius, float eps, int num_threads, JobControl *control = NULL);
+
+// Filtering strength of non-local means as a multiple of the noise sigma, patches further apart than the
+// noise by about this much get little weight
+static const float NL_MEANS_H = 0.4f;
+
+// Buades, Coll and Morel's non-local means: every pixel becomes the average of the pixels within
+// search_radius whose (2 patch_radius + 1)^2 patches look like its own, weighted exp(-max(d^2 - 2 sigma^2, 0)
+// / h^2) with d^2 the mean squared difference of the patches and h = NL_MEANS_H sigma, both in levels. The
+// patch distances for each offset come from an integral image of the squared differences, so the cost is
+// O(search window) per pixel whatever the patch size. Edges are always clamped.
+// https://www.ipol.im/pub/art/2011/bcm_nlm/
+bool nl_means(int width, int height, const Pixel *image, Pixel *output, float sigma, int search_radius,
+              int patch_radius, int num_threads, JobControl *control = NULL);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <algorithm>
+#include <atomic>
+
+// Lets one thread watch and stop a blur that others are running. The workers add the output pixels they
+// finished after every band (every row for the exact backend) and look at cancelled() before starting
+// the next one, so a cancel takes effect within one band and the cores are free right after. All of it
+// is relaxed, the numbers are only advisory and nothing else is published through them.
+class JobControl {
+   public:
+    JobControl() : cancelled_(false), done_(0), total_(0) {}
+
+    // safe to call from a signal handler, the flag is a lock-free atomic
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+    // progress is counted in output pixels, the caller sets the total for the whole job
+    void set_total(long long pixels) { total_.store(pixels, std::memory_order_relaxed); }
+    void add_done(long long pixels) { done_.fetch_add(pixels, std::memory_order_relaxed); }
+    long long done() const { return done_.load(std::memory_order_relaxed); }
+    long long total() const { return total_.load(std::memory_order_relaxed); }
+
+    double fraction() const {
+        long long t = total();
+        return t > 0 ? std::min(1.0, (double)done() / t) : 0.0;
+    }
+
+   private:
+    std::atomic<bool> cancelled_;
+    std::atomic<long long> done_;
+    std::atomic<long long> total_;
+};
+
+#endif
@@ -0,0 +1,269 @@
+// Row kernels written once against simd.h. kernels.cpp includes this file once per instruction set, with
+// SIMD_TARGET naming the simd.h namespace and the matching `#pragma GCC target` in force, so each copy is
+// compiled for its own vector width. No include guard on purpose.
+//
+// Every kernel adds the taps in the same order with a separate multiply and add, never mul_add_f, so all
+// the copies give the scalar result bit for bit.
+
+namespace SIMD_TARGET {
+
+static void convolve(const float *src, float *dst, int count, const float *kernel, int radius, int stride) {
+    int taps = 2 * radius + 1;
+    int i = 0;
+
+    // two vectors at a time, the adds of one hide the latency of the other
+    for (; i + 2 * F_LANES <= count; i += 2 * F_LANES) {
+        const float *s = src + i - radius * stride;
+        Vf sum0 = zero_f(), sum1 = zero_f();
+        for (int k = 0; k < taps; k++) {
+            Vf w = set1_f(kernel[k]);
+            sum0 = add_f(sum0, mul_f(load_f(s + k * stride), w));
+            sum1 = add_f(sum1, mul_f(load_f(s + k * stride + F_LANES), w));
+        }
+        store_f(dst + i, sum0);
+        store_f(dst + i + F_LANES, sum1);
+    }
+
+    // the last few outputs, lanes past the end are neither loaded nor stored
+    for (; i < count; i += F_LANES) {
+        int n = count - i < F_LANES ? count - i : F_LANES;
+        const float *s = src + i - radius * stride;
+        Vf sum = zero_f();
+        for (int k = 0; k < taps; k++) {
+            sum = add_f(sum, mul_f(load_partial_f(s + k * stride, n), set1_f(kernel[k])));
+        }
+        store_partial_f(dst + i, sum, n);
+    }
+}
+
+static void add_scaled(float *dst, const float *src, float weight, int count) {
+    Vf w = set1_f(weight);
+    int i = 0;
+    for (; i + F_LANES <= count; i += F_LANES) {
+        store_f(dst + i, add_f(load_f(dst + i), mul_f(load_f(src + i), w)));
+    }
+    if (i < count) {
+        int n = count - i;
+        store_partial_f(dst + i, add_f(load_partial_f(dst + i, n), mul_f(load_partial_f(src + i, n), w)), n);
+    }
+}
+
+static void multiply_add(float *dst, const float *src, const float *weights, int count) {
+    int i = 0;
+    for (; i + F_LANES <= count; i += F_LANES) {
+        store_f(dst + i, add_f(load_f(dst + i), mul_f(load_f(src + i), load_f(weights + i))));
+    }
+    if (i < count) {
+        int n = count - i;
+        Vf product = mul_f(load_partial_f(src + i, n), load_partial_f(weights + i, n));
+        store_partial_f(dst + i, add_f(load_partial_f(dst + i, n), product), n);
+    }
+}
+
+static void bytes_to_floats(const uint8_t *src, float *dst, int count) {
+    int i = 0;
+    for (; i + F_LANES <= count; i += F_LANES) {
+        store_f(dst + i, load_u8_f(src + i));
+    }
+    if (i < count) {
+        store_partial_f(dst + i, load_partial_u8_f(src + i, count - i), count - i);
+    }
+}
+
+// (int)(x + 0.5f) clamped to 0..255, the same rounding as the scalar engines
+static void floats_to_bytes(const float *src, uint8_t *dst, int count) {
+    Vf half = set1_f(0.5f);
+    int i = 0;
+    for (; i + F_LANES <= count; i += F_LANES) {
+        store_f_u8(dst + i, add_f(load_f(src + i), half));
+    }
+    if (i < count) {
+        store_partial_f_u8(dst + i, add_f(load_partial_f(src + i, count - i), half), count - i);
+    }
+}
+
+static void stack_step(const uint8_t *entering, const uint8_t *middle, const uint8_t *leaving, int32_t *sum,
+                       int32_t *sum_in, int32_t *sum_out, uint8_t *dst, int count, int32_t mul, int shift) {
+    Vi32 vmul = set1_i32(mul);
+    int i = 0;
+    for (; i + I32_LANES <= count; i += I32_LANES) {
+        Vi32 s = load_i32(sum + i), in = load_i32(sum_in + i), out = load_i32(sum_out + i);
+        Vi32 m = load_u8_i32(middle + i);
+        store_i32_u8(dst + i, shr_u32(mullo_i32(s, vmul), shift));
+        store_i32(sum + i, add_i32(s, sub_i32(in, out)));
+        store_i32(sum_in + i, sub_i32(add_i32(in, load_u8_i32(entering + i)), m));
+        store_i32(sum_out + i, sub_i32(add_i32(out, m), load_u8_i32(leaving + i)));
+    }
+    if (i < count) {
+        int n = count - i;
+        Vi32 s = load_partial_i32(sum + i, n), in = load_partial_i32(sum_in + i, n);
+        Vi32 out = load_partial_i32(sum_out + i, n), m = load_partial_u8_i32(middle + i, n);
+        store_partial_i32_u8(dst + i, shr_u32(mullo_i32(s, vmul), shift), n);
+        store_partial_i32(sum + i, add_i32(s, sub_i32(in, out)), n);
+        store_partial_i32(sum_in + i, sub_i32(add_i32(in, load_partial_u8_i32(entering + i, n)), m), n);
+        store_partial_i32(sum_out + i, sub_i32(add_i32(out, m), load_partial_u8_i32(leaving + i, n)), n);
+    }
+}
+
+// the binomial kernels count on the sums fitting 16 bits, 255 * 2^(2 radius) is at most 65280 for radius 4
+static inline Vi16 binomial_round(Vi16 sum, int radius) {
+    return shr_u16(add_i16(sum, set1_i16(radius > 0 ? 1 << (2 * radius - 1) : 0)), 2 * radius);
+}
+
+static void binomial_row(const uint8_t *src, uint8_t *dst, uint16_t *scratch, int count, int radius, int stride) {
+    int16_t *sums = (int16_t *)scratch;
+    int total = count + 2 * radius * stride;
+    int i = 0;
+    for (; i + I16_LANES <= total; i += I16_LANES) {
+        store_i16(sums + i, load_u8_i16(src + i));
+    }
+    if (i < total) {
+        store_partial_i16(sums + i, load_partial_u8_i16(src + i, total - i), total - i);
+    }
+
+    // in place and from the left, so every load of the neighbour stride ahead comes before its store
+    for (int level = 1; level <= 2 * radius; level++) {
+        int n = total - level * stride;
+        for (i = 0; i + I16_LANES <= n; i += I16_LANES) {
+            store_i16(sums + i, add_i16(load_i16(sums + i), load_i16(sums + i + stride)));
+        }
+        if (i < n) {
+            Vi16 sum = add_i16(load_partial_i16(sums + i, n - i), load_partial_i16(sums + i + stride, n - i));
+            store_partial_i16(sums + i, sum, n - i);
+        }
+    }
+
+    for (i = 0; i + I16_LANES <= count; i += I16_LANES) {
+        store_i16_u8(dst + i, binomial_round(load_i16(sums + i), radius));
+    }
+    if (i < count) {
+        store_partial_i16_u8(dst + i, binomial_round(load_partial_i16(sums + i, count - i), radius), count - i);
+    }
+}
+
+static void binomial_step(const uint8_t *src, uint16_t *levels, uint8_t *dst, int count, int radius) {
+    int16_t *rows = (int16_t *)levels;
+    int i = 0;
+    for (; i + I16_LANES <= count; i += I16_LANES) {
+        Vi16 sum = load_u8_i16(src + i);
+        for (int level = 0; level < 2 * radius; level++) {
+            int16_t *previous = rows + (size_t)level * count + i;
+            Vi16 above = load_i16(previous);
+            store_i16(previous, sum);
+            sum = add_i16(above, sum);
+        }
+        if (dst) {
+            store_i16_u8(dst + i, binomial_round(sum, radius));
+        }
+    }
+    if (i < count) {
+        int n = count - i;
+        Vi16 sum = load_partial_u8_i16(src + i, n);
+        for (int level = 0; level < 2 * radius; level++) {
+            int16_t *previous = rows + (size_t)level * count + i;
+            Vi16 above = load_partial_i16(previous, n);
+            store_partial_i16(previous, sum, n);
+            sum = add_i16(above, sum);
+        }
+        if (dst) {
+            store_partial_i16_u8(dst + i, binomial_round(sum, radius), n);
+        }
+    }
+}
+
+#if SIMD_TARGET_BLOCKS
+
+// The pixel shuffles take 4 pixels per 16 byte block: a dword permute moves each block's 12 bytes into
+// place (permutes cross the 128 bit halves, pshufb doesn't) and pshufb reorders the bytes inside it.
+
+static const int BLOCK_PIXELS = 4 * BLOCKS;
+
+static const uint8_t SPLIT_RGB[16] = {0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, 0x80, 0x80, 0x80, 0x80};
+static const uint8_t MERGE_RGB[16] = {0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, 0x80, 0x80, 0x80, 0x80};
+
+// block b gets bytes [12 b, 12 b + 16) of the packed pixels
+static Vidx spread_index() {
+    int32_t index[16];
+    for (int i = 0; i < 4 * BLOCKS; i++) {
+        index[i] = (i / 4) * 3 + i % 4;
+    }
+    return index_u32(index);
+}
+
+// the inverse, the first 12 bytes of every block packed together at the front
+static Vidx gather_index() {
+    int32_t index[16] = {0};
+    for (int i = 0; i < 3 * BLOCKS; i++) {
+        index[i] = (i / 3) * 4 + i % 3;
+    }
+    return index_u32(index);
+}
+
+// dword p of every block (channel p of its 4 pixels after SPLIT_RGB) lined up, one plane after the other
+static Vidx planes_index() {
+    int32_t index[16];
+    for (int i = 0; i < 4 * BLOCKS; i++) {
+        index[i] = (i % BLOCKS) * 4 + i / BLOCKS;
+    }
+    return index_u32(index);
+}
+
+static Vidx unplanes_index() {
+    int32_t index[16];
+    for (int i = 0; i < 4 * BLOCKS; i++) {
+        index[i] = (i % 4) * BLOCKS + i / 4;
+    }
+    return index_u32(index);
+}
+
+// the full width loops read or write a whole register per block of pixels, 4 * BLOCKS bytes more than
+// the packed pixels use, so they stop while that much is left and the tail goes through partial loads
+
+static void rgb_to_planar(const uint8_t *src, uint8_t *c0, uint8_t *c1, uint8_t *c2, int pixels) {
+    Vidx spread = spread_index(), planes = planes_index();
+    Vi16 split = set_blocks_u8(SPLIT_RGB);
+    uint8_t lanes[64];
+
+    // constant sized copies out of the register for the full blocks, they compile to plain stores
+    int i = 0;
+    for (; (pixels - i) * 3 >= 16 * BLOCKS; i += BLOCK_PIXELS) {
+        store_u8(lanes, permute_u32(shuffle_bytes(permute_u32(load_u8(src + i * 3), spread), split), planes));
+        memcpy(c0 + i, lanes, BLOCK_PIXELS);
+        memcpy(c1 + i, lanes + BLOCK_PIXELS, BLOCK_PIXELS);
+        memcpy(c2 + i, lanes + 2 * BLOCK_PIXELS, BLOCK_PIXELS);
+    }
+    for (; i < pixels; i += BLOCK_PIXELS) {
+        int n = pixels - i < BLOCK_PIXELS ? pixels - i : BLOCK_PIXELS;
+        Vi16 v = load_partial_u8(src + i * 3, n * 3);
+        store_u8(lanes, permute_u32(shuffle_bytes(permute_u32(v, spread), split), planes));
+        memcpy(c0 + i, lanes, n);
+        memcpy(c1 + i, lanes + BLOCK_PIXELS, n);
+        memcpy(c2 + i, lanes + 2 * BLOCK_PIXELS, n);
+    }
+}
+
+static void planar_to_rgb(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2, uint8_t *dst, int pixels) {
+    Vidx unplanes = unplanes_index(), gather = gather_index();
+    Vi16 merge = set_blocks_u8(MERGE_RGB);
+    uint8_t lanes[64] = {0};
+
+    int i = 0;
+    for (; (pixels - i) * 3 >= 16 * BLOCKS; i += BLOCK_PIXELS) {
+        Vi16 v = load_planes_u8(c0 + i, c1 + i, c2 + i);
+        store_u8(dst + i * 3, permute_u32(shuffle_bytes(permute_u32(v, unplanes), merge), gather));
+    }
+
+    // the tail goes through a buffer so the plane loads don't run off the end
+    for (; i < pixels; i += BLOCK_PIXELS) {
+        int n = pixels - i < BLOCK_PIXELS ? pixels - i : BLOCK_PIXELS;
+        memcpy(lanes, c0 + i, n);
+        memcpy(lanes + BLOCK_PIXELS, c1 + i, n);
+        memcpy(lanes + 2 * BLOCK_PIXELS, c2 + i, n);
+        Vi16 v = permute_u32(shuffle_bytes(permute_u32(load_u8(lanes), unplanes), merge), gather);
+        store_partial_u8(dst + i * 3, v, n * 3);
+    }
+}
+
+#endif
+
+}  // namespace SIMD_TARGET
@@ -0,0 +1,136 @@
+#include "kernels.h"
+
+#include "simd.h"
+
+using namespace std;
+
+// one copy of kernels-inl.h per instruction set, each compiled for its own target
+
+#define SIMD_TARGET simd_scalar
+#define SIMD_TARGET_BLOCKS 0
+#include "kernels-inl.h"
+#undef SIMD_TARGET
+#undef SIMD_TARGET_BLOCKS
+
+// the scalar target has no byte blocks to shuffle, so its pixel shuffles are plain loops
+namespace simd_scalar {
+
+static void rgb_to_planar(const uint8_t *src, uint8_t *c0, uint8_t *c1, uint8_t *c2, int pixels) {
+    for (int i = 0; i < pixels; i++) {
+        c0[i] = src[i * 3];
+        c1[i] = src[i * 3 + 1];
+        c2[i] = src[i * 3 + 2];
+    }
+}
+
+static void planar_to_rgb(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2, uint8_t *dst, int pixels) {
+    for (int i = 0; i < pixels; i++) {
+        dst[i * 3] = c0[i];
+        dst[i * 3 + 1] = c1[i];
+        dst[i * 3 + 2] = c2[i];
+    }
+}
+
+}  // namespace simd_scalar
+
+#define SIMD_TARGET_BLOCKS 1
+
+#ifdef SIMD_X86
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define SIMD_TARGET simd_sse
+#include "kernels-inl.h"
+#undef SIMD_TARGET
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define SIMD_TARGET simd_avx2
+#include "kernels-inl.h"
+#undef SIMD_TARGET
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,fma")
+#define SIMD_TARGET simd_avx512
+#include "kernels-inl.h"
+#undef SIMD_TARGET
+#pragma GCC pop_options
+
+#endif
+
+// every target's kernels, in RowKernels order
+#define ROW_KERNELS(level, ns)                                                                         \
+    {level, ns::convolve, ns::add_scaled, ns::multiply_add, ns::stack_step, ns::binomial_row,          \
+     ns::binomial_step, ns::bytes_to_floats, ns::floats_to_bytes, ns::rgb_to_planar, ns::planar_to_rgb}
+
+static const RowKernels SCALAR_KERNELS = ROW_KERNELS(SIMD_SCALAR, simd_scalar);
+#ifdef SIMD_X86
+static const RowKernels SSE_KERNELS = ROW_KERNELS(SIMD_SSE, simd_sse);
+static const RowKernels AVX2_KERNELS = ROW_KERNELS(SIMD_AVX2, simd_avx2);
+static const RowKernels AVX512_KERNELS = ROW_KERNELS(SIMD_AVX512, simd_avx512);
+#endif
+
+bool simd_supported(SimdLevel level) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();  // it may run from a static initialiser, before libgcc has looked at the CPU
+    switch (level) {
+        case SIMD_SSE:
+            return __builtin_cpu_supports("sse4.1");
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SIMD_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+        default:
+            return true;
+    }
+#else
+    return level == SIMD_SCALAR;
+#endif
+}
+
+SimdLevel best_simd_level() {
+    for (int level = SIMD_AVX512; level > SIMD_SCALAR; level--) {
+        if (simd_supported((SimdLevel)level)) {
+            return (SimdLevel)level;
+        }
+    }
+    return SIMD_SCALAR;
+}
+
+const char *simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE:
+            return "sse";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+const RowKernels &row_kernels(SimdLevel level) {
+#ifdef SIMD_X86
+    switch (level) {
+        case SIMD_SSE:
+            return SSE_KERNELS;
+        case SIMD_AVX2:
+            return AVX2_KERNELS;
+        case SIMD_AVX512:
+            return AVX512_KERNELS;
+        default:
+            break;
+    }
+#endif
+    return SCALAR_KERNELS;
+}
+
+// chosen once at startup, so the threads never race to pick it
+static const RowKernels *active_kernels = &row_kernels(best_simd_level());
+
+const RowKernels &row_kernels() { return *active_kernels; }
+
+void set_simd_level(SimdLevel level) { active_kernels = &row_kernels(level); }
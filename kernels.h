@@ -0,0 +1,64 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+// Vectorised row kernels behind the separable blur and the resize, picked at runtime from the widest
+// instruction set the CPU has. They are written once in kernels-inl.h against the simd.h layer and
+// compiled per target, and every variant gives the scalar result bit for bit.
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE,     // SSE4.1, 4 floats per vector
+    SIMD_AVX2,    // AVX2 + FMA, 8 floats per vector
+    SIMD_AVX512,  // AVX-512 F + BW, 16 floats per vector, the row tail is a masked load/store
+};
+
+struct RowKernels {
+    SimdLevel level;
+
+    // dst[i] = sum over k of src[i + (k - radius) * stride] * kernel[k], for i in [0, count)
+    // src must be readable from radius * stride floats before the first output to as many after the last
+    void (*convolve)(const float *src, float *dst, int count, const float *kernel, int radius, int stride);
+
+    // dst[i] += src[i] * weight, for i in [0, count)
+    void (*add_scaled)(float *dst, const float *src, float weight, int count);
+
+    // dst[i] += src[i] * weights[i], for i in [0, count)
+    void (*multiply_add)(float *dst, const float *src, const float *weights, int count);
+
+    // One row of a stack blur down a column: with S the weighted sum of the rows around row y, In the sum of
+    // rows y + 1 .. y + r + 1 and Out of rows y - r .. y, writes dst = (S * mul) >> shift (as unsigned) and
+    // moves the sums on to row y + 1. entering is row y + r + 2, middle row y + 1 and leaving row y - r.
+    void (*stack_step)(const uint8_t *entering, const uint8_t *middle, const uint8_t *leaving, int32_t *sum,
+                       int32_t *sum_in, int32_t *sum_out, uint8_t *dst, int count, int32_t mul, int shift);
+
+    // Binomial blurs of radius r <= 4, weights C(2r, k) / 4^r, as 2r [1 1] sums in 16 bit lanes. binomial_row
+    // blurs count elements whose neighbours are stride apart, src has r * stride more on each side and scratch
+    // room for all of them. binomial_step pushes the next row of a column pass through the cascade: levels
+    // keeps the 2r previous partial sum rows (zeros to start) and dst, once 2r rows are in, gets the blur of
+    // the row r back.
+    void (*binomial_row)(const uint8_t *src, uint8_t *dst, uint16_t *scratch, int count, int radius, int stride);
+    void (*binomial_step)(const uint8_t *src, uint16_t *levels, uint8_t *dst, int count, int radius);
+
+    // bytes to floats and back, the way back rounds half up and saturates to 0..255
+    void (*bytes_to_floats)(const uint8_t *src, float *dst, int count);
+    void (*floats_to_bytes)(const float *src, uint8_t *dst, int count);
+
+    // packed 3 byte pixels to one plane per channel and back, non-local means works on planes
+    void (*rgb_to_planar)(const uint8_t *src, uint8_t *c0, uint8_t *c1, uint8_t *c2, int pixels);
+    void (*planar_to_rgb)(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2, uint8_t *dst, int pixels);
+};
+
+bool simd_supported(SimdLevel level);
+SimdLevel best_simd_level();
+const char *simd_level_name(SimdLevel level);
+
+// the kernels for a level, which must be supported
+const RowKernels &row_kernels(SimdLevel level);
+
+// the kernels the engines use, best_simd_level() unless overridden for a benchmark or test
+const RowKernels &row_kernels();
+void set_simd_level(SimdLevel level);
+
+#endif
@@ -2,279 +2,715 @@
 Multithreaded Gaussian Blur
 ---------------------------
 A parallel implementation of Gaussian blur using pthreads to process the image
-in 4 concurrent segments. Supports 24-bit BMP files.
+in concurrent segments. Supports 24-bit BMP files, and 32-bit ones for --shadow.
 
-Usage: ./blur <file_name>.bmp <blur_radius>
+Usage: ./blur <file_name>.bmp <blur_radius> [options]
+       ./blur --serve <port> [options]
 Outputs: output.bmp
 */
 
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-#include <cmath>
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <vector>
 
-using namespace std;
+#include "approx.h"
+#include "backends.h"
+#include "blur.h"
+#include "bmp.h"
+#include "effects.h"
+#include "memstats.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "resize.h"
+#include "server.h"
 
-// http://www.dragonwins.com/domains/getteched/bmp/bmpfileformat.htm
-#pragma pack(push, 1)
-struct BMPHeader {
-    uint16_t bfType;
-    uint32_t bfSize;
-    uint32_t reserved;
-    uint32_t bfOffBits;        // offset of the start of the Pixel Data section relative to the start of the file
-    uint32_t biSize;           // Header Size - Must be at least 40
-    uint32_t biWidth;          // Image width in pixels
-    uint32_t biHeight;         // Image height in pixels
-    uint16_t biPlanes;         // Must be 1
-    uint16_t biBitCount;       // Bits per pixel - 1, 4, 8, 16, 24, or 32
-    uint32_t biCompression;    // Compression type (0 = uncompressed)
-    uint32_t biSizeImage;      // Image Size - may be zero for uncompressed images
-    uint32_t biXPelsPerMeter;  // Preferred resolution in pixels per meter
-    uint32_t biYPelsPerMeter;  // Preferred resolution in pixels per meter
-    uint32_t biClrUsed;        // Number Color Map entries that are actually used
-    uint32_t biClrImportant;   // Number of significant colors
-};
-#pragma pack(pop)
+using namespace std;
 
-struct Pixel {
-    uint8_t red, green, blue;
+struct Options {
+    Backend backend = BACKEND_EXACT;
+    bool backend_set = false;  // --backend was given, otherwise radius 2 to 4 takes the binomial fast path
+    EdgeMode edge = EDGE_ZERO;
+    int threads = 4;
+    int band_height = 32;  // rows per pipeline band
+    bool verify = false;    // re-run with other partitions and diff
+    bool progress = false;  // print how far the blur is while it runs
+    double budget_ms = 0.0;        // pick the backend by predicted time, 0 when the backend is fixed
+    const char *mem_stats = NULL;  // where to write the memory report, "-" for stdout
+    const char *metrics_socket = NULL;
+    int workers = 2;  // concurrent connections in server mode
+
+    // extra pipeline stages, chained after the blur in this order
+    float unsharp_amount = 0.0f;
+    int unsharp_radius = 2;
+    int downscale = 1;
+    float brightness = 0.0f, contrast = 1.0f, saturation = 1.0f;
+
+    // resize replaces the blur stage, the blur becomes its prefilter
+    int resize_width = 0, resize_height = 0;
+    ResizeFilter filter = FILTER_LANCZOS;
+
+    // a rotated gaussian replaces the blur stage, a negative sigma is default_sigma(radius)
+    bool rotated = false;
+    double sigma_x = -1.0, sigma_y = -1.0, theta = 0.0;
+
+    // a validity mask makes the blur blur(image * mask) / blur(mask), mask is set once the file is loaded
+    const char *mask_path = NULL;
+    const uint8_t *mask = NULL;
+
+    // a subject mask keeps its white pixels sharp and blurs the rest, its edge softened by feather
+    const char *subject_path = NULL;
+    const uint8_t *subject = NULL;
+    int feather = 0;
+
+    // bloom replaces the blur, a negative threshold is no bloom
+    float bloom_threshold = -1.0f, bloom_intensity = 1.0f;
+
+    // blur only the alpha of a 32-bit input, into an 8-bit mask or a layer of shadow_tint
+    bool shadow = false, shadow_mask = false;
+    Pixel shadow_tint = {0, 0, 0};
+
+    // the guided filter replaces the blur, a negative eps is none. With a matte it refines the matte instead.
+    float guided_eps = -1.0f;
+    const char *matte_path = NULL;
+
+    // non-local means replaces the blur, the radius is its search window. A negative sigma is none.
+    float denoise_sigma = -1.0f;
+    int patch_radius = 1;
 };
 
-struct BlurParams {
-    BMPHeader header;
-    Pixel *image;
-    Pixel *blurred_image;
-    vector<vector<double>> kernel;
-    int start;
-    int end;
-};
+static void print_usage() {
+    cerr << "\t Usage: ./blur <file_name>.bmp <blur_radius> [options]\n";
+    cerr << "\t        ./blur --serve <port> [options]   HTTP service on 127.0.0.1, POST /blur, GET /metrics\n";
+    cerr << "\t   --backend <name>            exact, separable, binomial, box, stack, pyramid or kawase\n";
+    cerr << "\t                               (default binomial for radius 2 to 4, exact otherwise)\n";
+    cerr << "\t   --budget-ms <ms>            pick the best backend predicted to finish the blur in time\n";
+    cerr << "\t   --edge zero|clamp           how pixels outside the image are treated (default zero)\n";
+    cerr << "\t   --threads <n>               number of worker threads (default 4)\n";
+    cerr << "\t   --band-height <rows>        rows per band in the separable engine (default 32)\n";
+    cerr << "\t   --verify-determinism        re-run with other thread counts and bands and diff the outputs\n";
+    cerr << "\t   --progress                  show the blur's progress on stderr, Ctrl-C cancels it\n";
+    cerr << "\t   --mem-stats <file>          write peak RSS, allocations and page faults per phase as JSON\n";
+    cerr << "\t                               (- for stdout)\n";
+    cerr << "\t   --metrics-socket <path>     serve Prometheus text metrics on a unix socket while running\n";
+    cerr << "\t   --workers <n>               connections handled at once with --serve (default 2)\n";
+    cerr << "\t   --sigma-x <s> --sigma-y <s> gaussian widths along and across theta (default radius / 3)\n";
+    cerr << "\t   --theta <degrees>           turn the blur counter-clockwise from the x axis\n";
+    cerr << "\t   --mask <file>.bmp           8 or 24-bit BMP, only its white pixels are averaged, black ones\n";
+    cerr << "\t                               are left out\n";
+    cerr << "\t   --subject <file>.bmp        8 or 24-bit BMP, keep its white pixels sharp and blur the background\n";
+    cerr << "\t   --feather <r>               soften the subject's edge with a gaussian of radius r (default 0)\n";
+    cerr << "\t   --bloom <threshold>         add a glow of the blur radius around pixels with luma above threshold\n";
+    cerr << "\t   --bloom-intensity <i>       strength of the glow (default 1)\n";
+    cerr << "\t   --shadow mask|<rrggbb>      blur the alpha of a 32-bit BMP into an 8-bit mask or a shadow of\n";
+    cerr << "\t                               that colour\n";
+    cerr << "\t   --guided <eps>              edge-preserving guided filter of the radius, smooths variance\n";
+    cerr << "\t                               below eps\n";
+    cerr << "\t   --matte <file>.bmp          with --guided, refine this 8 or 24-bit matte along the image's edges\n";
+    cerr << "\t   --denoise <sigma>           non-local means for noise of this sigma, searching within the radius\n";
+    cerr << "\t   --patch-radius <r>          radius of the patches --denoise compares (default 1)\n";
+    cerr << "\t   --unsharp <amount>          sharpen after the blur\n";
+    cerr << "\t   --unsharp-radius <r>        radius of the unsharp mask (default 2)\n";
+    cerr << "\t   --downscale <factor>        shrink by an integer factor\n";
+    cerr << "\t   --resize <w>x<h>            resample to w x h, the blur is folded in as an anti-alias prefilter\n";
+    cerr << "\t   --filter area|bicubic|lanczos  resampling filter (default lanczos)\n";
+    cerr << "\t   --brightness <b>            add b to every channel\n";
+    cerr << "\t   --contrast <c>              scale around mid grey\n";
+    cerr << "\t   --saturation <s>            scale away from luma\n";
+}
 
-// check if it ends in .bmp
-bool is_valid_file(string &filename);
+// returns false on an unknown option or a missing value
+static bool parse_options(int argc, char *argv[], Options &options) {
+    options = Options();
 
-bool read_bmp_file(ifstream &file, BMPHeader &header);
+    for (int i = 3; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--verify-determinism") == 0) {
+            options.verify = true;
+            continue;
+        }
+        if (strcmp(arg, "--progress") == 0) {
+            options.progress = true;
+            continue;
+        }
 
-void load_image(ifstream &file, BMPHeader &header, Pixel *image);
+        if (i + 1 >= argc) {
+            cerr << "Error: Missing value for " << arg << '\n';
+            return false;
+        }
+        const char *value = argv[++i];
 
-void save_image(ofstream &file, BMPHeader &header, Pixel *image);
+        if (strcmp(arg, "--backend") == 0) {
+            if (!parse_backend(value, options.backend)) {
+                cerr << "Error: Unknown backend " << value << '\n';
+                return false;
+            }
+            options.backend_set = true;
+        } else if (strcmp(arg, "--budget-ms") == 0) {
+            options.budget_ms = atof(value);
+            if (options.budget_ms <= 0) {
+                cerr << "Error: --budget-ms must be positive\n";
+                return false;
+            }
+        } else if (strcmp(arg, "--edge") == 0) {
+            if (strcmp(value, "zero") == 0) {
+                options.edge = EDGE_ZERO;
+            } else if (strcmp(value, "clamp") == 0) {
+                options.edge = EDGE_CLAMP;
+            } else {
+                cerr << "Error: Unknown edge mode " << value << '\n';
+                return false;
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads = max(atoi(value), 1);
+        } else if (strcmp(arg, "--mem-stats") == 0) {
+            options.mem_stats = value;
+        } else if (strcmp(arg, "--metrics-socket") == 0) {
+            options.metrics_socket = value;
+        } else if (strcmp(arg, "--workers") == 0) {
+            options.workers = max(atoi(value), 1);
+        } else if (strcmp(arg, "--band-height") == 0) {
+            options.band_height = max(atoi(value), 1);
+        } else if (strcmp(arg, "--unsharp") == 0) {
+            options.unsharp_amount = atof(value);
+        } else if (strcmp(arg, "--unsharp-radius") == 0) {
+            options.unsharp_radius = max(atoi(value), 1);
+        } else if (strcmp(arg, "--downscale") == 0) {
+            options.downscale = max(atoi(value), 1);
+        } else if (strcmp(arg, "--resize") == 0) {
+            if (sscanf(value, "%dx%d", &options.resize_width, &options.resize_height) != 2 ||
+                options.resize_width <= 0 || options.resize_height <= 0) {
+                cerr << "Error: --resize expects <width>x<height>\n";
+                return false;
+            }
+        } else if (strcmp(arg, "--filter") == 0) {
+            if (!parse_resize_filter(value, options.filter)) {
+                cerr << "Error: Unknown filter " << value << '\n';
+                return false;
+            }
+        } else if (strcmp(arg, "--sigma-x") == 0 || strcmp(arg, "--sigma-y") == 0) {
+            double sigma = atof(value);
+            if (sigma < 0) {
+                cerr << "Error: " << arg << " can't be negative\n";
+                return false;
+            }
+            (arg[8] == 'x' ? options.sigma_x : options.sigma_y) = sigma;
+            options.rotated = true;
+        } else if (strcmp(arg, "--theta") == 0) {
+            options.theta = atof(value);
+            options.rotated = true;
+        } else if (strcmp(arg, "--mask") == 0) {
+            options.mask_path = value;
+        } else if (strcmp(arg, "--bloom") == 0) {
+            options.bloom_threshold = atof(value);
+            if (options.bloom_threshold < 0) {
+                cerr << "Error: --bloom can't be negative\n";
+                return false;
+            }
+        } else if (strcmp(arg, "--bloom-intensity") == 0) {
+            options.bloom_intensity = atof(value);
+        } else if (strcmp(arg, "--shadow") == 0) {
+            unsigned int rgb;
+            options.shadow = true;
+            options.shadow_mask = strcmp(value, "mask") == 0;
+            if (!options.shadow_mask) {
+                if (strlen(value) != 6 || sscanf(value, "%6x", &rgb) != 1) {
+                    cerr << "Error: --shadow expects mask or a colour as rrggbb\n";
+                    return false;
+                }
+                // Pixel is in file order, blue first
+                options.shadow_tint = {(uint8_t)rgb, (uint8_t)(rgb >> 8), (uint8_t)(rgb >> 16)};
+            }
+        } else if (strcmp(arg, "--guided") == 0) {
+            options.guided_eps = atof(value);
+            if (options.guided_eps <= 0) {
+                cerr << "Error: --guided needs a positive eps\n";
+                return false;
+            }
+        } else if (strcmp(arg, "--denoise") == 0) {
+            options.denoise_sigma = atof(value);
+            if (options.denoise_sigma < 0) {
+                cerr << "Error: --denoise can't be negative\n";
+                return false;
+            }
+        } else if (strcmp(arg, "--patch-radius") == 0) {
+            options.patch_radius = max(atoi(value), 0);
+        } else if (strcmp(arg, "--matte") == 0) {
+            options.matte_path = value;
+        } else if (strcmp(arg, "--subject") == 0) {
+            options.subject_path = value;
+        } else if (strcmp(arg, "--feather") == 0) {
+            options.feather = max(atoi(value), 0);
+        } else if (strcmp(arg, "--brightness") == 0) {
+            options.brightness = atof(value);
+        } else if (strcmp(arg, "--contrast") == 0) {
+            options.contrast = atof(value);
+        } else if (strcmp(arg, "--saturation") == 0) {
+            options.saturation = atof(value);
+        } else {
+            cerr << "Error: Unknown option " << arg << '\n';
+            return false;
+        }
+    }
 
-double gaussian(int x, int y, double sigma);
+    return true;
+}
 
-vector<vector<double>> gen_gaussian_kernel(int kernel_size);
+// malloc is used for the frames, like always, but counted so --mem-stats sees them
+static Pixel *alloc_pixels(size_t count) {
+    mem_stats_record_alloc(sizeof(Pixel) * count);
+    return (Pixel *)malloc(sizeof(Pixel) * count);
+}
 
-void *apply_blur(void *params);
+static bool has_extra_stages(Options &options) {
+    return options.rotated || options.mask_path || options.subject_path || options.unsharp_amount != 0.0f ||
+           options.downscale > 1 || options.resize_width > 0 || options.brightness != 0.0f ||
+           options.contrast != 1.0f || options.saturation != 1.0f;
+}
 
-// first argument is usually executing "./blur"
-int main(int argc, char *argv[]) {
-    if (argc <= 2) {
-        cerr << "Error: Make sure to specify the BMP file you would like to blur along with the radius of the blur.\n";
-        cerr << "\t Usage: ./main <file_name>.bmp <blur_radius>\n";
-        return 1;
+// label used for the per backend metrics
+static const char *backend_name(Options &options) {
+    if (options.bloom_threshold >= 0) {
+        return "bloom";
     }
-
-    string filename = argv[1];
-    if (!is_valid_file(filename)) {
-        cerr << "Error: The file specified does not end with \".bmp\"\n";
-        return 1;
+    if (options.guided_eps > 0) {
+        return "guided";
     }
-
-    int radius = atoi(argv[2]);
-
-    ifstream file(filename, ios::binary);
-
-    if (!file) {
-        cerr << "Error: Unable to open file " << filename << '\n';
-        return 1;
+    if (options.denoise_sigma >= 0) {
+        return "denoise";
     }
-
-    BMPHeader header;
-    if (!read_bmp_file(file, header)) {
-        return 1;
+    if (options.resize_width > 0) {
+        return "resize";
     }
+    if (has_extra_stages(options)) {
+        return "pipeline";
+    }
+    return backend_name(options.backend);
+}
 
-    int width = header.biWidth, height = header.biHeight;
-
-    // allocate enough memory for the image
-    Pixel *image = (Pixel *)malloc(sizeof(Pixel) * width * height);
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    load_image(file, header, image);
-    file.close();
+// Blurs the image with the chosen backend and stages using the given split of the work, and returns a
+// malloc'd output described by output_header. The bytes it returns never depend on threads or band_height.
+// control, when given, gets the job's progress and may cancel it, the output is then only partly written.
+static Pixel *run_blur(Options &options, int radius, BMPHeader &header, Pixel *image, int threads, int band_height,
+                       BMPHeader &output_header, bool report, JobControl *control) {
+    int width = header.biWidth, height = header.biHeight;
+    output_header = header;
 
-    auto kernel = gen_gaussian_kernel(radius);
+    if (options.bloom_threshold >= 0) {
+        Pixel *glowing = alloc_pixels((size_t)width * height);
+        bloom(width, height, image, glowing, radius, options.bloom_threshold, options.bloom_intensity, threads,
+              band_height, options.edge, control);
+        return glowing;
+    }
 
-    Pixel *blurred_image = (Pixel *)malloc(sizeof(Pixel) * width * height);
+    if (options.guided_eps > 0) {
+        Pixel *smoothed = alloc_pixels((size_t)width * height);
+        guided_filter(width, height, image, image, smoothed, radius, options.guided_eps, threads, control);
+        return smoothed;
+    }
 
-    pthread_t thread1, thread2, thread3, thread4; /*thread identifier*/
-    pthread_attr_t attr;                          /*set of thread attributes */
-    pthread_attr_init(&attr);                     /* set the default attributes of the thread */
+    if (options.denoise_sigma >= 0) {
+        Pixel *denoised = alloc_pixels((size_t)width * height);
+        nl_means(width, height, image, denoised, options.denoise_sigma, radius, options.patch_radius, threads,
+                 control);
+        return denoised;
+    }
 
-    BlurParams params1 = {header, image, blurred_image, kernel, 0, width * height / 4};
-    BlurParams params2 = {header, image, blurred_image, kernel, width * height / 4, width * height / 2};
-    BlurParams params3 = {header, image, blurred_image, kernel, width * height / 2, 3 * width * height / 4};
-    BlurParams params4 = {header, image, blurred_image, kernel, 3 * width * height / 4, width * height};
+    if (!has_extra_stages(options)) {
+        Pixel *blurred_image = alloc_pixels((size_t)width * height);
+        BlurStats stats = {0, 0};
+        run_backend(options.backend, width, height, image, blurred_image, radius, threads, band_height, options.edge,
+                    control, &stats);
+        if (report && options.backend == BACKEND_EXACT) {
+            cout << fixed << setprecision(1) << "Skipped " << 100.0 * stats.skipped_pixels / max(stats.pixels, 1LL)
+                 << "% of the frame in uniform tiles\n";
+        }
+        return blurred_image;
+    }
 
-    pthread_create(&thread1, &attr, apply_blur, &params1);
-    pthread_create(&thread2, &attr, apply_blur, &params2);
-    pthread_create(&thread3, &attr, apply_blur, &params3);
-    pthread_create(&thread4, &attr, apply_blur, &params4);
+    // the extra stages only exist in the fused pipeline, so the blur runs separably there with any backend
+    Pipeline pipeline(width, height);
+    pipeline.edge(options.edge).threads(threads).band_height(band_height).control(control);
+
+    if (options.resize_width > 0) {
+        pipeline.resize(options.resize_width, options.resize_height, options.filter,
+                        radius > 0 ? default_sigma(radius) : 0.0);
+    } else if (options.rotated) {
+        pipeline.rotated_blur(options.sigma_x < 0 ? default_sigma(radius) : options.sigma_x,
+                              options.sigma_y < 0 ? default_sigma(radius) : options.sigma_y, options.theta);
+    } else if (options.mask) {
+        pipeline.masked_blur(radius, options.mask);
+    } else if (options.subject) {
+        pipeline.background_blur(radius, options.subject, options.feather);
+    } else {
+        pipeline.blur(radius);
+    }
+    if (options.unsharp_amount != 0.0f) {
+        pipeline.unsharp(options.unsharp_radius, options.unsharp_amount);
+    }
+    if (options.downscale > 1) {
+        pipeline.downscale(options.downscale);
+    }
+    if (options.brightness != 0.0f || options.contrast != 1.0f || options.saturation != 1.0f) {
+        pipeline.adjust(options.brightness, options.contrast, options.saturation);
+    }
 
-    pthread_join(thread1, NULL);
-    pthread_join(thread2, NULL);
-    pthread_join(thread3, NULL);
-    pthread_join(thread4, NULL);
+    Pixel *blurred_image = alloc_pixels((size_t)pipeline.output_width() * pipeline.output_height());
+    if (control) {
+        control->set_total((long long)pipeline.output_width() * pipeline.output_height());
+    }
+    pipeline.run(image, blurred_image);
 
-    ofstream output_file("output.bmp");
-    save_image(output_file, header, blurred_image);
-    output_file.close();
+    if (pipeline.output_width() != width || pipeline.output_height() != height) {
+        output_header = make_bmp_header(pipeline.output_width(), pipeline.output_height());
+    }
 
-    free(image);
-    free(blurred_image);
+    PipelineTraffic traffic = pipeline.traffic();
+    if (report && pipeline.stages().size() > 1) {
+        cout << fixed << setprecision(2) << "Fused " << pipeline.stages().size()
+             << " stages: " << traffic.fused_bytes / 1e6 << " MB of frame traffic instead of "
+             << traffic.unfused_bytes / 1e6 << " MB (saved " << traffic.saved_bytes / 1e6 << " MB)\n";
+    }
 
-    return 0;
+    return blurred_image;
 }
 
-void *apply_blur(void *params) {
-    BlurParams *blur_params = (BlurParams *)params;
-    BMPHeader header = blur_params->header;
-    Pixel *image = blur_params->image;
-    Pixel *blurred_image = blur_params->blurred_image;
-    vector<vector<double>> kernel = blur_params->kernel;
-
-    int kernel_size = kernel.size();
-    int radius = kernel_size / 2;
-
-    int width = header.biWidth;
-    int height = header.biHeight;
-
-    for (int i = blur_params->start; i < blur_params->end; i++) {
-        double red = 0, green = 0, blue = 0;
-
-        for (int r = -radius; r <= radius; r++) {
-            for (int c = -radius; c <= radius; c++) {
-                int x = i % width, y = i / width;
-                if (x + c < 0 || x + c >= width || y + r < 0 || y + r >= height) {
-                    continue;
+// Re-runs the blur with a range of thread counts and band heights and diffs every result against the
+// first run. Anything cached by output hash relies on these being byte for byte identical.
+static bool verify_determinism(Options &options, int radius, BMPHeader &header, Pixel *image,
+                               BMPHeader &output_header, Pixel *expected) {
+    const int thread_counts[] = {1, 2, 3, 7, 16};
+    const int band_heights[] = {1, 5, 32, (int)header.biHeight};
+    size_t count = (size_t)output_header.biWidth * output_header.biHeight;
+    int runs = 0;
+
+    for (int threads : thread_counts) {
+        for (int band_height : band_heights) {
+            BMPHeader run_header;
+            Pixel *output = run_blur(options, radius, header, image, threads, band_height, run_header, false, NULL);
+            runs++;
+
+            for (size_t i = 0; i < count; i++) {
+                if (memcmp(output + i, expected + i, sizeof(Pixel)) != 0) {
+                    cerr << "Error: Output changed with " << threads << " threads and " << band_height
+                         << " row bands, first difference at pixel (" << i % output_header.biWidth << ", "
+                         << i / output_header.biWidth << ")\n";
+                    free(output);
+                    return false;
                 }
-
-                Pixel *sample = image + (y + r) * width + (x + c);
-
-                double weight = kernel[r + radius][c + radius];
-
-                red += sample->red * weight;
-                green += sample->green * weight;
-                blue += sample->blue * weight;
             }
+            free(output);
         }
-
-        Pixel *blurred_pixel = blurred_image + i;
-        blurred_pixel->red = red;
-        blurred_pixel->green = green;
-        blurred_pixel->blue = blue;
     }
 
-    pthread_exit(0);
+    cout << "Determinism check: " << runs << " partitions gave identical output\n";
+    return true;
 }
 
-// https://en.wikipedia.org/wiki/Gaussian_function
-double gaussian(int x, int y, double sigma) {
-    return (1.0 / (2.0 * M_PI * sigma * sigma)) * exp(-(x * x + y * y) / (2 * sigma * sigma));
-}
+// the CLI's job, Ctrl-C cancels it and the progress line reads it
+static JobControl cli_job;
 
-// https://en.wikipedia.org/wiki/Gaussian_function
-vector<vector<double>> gen_gaussian_kernel(int radius) {
-    int kernel_size = 2 * radius + 1;
-    vector<vector<double>> kernel(kernel_size, vector<double>(kernel_size, 0.0));
+static void cancel_on_interrupt(int) { cli_job.cancel(); }
 
-    // nvidia uses sigma = radius / 3.0
-    // https://stackoverflow.com/questions/17841098/gaussian-blur-standard-deviation-radius-and-kernel-size
-    // https://developer.nvidia.com/gpugems/gpugems3/part-vi-gpu-computing/chapter-40-incremental-computation-gaussian
-    double sigma = radius / 3.0;
+struct ProgressWatch {
+    const JobControl *control;
+    atomic<bool> finished;
+};
 
-    double sum = 0;
+// redraws the percentage on stderr until the blur returns
+static void *show_progress(void *arg) {
+    ProgressWatch &watch = *(ProgressWatch *)arg;
+    while (!watch.finished.load(memory_order_relaxed)) {
+        fprintf(stderr, "\rBlurring: %3d%%", (int)(watch.control->fraction() * 100));
+        usleep(100 * 1000);
+    }
+    fprintf(stderr, "\rBlurring: %3d%%\n", (int)(watch.control->fraction() * 100));
+    return NULL;
+}
 
-    for (int i = -radius; i <= radius; i++) {
-        for (int j = -radius; j <= radius; j++) {
-            double value = gaussian(i, j, sigma);
-            kernel[i + radius][j + radius] = value;
-            sum += value;
+// Drop shadows only need the alpha blurred, so it is pulled out of the 32-bit input and blurred as one plane
+// with the stack blur, a third of the work of blurring the colour. Writes output.bmp.
+static int run_shadow(const string &filename, int radius, Options &options) {
+    BMPHeader header;
+    vector<uint8_t> alpha;
+    {
+        MappedFile file(filename);
+        if (file.data() == NULL) {
+            cerr << "Error: Unable to open file " << filename << '\n';
+            return 1;
+        }
+        if (!load_alpha(file, header, alpha)) {
+            return 1;
         }
     }
 
-    // normalize
-    for (int i = 0; i < kernel_size; i++) {
-        for (int j = 0; j < kernel_size; j++) {
-            kernel[i][j] /= sum;
+    int width = header.biWidth, height = header.biHeight;
+    vector<uint8_t> shadow(alpha.size());
+    double start = now_seconds();
+    stack_blur_plane(width, height, alpha.data(), shadow.data(), default_sigma(radius), options.threads, options.edge);
+    metrics_record_job("shadow", (uint64_t)width * height, now_seconds() - start);
+
+    bool saved = options.shadow_mask ? save_mask("output.bmp", width, height, shadow.data())
+                                     : save_tinted("output.bmp", width, height, shadow.data(), options.shadow_tint);
+    return saved ? 0 : 1;
+}
+
+// Refines the matte with the guided filter, the image as the guide, so its edges snap to the image's. Writes
+// output.bmp as an 8-bit mask.
+static int run_matte(const string &filename, int radius, Options &options) {
+    BMPHeader header;
+    vector<Pixel> image;
+    vector<uint8_t> matte;
+    {
+        MappedFile file(filename);
+        if (file.data() == NULL) {
+            cerr << "Error: Unable to open file " << filename << '\n';
+            return 1;
+        }
+        if (!read_bmp_file(file, header)) {
+            return 1;
+        }
+        image.resize((size_t)header.biWidth * header.biHeight);
+        load_image(file, header, image.data());
+    }
+    {
+        MappedFile file(options.matte_path);
+        if (!load_mask(file, header.biWidth, header.biHeight, matte)) {
+            return 1;
         }
     }
 
-    return kernel;
+    int width = header.biWidth, height = header.biHeight;
+    vector<uint8_t> refined(matte.size());
+    double start = now_seconds();
+    guided_filter_plane(width, height, matte.data(), image.data(), refined.data(), radius, options.guided_eps,
+                        options.threads);
+    metrics_record_job("matte", (uint64_t)width * height, now_seconds() - start);
+    return save_mask("output.bmp", width, height, refined.data()) ? 0 : 1;
 }
 
-void save_image(ofstream &file, BMPHeader &header, Pixel *image) {
-    file.write(reinterpret_cast<char *>(&header), sizeof(BMPHeader));
+// first argument is usually executing "./blur"
+int main(int argc, char *argv[]) {
+    if (argc <= 2) {
+        cerr << "Error: Make sure to specify the BMP file you would like to blur along with the radius of the blur.\n";
+        print_usage();
+        return 1;
+    }
 
-    int row_size = header.biWidth * sizeof(Pixel);
-    int padding = (4 - (row_size % 4)) % 4;
+    if (strcmp(argv[1], "--serve") == 0) {
+        Options options;
+        if (!parse_options(argc, argv, options)) {
+            print_usage();
+            return 1;
+        }
+        if (options.metrics_socket && !serve_metrics_unix(options.metrics_socket)) {
+            return 1;
+        }
 
-    for (int y = 0; y < (int)header.biHeight; y++) {
-        file.write((char *)(image + y * header.biWidth), row_size);
-        char padding_bytes[3] = {0};  // BMP padding is zeroed
-        file.write(padding_bytes, padding);
+        ServerOptions server = {atoi(argv[2]), options.workers, options.threads, options.band_height, options.edge};
+        return run_server(server);
     }
-}
 
-void load_image(ifstream &file, BMPHeader &header, Pixel *image) {
-    file.seekg(header.bfOffBits, ios::beg);
+    string filename = argv[1];
+    if (!is_valid_file(filename)) {
+        cerr << "Error: The file specified does not end with \".bmp\"\n";
+        return 1;
+    }
 
-    // https://en.wikipedia.org/wiki/BMP_file_format#Pixel_storage
-    // http://www.dragonwins.com/domains/getteched/bmp/bmpfileformat.htm#The%20Pixel%20Data
-    int row_size = header.biWidth * 3;  // 3 is the number of bytes in each pixel for the 24 bit count
+    int radius = atoi(argv[2]);
 
-    // we do another % 4 to make sure we don't include 4 - 0 = 4 since its
-    // already divisible by 4
-    int padding = (4 - (row_size % 4)) % 4;
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
 
-    for (int y = 0; y < (int)header.biHeight; y++) {
-        file.read((char *)(image + y * header.biWidth), row_size);
-        file.seekg(padding, ios::cur);
+    if (options.budget_ms > 0 && has_extra_stages(options)) {
+        cerr << "Error: --budget-ms picks the blur backend and can't be combined with extra stages\n";
+        return 1;
+    }
+    if (options.rotated && options.resize_width > 0) {
+        cerr << "Error: --resize has its own prefilter and can't be combined with --sigma-x, --sigma-y or --theta\n";
+        return 1;
+    }
+    if ((options.mask_path || options.subject_path) && (options.rotated || options.resize_width > 0)) {
+        cerr << "Error: --mask and --subject only work with the plain blur, not with --resize or a rotated one\n";
+        return 1;
+    }
+    if (options.bloom_threshold >= 0 && (has_extra_stages(options) || options.budget_ms > 0)) {
+        cerr << "Error: --bloom runs on its own and can't be combined with other stages or --budget-ms\n";
+        return 1;
+    }
+    if (options.mask_path && options.subject_path) {
+        cerr << "Error: --mask and --subject can't be combined\n";
+        return 1;
+    }
+    if (options.shadow && (has_extra_stages(options) || options.bloom_threshold >= 0 || options.budget_ms > 0)) {
+        cerr << "Error: --shadow only blurs the alpha and can't be combined with other stages or --budget-ms\n";
+        return 1;
+    }
+    if (options.guided_eps > 0 &&
+        (has_extra_stages(options) || options.bloom_threshold >= 0 || options.shadow || options.budget_ms > 0)) {
+        cerr << "Error: --guided runs on its own and can't be combined with other stages or --budget-ms\n";
+        return 1;
+    }
+    if (options.denoise_sigma >= 0 && (has_extra_stages(options) || options.bloom_threshold >= 0 || options.shadow ||
+                                       options.guided_eps > 0 || options.budget_ms > 0)) {
+        cerr << "Error: --denoise runs on its own and can't be combined with other stages or --budget-ms\n";
+        return 1;
+    }
+    if (options.matte_path && options.guided_eps <= 0) {
+        cerr << "Error: --matte is refined by the guided filter and needs --guided\n";
+        return 1;
+    }
+    if (!backend_supports(options.backend, radius)) {
+        cerr << "Error: The " << backend_name(options.backend) << " backend only blurs radius 2 to 4\n";
+        return 1;
     }
-}
 
-bool read_bmp_file(ifstream &file, BMPHeader &header) {
-    // Read the BMP header
-    file.read(reinterpret_cast<char *>(&header), sizeof(BMPHeader));
+    // the binomial blur is a close integer stand-in for the small gaussians, and several times faster
+    if (!options.backend_set && options.budget_ms == 0 && !has_extra_stages(options)) {
+        options.backend = default_backend(radius);
+    }
+
+    if (options.metrics_socket && !serve_metrics_unix(options.metrics_socket)) {
+        return 1;
+    }
+    if (options.shadow) {
+        return run_shadow(filename, radius, options);
+    }
+    if (options.matte_path) {
+        return run_matte(filename, radius, options);
+    }
+
+    MemStats mem_stats;
+    mem_stats.begin("load");
+
+    // the file is mapped and the padding dropped in one pass over it, no per row reads
+    BMPHeader header;
+    Pixel *image;
+    {
+        MappedFile file(filename);
+        if (file.data() == NULL) {
+            cerr << "Error: Unable to open file " << filename << '\n';
+            return 1;
+        }
+        if (!read_bmp_file(file, header)) {
+            return 1;
+        }
 
-    if (!file) {
-        cerr << "Error: Unable to read BMP header.\n";
-        return false;
+        // allocate enough memory for the image
+        image = alloc_pixels((size_t)header.biWidth * header.biHeight);
+        load_image(file, header, image);
+    }
+    vector<uint8_t> mask;
+    if (options.mask_path || options.subject_path) {
+        MappedFile file(options.mask_path ? options.mask_path : options.subject_path);
+        if (!load_mask(file, header.biWidth, header.biHeight, mask)) {
+            free(image);
+            return 1;
+        }
+        (options.mask_path ? options.mask : options.subject) = mask.data();
     }
+    mem_stats.end();
 
-    // Validate BMP file type
-    // BM in little-endian
-    if (header.bfType != 0x4D42) {
-        cerr << "Error: Not a valid BMP file.\n";
-        return false;
+    int width = header.biWidth, height = header.biHeight;
+
+    mem_stats.begin("blur");
+
+    // a first Ctrl-C stops the workers at the next band or row, the default action is back for a second one
+    struct sigaction interrupt = {};
+    interrupt.sa_handler = cancel_on_interrupt;
+    interrupt.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &interrupt, NULL);
+
+    ProgressWatch watch;
+    watch.control = &cli_job;
+    watch.finished = false;
+    pthread_t progress_thread;
+    bool showing = options.progress && pthread_create(&progress_thread, NULL, show_progress, &watch) == 0;
+
+    // with a budget the backend is whichever one the cost model expects to make it, the calibration counts
+    // against the budget too
+    double budget_start = now_seconds();
+    CostModel model = {};
+    double predicted = 0;
+    if (options.budget_ms > 0) {
+        model = calibrate_cost_model(options.threads);
+        options.backend = choose_backend(model, width, height, radius, options.band_height,
+                                         options.budget_ms / 1e3 - model.calibration_seconds);
+        predicted = model.calibration_seconds +
+                    predict_seconds(model, options.backend, width, height, radius, options.band_height);
     }
 
-    if (header.biBitCount != 24) {
-        cerr << "We only support 24-bit BMP files!\n";
-        return false;
+    BMPHeader output_header;
+    double blur_start = now_seconds();
+    Pixel *blurred_image = run_blur(options, radius, header, image, options.threads, options.band_height,
+                                    output_header, true, &cli_job);
+    watch.finished = true;
+    if (showing) {
+        pthread_join(progress_thread, NULL);
     }
+    signal(SIGINT, SIG_DFL);
 
-    return true;
-}
+    if (cli_job.cancelled()) {
+        cerr << "Cancelled, output.bmp was not written\n";
+        free(image);
+        free(blurred_image);
+        return 130;
+    }
+    metrics_record_job(backend_name(options), (uint64_t)width * height, now_seconds() - blur_start);
+    mem_stats.end();
+
+    if (options.budget_ms > 0) {
+        double took = now_seconds() - budget_start;
+        bool met = took * 1e3 <= options.budget_ms;
+        metrics_record_deadline(met);
+        cout << fixed << setprecision(1) << "Budget " << options.budget_ms << " ms: chose " << backend_name(options)
+             << " (predicted " << predicted * 1e3 << " ms with " << model.calibration_seconds * 1e3
+             << " ms of calibration), took " << took * 1e3 << " ms, deadline "
+             << (met ? "met" : "missed") << '\n';
+    }
 
-bool is_valid_file(string &filename) {
-    const string suffix = ".bmp";
+    if (options.verify && !verify_determinism(options, radius, header, image, output_header, blurred_image)) {
+        free(image);
+        free(blurred_image);
+        return 1;
+    }
 
-    if (filename.size() < suffix.size()) {
-        return false;
+    mem_stats.begin("save");
+    bool saved = save_image("output.bmp", output_header, blurred_image);
+    mem_stats.end();
+
+    if (options.mem_stats) {
+        // the original program kept two full frames, the input and the blurred copy
+        long long baseline_bytes = 2LL * width * height * sizeof(Pixel);
+        if (strcmp(options.mem_stats, "-") == 0) {
+            mem_stats.write_json(cout, baseline_bytes);
+        } else {
+            ofstream json(options.mem_stats);
+            mem_stats.write_json(json, baseline_bytes);
+        }
     }
-    return filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
-}
\ No newline at end of file
+
+    free(image);
+    free(blurred_image);
+
+    return saved ? 0 : 1;
+}
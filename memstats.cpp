@@ -0,0 +1,115 @@
+#include "memstats.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <atomic>
+#include <fstream>
+#include <new>
+
+using namespace std;
+
+static atomic<long long> allocated_bytes(0);
+
+void mem_stats_record_alloc(size_t bytes) { allocated_bytes.fetch_add(bytes, memory_order_relaxed); }
+
+long long mem_stats_allocated_bytes() { return allocated_bytes.load(memory_order_relaxed); }
+
+// every std::vector in the engines goes through here, so the per phase numbers include the band buffers
+void *operator new(size_t size) {
+    mem_stats_record_alloc(size);
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long long mem_stats_heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return (long long)info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// reads a "Key:   1234 kB" line from a /proc file, in bytes
+static long long proc_kb_field(const char *path, const string &key) {
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0 && line.size() > key.size() && line[key.size()] == ':') {
+            return atoll(line.c_str() + key.size() + 1) * 1024;
+        }
+    }
+    return 0;
+}
+
+void MemStats::begin(const string &phase) {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    MemPhase entry = {};
+    entry.name = phase;
+    phases_.push_back(entry);
+
+    start_seconds_ = now_seconds();
+    start_allocated_ = mem_stats_allocated_bytes();
+    start_minor_ = usage.ru_minflt;
+    start_major_ = usage.ru_majflt;
+}
+
+void MemStats::end() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    MemPhase &entry = phases_.back();
+    entry.seconds = now_seconds() - start_seconds_;
+    entry.allocated_bytes = mem_stats_allocated_bytes() - start_allocated_;
+    entry.heap_in_use_bytes = mem_stats_heap_in_use();
+    entry.rss_bytes = proc_kb_field("/proc/self/status", "VmRSS");
+    entry.minor_faults = usage.ru_minflt - start_minor_;
+    entry.major_faults = usage.ru_majflt - start_major_;
+}
+
+const vector<MemPhase> &MemStats::phases() const { return phases_; }
+
+void MemStats::write_json(ostream &out, long long baseline_bytes) const {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    out << "{\n";
+    out << "  \"peak_rss_bytes\": " << (long long)usage.ru_maxrss * 1024 << ",\n";
+    out << "  \"vm_hwm_bytes\": " << proc_kb_field("/proc/self/status", "VmHWM") << ",\n";
+    out << "  \"anon_huge_pages_bytes\": " << proc_kb_field("/proc/self/smaps_rollup", "AnonHugePages") << ",\n";
+    out << "  \"hugetlb_bytes\": " << proc_kb_field("/proc/self/status", "HugetlbPages") << ",\n";
+    out << "  \"minor_faults\": " << usage.ru_minflt << ",\n";
+    out << "  \"major_faults\": " << usage.ru_majflt << ",\n";
+    out << "  \"allocated_bytes\": " << mem_stats_allocated_bytes() << ",\n";
+    out << "  \"baseline_frame_bytes\": " << baseline_bytes << ",\n";
+    out << "  \"phases\": [";
+
+    for (size_t i = 0; i < phases_.size(); i++) {
+        const MemPhase &p = phases_[i];
+        out << (i ? ",\n" : "\n");
+        out << "    {\"name\": \"" << p.name << "\", \"seconds\": " << p.seconds
+            << ", \"allocated_bytes\": " << p.allocated_bytes << ", \"heap_in_use_bytes\": " << p.heap_in_use_bytes
+            << ", \"rss_bytes\": " << p.rss_bytes << ", \"minor_faults\": " << p.minor_faults
+            << ", \"major_faults\": " << p.major_faults << "}";
+    }
+
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,46 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <stddef.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct MemPhase {
+    std::string name;
+    double seconds;
+    long long allocated_bytes;    // requested through operator new or counted malloc during the phase
+    long long heap_in_use_bytes;  // live heap at the end of the phase, from mallinfo
+    long long rss_bytes;          // VmRSS at the end of the phase
+    long minor_faults, major_faults;
+};
+
+// Records memory use per phase of a run (load, blur, save, ...) so the streaming, in-place and pooled
+// paths can be compared against the baseline of two full frame buffers.
+class MemStats {
+   public:
+    void begin(const std::string &phase);
+    void end();
+
+    const std::vector<MemPhase> &phases() const;
+
+    // baseline_bytes is what the original two malloc'd frames would have cost for this image
+    void write_json(std::ostream &out, long long baseline_bytes) const;
+
+   private:
+    std::vector<MemPhase> phases_;
+    double start_seconds_;
+    long long start_allocated_;
+    long start_minor_, start_major_;
+};
+
+// malloc'd buffers are counted by hand, operator new is counted automatically
+void mem_stats_record_alloc(size_t bytes);
+
+long long mem_stats_allocated_bytes();
+
+// live heap bytes according to mallinfo, 0 where that isn't available
+long long mem_stats_heap_in_use();
+
+#endif
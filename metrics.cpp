@@ -0,0 +1,288 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "memstats.h"
+
+using namespace std;
+
+const double LATENCY_BOUNDS[LATENCY_BUCKETS] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                                0.1,   0.25,   0.5,   1.0,  2.5,   10.0};
+
+static const int MAX_BACKENDS = 16;
+
+// each thread picks a shard the first time it records anything and keeps it
+static int shard_index() {
+    static atomic<int> next_shard(0);
+    static thread_local int shard = next_shard.fetch_add(1, memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+static double monotonic_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const double start_seconds = monotonic_seconds();
+
+Counter::Counter() {
+    for (CounterShard &shard : shards_) {
+        shard.value.store(0, memory_order_relaxed);
+    }
+}
+
+void Counter::add(uint64_t amount) { shards_[shard_index()].value.fetch_add(amount, memory_order_relaxed); }
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const CounterShard &shard : shards_) {
+        total += shard.value.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+void Histogram::observe(double seconds) {
+    int i = 0;
+    while (i < LATENCY_BUCKETS && seconds > LATENCY_BOUNDS[i]) {
+        i++;
+    }
+    buckets_[i].add(1);
+    sum_micros_.add((uint64_t)(seconds * 1e6));
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (const Counter &bucket : buckets_) {
+        total += bucket.value();
+    }
+    return total;
+}
+
+double Histogram::sum() const { return sum_micros_.value() / 1e6; }
+
+uint64_t Histogram::bucket(int i) const { return buckets_[i].value(); }
+
+double Histogram::quantile(double q) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    double target = q * total;
+    uint64_t seen = 0;
+    for (int i = 0; i <= LATENCY_BUCKETS; i++) {
+        uint64_t in_bucket = buckets_[i].value();
+        if (seen + in_bucket >= target && in_bucket > 0) {
+            double lower = i == 0 ? 0 : LATENCY_BOUNDS[i - 1];
+            if (i == LATENCY_BUCKETS) {
+                return lower;
+            }
+            return lower + (LATENCY_BOUNDS[i] - lower) * (target - seen) / in_bucket;
+        }
+        seen += in_bucket;
+    }
+    return LATENCY_BOUNDS[LATENCY_BUCKETS - 1];
+}
+
+struct BackendSlot {
+    atomic<const char *> name;
+    Histogram histogram;
+};
+
+static BackendSlot backend_slots[MAX_BACKENDS];
+
+Histogram *Metrics::latency(const char *backend) {
+    // slots are claimed with a CAS and never released, so a plain scan is safe without a lock.
+    // Names are expected to be string literals, anything past MAX_BACKENDS shares the last slot.
+    for (int i = 0; i < MAX_BACKENDS; i++) {
+        const char *name = backend_slots[i].name.load(memory_order_acquire);
+        if (name == NULL) {
+            const char *expected = NULL;
+            if (backend_slots[i].name.compare_exchange_strong(expected, backend, memory_order_acq_rel)) {
+                return &backend_slots[i].histogram;
+            }
+            name = expected;
+        }
+        if (strcmp(name, backend) == 0) {
+            return &backend_slots[i].histogram;
+        }
+    }
+    return &backend_slots[MAX_BACKENDS - 1].histogram;
+}
+
+Metrics &metrics() {
+    static Metrics instance;
+    return instance;
+}
+
+void metrics_record_job(const char *backend, uint64_t pixels, double seconds) {
+    Metrics &m = metrics();
+    m.jobs.add(1);
+    m.pixels.add(pixels);
+    m.latency(backend)->observe(seconds);
+}
+
+void metrics_record_deadline(bool met) {
+    if (met) {
+        metrics().deadlines_met.add(1);
+    } else {
+        metrics().deadlines_missed.add(1);
+    }
+}
+
+static void write_metric(ostream &out, const char *name, const char *type, const char *help, double value) {
+    out << "# HELP " << name << ' ' << help << '\n';
+    out << "# TYPE " << name << ' ' << type << '\n';
+    out << name << ' ' << value << '\n';
+}
+
+void render_metrics(ostream &out) {
+    Metrics &m = metrics();
+    double uptime = max(monotonic_seconds() - start_seconds, 1e-9);
+    uint64_t jobs = m.jobs.value();
+    uint64_t pixels = m.pixels.value();
+
+    // large counters would otherwise come out in exponent form
+    streamsize precision = out.precision(12);
+
+    write_metric(out, "blur_jobs_total", "counter", "Finished blur jobs.", jobs);
+    write_metric(out, "blur_failed_jobs_total", "counter", "Jobs that failed or were rejected.", m.failed_jobs.value());
+    write_metric(out, "blur_cancelled_jobs_total", "counter", "Jobs cancelled after the client disconnected.",
+                 m.cancelled_jobs.value());
+    write_metric(out, "blur_deadlines_met_total", "counter", "Budgeted jobs that finished within their budget.",
+                 m.deadlines_met.value());
+    write_metric(out, "blur_deadlines_missed_total", "counter", "Budgeted jobs that overran their budget.",
+                 m.deadlines_missed.value());
+    write_metric(out, "blur_megapixels_total", "counter", "Megapixels blurred.", pixels / 1e6);
+    write_metric(out, "blur_jobs_per_second", "gauge", "Average jobs per second since start.", jobs / uptime);
+    write_metric(out, "blur_megapixels_per_second", "gauge", "Average megapixels per second since start.",
+                 pixels / 1e6 / uptime);
+    write_metric(out, "blur_bytes_in_total", "counter", "Encoded bytes received.", m.bytes_in.value());
+    write_metric(out, "blur_bytes_out_total", "counter", "Encoded bytes sent.", m.bytes_out.value());
+    write_metric(out, "blur_queue_depth", "gauge", "Jobs waiting for a worker.", m.queue_depth.value());
+    write_metric(out, "blur_active_jobs", "gauge", "Jobs being processed.", m.active_jobs.value());
+    write_metric(out, "blur_pool_hits_total", "counter", "Buffer requests served from the pool.", m.pool_hits.value());
+    write_metric(out, "blur_pool_misses_total", "counter", "Buffer requests that had to allocate.",
+                 m.pool_misses.value());
+    write_metric(out, "blur_pool_bytes", "gauge", "Bytes held by the buffer pool.", m.pool_bytes.value());
+    write_metric(out, "blur_memory_in_use_bytes", "gauge", "Live heap bytes.", mem_stats_heap_in_use());
+    write_metric(out, "blur_uptime_seconds", "gauge", "Seconds since start.", uptime);
+
+    out << "# HELP blur_job_latency_seconds Time to blur one job, by backend.\n";
+    out << "# TYPE blur_job_latency_seconds histogram\n";
+    for (int i = 0; i < MAX_BACKENDS; i++) {
+        const char *name = backend_slots[i].name.load(memory_order_acquire);
+        if (name == NULL) {
+            break;
+        }
+        const Histogram &h = backend_slots[i].histogram;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            cumulative += h.bucket(b);
+            out << "blur_job_latency_seconds_bucket{backend=\"" << name << "\",le=\"" << LATENCY_BOUNDS[b] << "\"} "
+                << cumulative << '\n';
+        }
+        out << "blur_job_latency_seconds_bucket{backend=\"" << name << "\",le=\"+Inf\"} " << h.count() << '\n';
+        out << "blur_job_latency_seconds_sum{backend=\"" << name << "\"} " << h.sum() << '\n';
+        out << "blur_job_latency_seconds_count{backend=\"" << name << "\"} " << h.count() << '\n';
+    }
+
+    out << "# HELP blur_job_latency_quantile_seconds Latency percentiles estimated from the histogram.\n";
+    out << "# TYPE blur_job_latency_quantile_seconds gauge\n";
+    for (int i = 0; i < MAX_BACKENDS; i++) {
+        const char *name = backend_slots[i].name.load(memory_order_acquire);
+        if (name == NULL) {
+            break;
+        }
+        for (double q : {0.5, 0.9, 0.99}) {
+            out << "blur_job_latency_quantile_seconds{backend=\"" << name << "\",quantile=\"" << q << "\"} "
+                << backend_slots[i].histogram.quantile(q) << '\n';
+        }
+    }
+
+    out.precision(precision);
+}
+
+int accept_client(int listener) {
+    while (true) {
+        int client = accept(listener, NULL, NULL);
+        if (client >= 0) {
+            return client;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM) {
+            return -1;
+        }
+        // the listener stays readable while the backlog holds connections, so the sleep is what backs off
+        poll(NULL, 0, ACCEPT_BACKOFF_MS);
+        pollfd waiting = {listener, POLLIN, 0};
+        poll(&waiting, 1, ACCEPT_BACKOFF_MS);
+    }
+}
+
+static void *metrics_socket_loop(void *arg) {
+    int server = (int)(intptr_t)arg;
+
+    while (true) {
+        int client = accept_client(server);
+        if (client < 0) {
+            cerr << "Error: Metrics socket stopped accepting: " << strerror(errno) << '\n';
+            close(server);
+            return NULL;
+        }
+
+        ostringstream text;
+        render_metrics(text);
+        string body = text.str();
+
+        size_t sent = 0;
+        while (sent < body.size()) {
+            ssize_t n = write(client, body.data() + sent, body.size() - sent);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        close(client);
+    }
+
+    return NULL;
+}
+
+bool serve_metrics_unix(const string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Metrics socket path is too long\n";
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (server < 0 || bind(server, (sockaddr *)&address, sizeof(address)) < 0 || listen(server, 16) < 0) {
+        cerr << "Error: Unable to listen on " << path << ": " << strerror(errno) << '\n';
+        if (server >= 0) {
+            close(server);
+        }
+        return false;
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, metrics_socket_loop, (void *)(intptr_t)server);
+    pthread_detach(thread);
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+// Counters are split over cache line sized shards and each thread adds to its own shard with a relaxed
+// atomic, so recording from the workers never takes a lock or bounces a shared line. Reads sum the shards.
+static const int METRIC_SHARDS = 16;
+
+struct alignas(64) CounterShard {
+    std::atomic<uint64_t> value;
+};
+
+class Counter {
+   public:
+    Counter();
+    void add(uint64_t amount);
+    uint64_t value() const;
+
+   private:
+    CounterShard shards_[METRIC_SHARDS];
+};
+
+class Gauge {
+   public:
+    Gauge() : value_(0) {}
+    void add(int64_t amount) { value_.fetch_add(amount, std::memory_order_relaxed); }
+    void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<int64_t> value_;
+};
+
+// latency buckets in seconds, shared by every histogram
+static const int LATENCY_BUCKETS = 12;
+extern const double LATENCY_BOUNDS[LATENCY_BUCKETS];
+
+class Histogram {
+   public:
+    void observe(double seconds);
+
+    uint64_t count() const;
+    double sum() const;
+    uint64_t bucket(int i) const;  // observations <= LATENCY_BOUNDS[i], not cumulative
+
+    // estimated from the buckets by interpolating inside the one holding the quantile
+    double quantile(double q) const;
+
+   private:
+    Counter buckets_[LATENCY_BUCKETS + 1];  // the last one is +Inf
+    Counter sum_micros_;
+};
+
+// Everything the engine reports. Per backend latency is looked up by name without locking.
+struct Metrics {
+    Counter jobs;
+    Counter failed_jobs;
+    Counter cancelled_jobs;  // stopped early because the client went away
+    Counter deadlines_met, deadlines_missed;  // jobs run with a time budget
+    Counter pixels;
+    Counter bytes_in, bytes_out;
+    Counter pool_hits, pool_misses;
+    Gauge queue_depth;
+    Gauge active_jobs;
+    Gauge pool_bytes;
+
+    Histogram *latency(const char *backend);
+};
+
+Metrics &metrics();
+
+// records one finished job against the counters and its backend's histogram
+void metrics_record_job(const char *backend, uint64_t pixels, double seconds);
+
+// records whether a job run with --budget-ms finished within it
+void metrics_record_deadline(bool met);
+
+// Prometheus text exposition format, version 0.0.4
+void render_metrics(std::ostream &out);
+
+// serves render_metrics to anything connecting to the unix socket at path, from a background thread
+bool serve_metrics_unix(const std::string &path);
+
+// how long accept_client waits before trying again once the process is out of descriptors or buffers
+static const int ACCEPT_BACKOFF_MS = 100;
+
+// accept() for the listening loops. Interrupted calls and connections that died in the backlog are retried.
+// Out of descriptors or buffers, every accept fails until something is closed, so it waits ACCEPT_BACKOFF_MS
+// and then for the listener before retrying rather than spinning. Any other error returns -1 with errno set.
+int accept_client(int listener);
+
+#endif
@@ -0,0 +1,714 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kernels.h"
+
+using namespace std;
+
+// every intermediate is kept as interleaved float rows, one float per channel
+static const int CHANNELS = 3;
+
+// the masked blur carries the mask along with the weighted colours, so one pair of passes blurs both
+static const int MASKED_CHANNELS = CHANNELS + 1;
+
+struct RowRange {
+    int begin, end;
+};
+
+struct PipelineParams {
+    const vector<Stage> *stages;
+    const Pixel *input;
+    Pixel *output;
+    EdgeMode edge;
+    RowRange output_rows;
+    int band_height;
+    int first_band;
+    int band_step;
+    JobControl *control;
+};
+
+Pipeline::Pipeline(int width, int height)
+    : width_(width), height_(height), edge_(EDGE_ZERO), num_threads_(4), band_height_(32), control_(NULL) {}
+
+Stage &Pipeline::add_stage(StageType type) {
+    Stage stage = {};
+    stage.type = type;
+    stage.in_width = stage.out_width = output_width();
+    stage.in_height = stage.out_height = output_height();
+    stages_.push_back(stage);
+    return stages_.back();
+}
+
+Pipeline &Pipeline::blur(int radius) { return blur(radius, default_sigma(radius)); }
+
+Pipeline &Pipeline::blur(int radius, double sigma) {
+    Stage &stage = add_stage(STAGE_BLUR);
+    stage.radius = radius;
+    stage.kernel = gen_gaussian_kernel_1d(radius, sigma);
+    return *this;
+}
+
+Pipeline &Pipeline::unsharp(int radius, float amount) {
+    Stage &stage = add_stage(STAGE_UNSHARP);
+    stage.radius = radius;
+    stage.kernel = gen_gaussian_kernel_1d(radius, default_sigma(radius));
+    stage.amount = amount;
+    return *this;
+}
+
+Pipeline &Pipeline::downscale(int factor) {
+    Stage &stage = add_stage(STAGE_DOWNSCALE);
+    stage.factor = max(factor, 1);
+    stage.out_width = max(stage.in_width / stage.factor, 1);
+    stage.out_height = max(stage.in_height / stage.factor, 1);
+    return *this;
+}
+
+Pipeline &Pipeline::adjust(float brightness, float contrast, float saturation) {
+    Stage &stage = add_stage(STAGE_ADJUST);
+    stage.brightness = brightness;
+    stage.contrast = contrast;
+    stage.saturation = saturation;
+    return *this;
+}
+
+Pipeline &Pipeline::threshold(float level) {
+    Stage &stage = add_stage(STAGE_THRESHOLD);
+    stage.threshold = max(level, 0.0f);
+    return *this;
+}
+
+Pipeline &Pipeline::resize(int width, int height, ResizeFilter filter, double prefilter_sigma) {
+    Stage &stage = add_stage(STAGE_RESIZE);
+    stage.out_width = max(width, 1);
+    stage.out_height = max(height, 1);
+    stage.x_weights = compute_resize_weights(stage.in_width, stage.out_width, filter, prefilter_sigma);
+    stage.y_weights = compute_resize_weights(stage.in_height, stage.out_height, filter, prefilter_sigma);
+    return *this;
+}
+
+// Geusebroek, Smeulders and van de Weijer, "Fast anisotropic Gauss filtering": the covariance is split into a
+// gaussian along one axis and one along the line (shear, 1) through the rows, or (1, shear) through the
+// columns. The line goes through whichever axis has the larger variance, so |shear| <= 1, and its samples
+// between pixels are linear interpolations, two taps each.
+Pipeline &Pipeline::rotated_blur(double sigma_x, double sigma_y, double theta) {
+    Stage &stage = add_stage(STAGE_ROTATED);
+    double c = cos(theta * M_PI / 180), s = sin(theta * M_PI / 180);
+    double vx = sigma_x * sigma_x, vy = sigma_y * sigma_y;
+    double sxx = vx * c * c + vy * s * s, syy = vx * s * s + vy * c * c, sxy = (vx - vy) * s * c;
+
+    stage.axis_vertical = sxx > syy;
+    double line_variance = stage.axis_vertical ? sxx : syy;
+    double shear = line_variance > 0 ? sxy / line_variance : 0.0;
+    double axis_variance = (stage.axis_vertical ? syy : sxx) - shear * sxy;
+    double axis_sigma = sqrt(max(axis_variance, 0.0)), line_sigma = sqrt(line_variance);
+
+    int axis_radius = (int)ceil(3 * axis_sigma), line_radius = (int)ceil(3 * line_sigma);
+    stage.kernel = gen_gaussian_kernel_1d(axis_radius, axis_sigma);
+    vector<float> line = gen_gaussian_kernel_1d(line_radius, line_sigma);
+
+    int reach = 0;
+    for (int k = -line_radius; k <= line_radius; k++) {
+        double offset = k * shear;
+        int whole = (int)floor(offset);
+        float fraction = offset - whole, weight = line[k + line_radius];
+        for (int side = 0; side < 2; side++) {
+            float w = side == 0 ? weight * (1 - fraction) : weight * fraction;
+            if (w == 0.0f) {
+                continue;
+            }
+            ShearTap tap = stage.axis_vertical ? ShearTap{k, whole + side, w} : ShearTap{whole + side, k, w};
+            stage.taps.push_back(tap);
+            reach = max(reach, abs(tap.dy));
+        }
+    }
+    stage.radius = reach + (stage.axis_vertical ? axis_radius : 0);
+    return *this;
+}
+
+Pipeline &Pipeline::masked_blur(int radius, const uint8_t *mask) {
+    Stage &stage = add_stage(STAGE_MASKED);
+    stage.radius = radius;
+    stage.kernel = gen_gaussian_kernel_1d(radius, default_sigma(radius));
+    stage.mask = mask;
+    return *this;
+}
+
+Pipeline &Pipeline::background_blur(int radius, const uint8_t *subject, int feather_radius) {
+    Stage &stage = add_stage(STAGE_BACKGROUND);
+    stage.radius = radius;
+    stage.kernel = gen_gaussian_kernel_1d(radius, default_sigma(radius));
+    stage.mask = subject;
+    if (feather_radius > 0) {
+        stage.feather = gen_gaussian_kernel_1d(feather_radius, default_sigma(feather_radius));
+    }
+    return *this;
+}
+
+Pipeline &Pipeline::edge(EdgeMode mode) {
+    edge_ = mode;
+    return *this;
+}
+
+Pipeline &Pipeline::threads(int num_threads) {
+    num_threads_ = max(num_threads, 1);
+    return *this;
+}
+
+Pipeline &Pipeline::band_height(int rows) {
+    band_height_ = max(rows, 1);
+    return *this;
+}
+
+Pipeline &Pipeline::control(JobControl *control) {
+    control_ = control;
+    return *this;
+}
+
+int Pipeline::output_width() const { return stages_.empty() ? width_ : stages_.back().out_width; }
+
+int Pipeline::output_height() const { return stages_.empty() ? height_ : stages_.back().out_height; }
+
+const vector<Stage> &Pipeline::stages() const { return stages_; }
+
+PipelineTraffic Pipeline::traffic() const {
+    PipelineTraffic traffic;
+    traffic.unfused_bytes = 0;
+    for (const Stage &stage : stages_) {
+        traffic.unfused_bytes += (long long)stage.in_width * stage.in_height * sizeof(Pixel);
+        traffic.unfused_bytes += (long long)stage.out_width * stage.out_height * sizeof(Pixel);
+    }
+
+    traffic.fused_bytes = (long long)width_ * height_ * sizeof(Pixel);
+    traffic.fused_bytes += (long long)output_width() * output_height() * sizeof(Pixel);
+
+    // a mask is read once either way
+    for (const Stage &stage : stages_) {
+        if (stage.type == STAGE_MASKED || stage.type == STAGE_BACKGROUND) {
+            traffic.unfused_bytes += (long long)stage.in_width * stage.in_height;
+            traffic.fused_bytes += (long long)stage.in_width * stage.in_height;
+        }
+    }
+    traffic.unfused_bytes = max(traffic.unfused_bytes, traffic.fused_bytes);
+    traffic.saved_bytes = traffic.unfused_bytes - traffic.fused_bytes;
+    return traffic;
+}
+
+// rows of the stage's input needed to produce the given rows of its output
+static RowRange input_rows(const Stage &stage, RowRange out) {
+    switch (stage.type) {
+        case STAGE_BLUR:
+        case STAGE_UNSHARP:
+        case STAGE_ROTATED:
+        case STAGE_MASKED:
+        case STAGE_BACKGROUND:
+            return {max(out.begin - stage.radius, 0), min(out.end + stage.radius, stage.in_height)};
+        case STAGE_DOWNSCALE:
+            return {out.begin * stage.factor, min(out.end * stage.factor, stage.in_height)};
+        case STAGE_RESIZE: {
+            const ResizeWeights &w = stage.y_weights;
+            RowRange in = {w.start[out.begin], 0};
+            for (int y = out.begin; y < out.end; y++) {
+                in.end = max(in.end, w.start[y] + w.count[y]);
+            }
+            return in;
+        }
+        default:
+            return out;
+    }
+}
+
+// one output pixel near the ends of the row, where some taps fall outside it
+static void horizontal_edge_pixel(const float *src, float *dst, int x, int width, const vector<float> &kernel,
+                                  EdgeMode edge, int channels) {
+    int radius = kernel.size() / 2;
+    float sum[MASKED_CHANNELS] = {0};
+
+    for (int k = -radius; k <= radius; k++) {
+        int sx = x + k;
+        if (sx < 0 || sx >= width) {
+            if (edge == EDGE_ZERO) {
+                continue;
+            }
+            sx = min(max(sx, 0), width - 1);
+        }
+
+        float weight = kernel[k + radius];
+        for (int c = 0; c < channels; c++) {
+            sum[c] += src[sx * channels + c] * weight;
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        dst[x * channels + c] = sum[c];
+    }
+}
+
+// only writes output pixels [begin, end) of the row
+static void horizontal_span(const float *src, float *dst, int width, int begin, int end, const vector<float> &kernel,
+                            EdgeMode edge, int channels) {
+    int radius = kernel.size() / 2;
+
+    // in the interior every tap lands inside the row, so it is one flat convolution over the interleaved floats
+    int lo = min(radius, width), hi = max(width - radius, lo);
+    int inner_begin = max(begin, lo), inner_end = min(end, hi);
+    if (inner_end > inner_begin) {
+        row_kernels().convolve(src + inner_begin * channels, dst + inner_begin * channels,
+                               (inner_end - inner_begin) * channels, kernel.data(), radius, channels);
+    }
+
+    for (int x = begin; x < min(end, lo); x++) {
+        horizontal_edge_pixel(src, dst, x, width, kernel, edge, channels);
+    }
+    for (int x = max(begin, hi); x < end; x++) {
+        horizontal_edge_pixel(src, dst, x, width, kernel, edge, channels);
+    }
+}
+
+static void horizontal_pass(const float *src, float *dst, int width, const vector<float> &kernel, EdgeMode edge,
+                            int channels = CHANNELS) {
+    horizontal_span(src, dst, width, 0, width, kernel, edge, channels);
+}
+
+// src holds rows [in.begin, in.end) of a frame that is `height` rows tall, only columns [begin, end) are
+// written
+static void vertical_span(const float *src, RowRange in, float *dst, RowRange out, int width, int height, int begin,
+                          int end, const vector<float> &kernel, EdgeMode edge, int channels) {
+    int radius = kernel.size() / 2;
+    int row_floats = width * channels;
+    int offset = begin * channels, count = (end - begin) * channels;
+    const RowKernels &kernels = row_kernels();
+
+    for (int y = out.begin; y < out.end; y++) {
+        float *dst_row = dst + (size_t)(y - out.begin) * row_floats + offset;
+        fill(dst_row, dst_row + count, 0.0f);
+
+        for (int k = -radius; k <= radius; k++) {
+            int sy = y + k;
+            if (sy < 0 || sy >= height) {
+                if (edge == EDGE_ZERO) {
+                    continue;
+                }
+                sy = min(max(sy, 0), height - 1);
+            }
+
+            kernels.add_scaled(dst_row, src + (size_t)(sy - in.begin) * row_floats + offset, kernel[k + radius],
+                               count);
+        }
+    }
+}
+
+static void vertical_pass(const float *src, RowRange in, float *dst, RowRange out, int width, int height,
+                          const vector<float> &kernel, EdgeMode edge, int channels = CHANNELS) {
+    vertical_span(src, in, dst, out, width, height, 0, width, kernel, edge, channels);
+}
+
+static void blur_rows(const Stage &stage, const float *src, RowRange in, float *dst, RowRange out,
+                      vector<float> &scratch, EdgeMode edge) {
+    int row_floats = stage.in_width * CHANNELS;
+    scratch.resize((size_t)(in.end - in.begin) * row_floats);
+
+    for (int y = in.begin; y < in.end; y++) {
+        size_t offset = (size_t)(y - in.begin) * row_floats;
+        horizontal_pass(src + offset, scratch.data() + offset, stage.in_width, stage.kernel, edge);
+    }
+    vertical_pass(scratch.data(), in, dst, out, stage.in_width, stage.in_height, stage.kernel, edge);
+}
+
+// Knutsson and Westin's normalised convolution: the colours are weighted by the mask and the mask is blurred
+// alongside them as a fourth channel, so invalid pixels drop out of both sums and the divide renormalises
+// over what is left. With zero edges the outside drops out the same way and the border doesn't darken.
+static void masked_rows(const Stage &stage, const float *src, RowRange in, float *dst, RowRange out,
+                        vector<float> &scratch, vector<float> &blurred, EdgeMode edge) {
+    int width = stage.in_width;
+    int row_floats = width * MASKED_CHANNELS;
+
+    blurred.resize((size_t)(in.end - in.begin) * row_floats);
+    for (int y = in.begin; y < in.end; y++) {
+        const float *src_row = src + (size_t)(y - in.begin) * width * CHANNELS;
+        const uint8_t *mask_row = stage.mask + (size_t)y * width;
+        float *weighted = blurred.data() + (size_t)(y - in.begin) * row_floats;
+        for (int x = 0; x < width; x++) {
+            float m = mask_row[x] * (1.0f / 255);
+            for (int c = 0; c < CHANNELS; c++) {
+                weighted[x * MASKED_CHANNELS + c] = src_row[x * CHANNELS + c] * m;
+            }
+            weighted[x * MASKED_CHANNELS + CHANNELS] = m;
+        }
+    }
+
+    scratch.resize(blurred.size());
+    for (int y = in.begin; y < in.end; y++) {
+        size_t offset = (size_t)(y - in.begin) * row_floats;
+        horizontal_pass(blurred.data() + offset, scratch.data() + offset, width, stage.kernel, edge, MASKED_CHANNELS);
+    }
+    // the weighted rows are done with, the column pass writes its sums over them
+    vertical_pass(scratch.data(), in, blurred.data(), out, width, stage.in_height, stage.kernel, edge,
+                  MASKED_CHANNELS);
+
+    for (int y = out.begin; y < out.end; y++) {
+        const float *sums = blurred.data() + (size_t)(y - out.begin) * row_floats;
+        const float *src_row = src + (size_t)(y - in.begin) * width * CHANNELS;
+        float *dst_row = dst + (size_t)(y - out.begin) * width * CHANNELS;
+        for (int x = 0; x < width; x++) {
+            float weight = sums[x * MASKED_CHANNELS + CHANNELS];
+            for (int c = 0; c < CHANNELS; c++) {
+                dst_row[x * CHANNELS + c] =
+                    weight > 0 ? sums[x * MASKED_CHANNELS + c] / weight : src_row[x * CHANNELS + c];
+            }
+        }
+    }
+}
+
+// columns per tile of the background blur, a tile that is all subject in the band is copied through
+static const int SUBJECT_TILE = 32;
+
+// The subject mask is turned into transparency, 1 - mask, before it is feathered. A pixel whose feathering
+// window is all subject then sums to exactly 0 and is copied bit for bit whichever tile it falls in, so
+// skipping tiles never depends on the band split. The rest is in + (blur(in) - in) * transparency.
+static void background_rows(const Stage &stage, const float *src, RowRange in, float *dst, RowRange out,
+                            vector<float> &scratch, vector<float> &blurred, vector<float> &transparency,
+                            EdgeMode edge) {
+    int width = stage.in_width, height = stage.in_height;
+    int row_floats = width * CHANNELS;
+
+    transparency.resize((size_t)(out.end - out.begin) * width);
+    int feather = stage.feather.size() / 2;
+    RowRange mask_rows = out;
+    float *raw = transparency.data();
+    if (feather > 0) {
+        mask_rows = {max(out.begin - feather, 0), min(out.end + feather, height)};
+        scratch.resize((size_t)(mask_rows.end - mask_rows.begin) * width);
+        raw = scratch.data();
+    }
+    for (int y = mask_rows.begin; y < mask_rows.end; y++) {
+        const uint8_t *mask_row = stage.mask + (size_t)y * width;
+        float *row = raw + (size_t)(y - mask_rows.begin) * width;
+        for (int x = 0; x < width; x++) {
+            row[x] = (255 - mask_row[x]) * (1.0f / 255);
+        }
+    }
+    // the feathering never fades at the frame's border, a subject that touches it stays sharp there
+    if (feather > 0) {
+        blurred.resize(scratch.size());
+        for (int y = mask_rows.begin; y < mask_rows.end; y++) {
+            size_t offset = (size_t)(y - mask_rows.begin) * width;
+            horizontal_pass(scratch.data() + offset, blurred.data() + offset, width, stage.feather, EDGE_CLAMP, 1);
+        }
+        vertical_pass(blurred.data(), mask_rows, transparency.data(), out, width, height, stage.feather, EDGE_CLAMP,
+                      1);
+    }
+
+    // only the tiles with some background in these rows get blurred
+    vector<RowRange> spans;
+    for (int x0 = 0; x0 < width; x0 += SUBJECT_TILE) {
+        int x1 = min(x0 + SUBJECT_TILE, width);
+        bool subject = true;
+        for (int y = 0; y < out.end - out.begin && subject; y++) {
+            const float *row = transparency.data() + (size_t)y * width;
+            subject = all_of(row + x0, row + x1, [](float t) { return t == 0.0f; });
+        }
+        if (subject) {
+            continue;
+        }
+        if (!spans.empty() && spans.back().end == x0) {
+            spans.back().end = x1;
+        } else {
+            spans.push_back({x0, x1});
+        }
+    }
+
+    blurred.resize((size_t)(out.end - out.begin) * row_floats);
+    if (!spans.empty()) {
+        scratch.resize((size_t)(in.end - in.begin) * row_floats);
+        for (const RowRange &span : spans) {
+            for (int y = in.begin; y < in.end; y++) {
+                size_t offset = (size_t)(y - in.begin) * row_floats;
+                horizontal_span(src + offset, scratch.data() + offset, width, span.begin, span.end, stage.kernel,
+                                edge, CHANNELS);
+            }
+            vertical_span(scratch.data(), in, blurred.data(), out, width, height, span.begin, span.end, stage.kernel,
+                          edge, CHANNELS);
+        }
+    }
+
+    for (int y = out.begin; y < out.end; y++) {
+        const float *src_row = src + (size_t)(y - in.begin) * row_floats;
+        const float *blur_row = blurred.data() + (size_t)(y - out.begin) * row_floats;
+        const float *t = transparency.data() + (size_t)(y - out.begin) * width;
+        float *dst_row = dst + (size_t)(y - out.begin) * row_floats;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < CHANNELS; c++) {
+                int i = x * CHANNELS + c;
+                dst_row[i] = t[x] > 0 ? src_row[i] + (blur_row[i] - src_row[i]) * t[x] : src_row[i];
+            }
+        }
+    }
+}
+
+// dst += weight * src shifted left by dx pixels, the pixels shifted in from outside follow the edge mode
+static void add_shifted(float *dst, const float *src, int width, int dx, float weight, EdgeMode edge) {
+    int lo = min(max(-dx, 0), width), hi = max(min(width - dx, width), lo);
+    if (hi > lo) {
+        row_kernels().add_scaled(dst + lo * CHANNELS, src + (lo + dx) * CHANNELS, weight, (hi - lo) * CHANNELS);
+    }
+    if (edge == EDGE_ZERO) {
+        return;
+    }
+    const float *first = src, *last = src + (width - 1) * CHANNELS;
+    for (int x = 0; x < lo; x++) {
+        for (int c = 0; c < CHANNELS; c++) {
+            dst[x * CHANNELS + c] += first[c] * weight;
+        }
+    }
+    for (int x = hi; x < width; x++) {
+        for (int c = 0; c < CHANNELS; c++) {
+            dst[x * CHANNELS + c] += last[c] * weight;
+        }
+    }
+}
+
+// src holds rows [in.begin, in.end) of a frame that is `height` rows tall
+static void sheared_pass(const float *src, RowRange in, float *dst, RowRange out, int width, int height,
+                         const vector<ShearTap> &taps, EdgeMode edge) {
+    int row_floats = width * CHANNELS;
+
+    for (int y = out.begin; y < out.end; y++) {
+        float *dst_row = dst + (size_t)(y - out.begin) * row_floats;
+        fill(dst_row, dst_row + row_floats, 0.0f);
+
+        for (const ShearTap &tap : taps) {
+            int sy = y + tap.dy;
+            if (sy < 0 || sy >= height) {
+                if (edge == EDGE_ZERO) {
+                    continue;
+                }
+                sy = min(max(sy, 0), height - 1);
+            }
+            add_shifted(dst_row, src + (size_t)(sy - in.begin) * row_floats, width, tap.dx, tap.weight, edge);
+        }
+    }
+}
+
+static void rotated_rows(const Stage &stage, const float *src, RowRange in, float *dst, RowRange out,
+                         vector<float> &scratch, EdgeMode edge) {
+    int width = stage.in_width, height = stage.in_height;
+    int row_floats = width * CHANNELS;
+
+    if (!stage.axis_vertical) {
+        scratch.resize((size_t)(in.end - in.begin) * row_floats);
+        for (int y = in.begin; y < in.end; y++) {
+            size_t offset = (size_t)(y - in.begin) * row_floats;
+            horizontal_pass(src + offset, scratch.data() + offset, width, stage.kernel, edge);
+        }
+        sheared_pass(scratch.data(), in, dst, out, width, height, stage.taps, edge);
+        return;
+    }
+
+    // the line first, over the rows the column pass will read
+    int axis_radius = stage.kernel.size() / 2;
+    RowRange mid = {max(out.begin - axis_radius, 0), min(out.end + axis_radius, height)};
+    scratch.resize((size_t)(mid.end - mid.begin) * row_floats);
+    sheared_pass(src, in, scratch.data(), mid, width, height, stage.taps, edge);
+    vertical_pass(scratch.data(), mid, dst, out, width, height, stage.kernel, edge);
+}
+
+static void apply_stage(const Stage &stage, const float *src, RowRange in, float *dst, RowRange out,
+                        vector<float> &scratch, vector<float> &blurred, vector<float> &transparency, EdgeMode edge) {
+    int in_row_floats = stage.in_width * CHANNELS;
+    int out_row_floats = stage.out_width * CHANNELS;
+
+    switch (stage.type) {
+        case STAGE_BLUR:
+            blur_rows(stage, src, in, dst, out, scratch, edge);
+            break;
+
+        case STAGE_ROTATED:
+            rotated_rows(stage, src, in, dst, out, scratch, edge);
+            break;
+
+        case STAGE_MASKED:
+            masked_rows(stage, src, in, dst, out, scratch, blurred, edge);
+            break;
+
+        case STAGE_BACKGROUND:
+            background_rows(stage, src, in, dst, out, scratch, blurred, transparency, edge);
+            break;
+
+        case STAGE_UNSHARP: {
+            blurred.resize((size_t)(out.end - out.begin) * in_row_floats);
+            blur_rows(stage, src, in, blurred.data(), out, scratch, edge);
+
+            for (int y = out.begin; y < out.end; y++) {
+                const float *src_row = src + (size_t)(y - in.begin) * in_row_floats;
+                const float *blur_row = blurred.data() + (size_t)(y - out.begin) * in_row_floats;
+                float *dst_row = dst + (size_t)(y - out.begin) * out_row_floats;
+                for (int i = 0; i < in_row_floats; i++) {
+                    dst_row[i] = src_row[i] + stage.amount * (src_row[i] - blur_row[i]);
+                }
+            }
+            break;
+        }
+
+        case STAGE_DOWNSCALE: {
+            // an image smaller than the factor still gives one pixel, the average of what there is
+            int f = stage.factor;
+            int columns = min(f, stage.in_width), rows = min(f, stage.in_height);
+            float scale = 1.0f / (columns * rows);
+
+            for (int y = out.begin; y < out.end; y++) {
+                float *dst_row = dst + (size_t)(y - out.begin) * out_row_floats;
+                fill(dst_row, dst_row + out_row_floats, 0.0f);
+
+                for (int dy = 0; dy < rows; dy++) {
+                    const float *src_row = src + (size_t)(y * f + dy - in.begin) * in_row_floats;
+                    for (int x = 0; x < stage.out_width; x++) {
+                        for (int dx = 0; dx < columns; dx++) {
+                            for (int c = 0; c < CHANNELS; c++) {
+                                dst_row[x * CHANNELS + c] += src_row[(x * f + dx) * CHANNELS + c];
+                            }
+                        }
+                    }
+                }
+                for (int i = 0; i < out_row_floats; i++) {
+                    dst_row[i] *= scale;
+                }
+            }
+            break;
+        }
+
+        case STAGE_ADJUST: {
+            for (int y = out.begin; y < out.end; y++) {
+                const float *src_row = src + (size_t)(y - in.begin) * in_row_floats;
+                float *dst_row = dst + (size_t)(y - out.begin) * out_row_floats;
+
+                for (int x = 0; x < stage.out_width; x++) {
+                    const float *p = src_row + x * CHANNELS;
+                    float *q = dst_row + x * CHANNELS;
+
+                    // channels are in BMP order, so 0 is blue and 2 is red
+                    float adjusted[CHANNELS];
+                    for (int c = 0; c < CHANNELS; c++) {
+                        adjusted[c] = (p[c] - 128.0f) * stage.contrast + 128.0f + stage.brightness;
+                    }
+                    float luma = 0.114f * adjusted[0] + 0.587f * adjusted[1] + 0.299f * adjusted[2];
+                    for (int c = 0; c < CHANNELS; c++) {
+                        q[c] = luma + (adjusted[c] - luma) * stage.saturation;
+                    }
+                }
+            }
+            break;
+        }
+
+        case STAGE_THRESHOLD: {
+            for (int y = out.begin; y < out.end; y++) {
+                const float *src_row = src + (size_t)(y - in.begin) * in_row_floats;
+                float *dst_row = dst + (size_t)(y - out.begin) * out_row_floats;
+
+                for (int x = 0; x < stage.out_width; x++) {
+                    const float *p = src_row + x * CHANNELS;
+                    float luma = 0.114f * p[0] + 0.587f * p[1] + 0.299f * p[2];
+                    float scale = luma > stage.threshold ? (luma - stage.threshold) / luma : 0.0f;
+                    for (int c = 0; c < CHANNELS; c++) {
+                        dst_row[x * CHANNELS + c] = p[c] * scale;
+                    }
+                }
+            }
+            break;
+        }
+
+        case STAGE_RESIZE: {
+            // shrink every row first, so the vertical pass only touches out_width columns
+            scratch.resize((size_t)(in.end - in.begin) * out_row_floats);
+            for (int y = in.begin; y < in.end; y++) {
+                resize_row(src + (size_t)(y - in.begin) * in_row_floats,
+                           scratch.data() + (size_t)(y - in.begin) * out_row_floats, stage.x_weights, CHANNELS);
+            }
+
+            const ResizeWeights &w = stage.y_weights;
+            const RowKernels &kernels = row_kernels();
+            for (int y = out.begin; y < out.end; y++) {
+                float *dst_row = dst + (size_t)(y - out.begin) * out_row_floats;
+                fill(dst_row, dst_row + out_row_floats, 0.0f);
+
+                for (int t = 0; t < w.count[y]; t++) {
+                    const float *src_row = scratch.data() + (size_t)(w.start[y] + t - in.begin) * out_row_floats;
+                    kernels.add_scaled(dst_row, src_row, w.weights[(size_t)y * w.max_taps + t], out_row_floats);
+                }
+            }
+            break;
+        }
+    }
+}
+
+static void *run_bands(void *params) {
+    PipelineParams *p = (PipelineParams *)params;
+    const vector<Stage> &stages = *p->stages;
+    int num_stages = stages.size();
+    int in_width = stages.front().in_width;
+    int out_width = stages.back().out_width;
+    RowRange output_rows = p->output_rows;
+    int num_bands = (output_rows.end - output_rows.begin + p->band_height - 1) / p->band_height;
+
+    // per-thread buffers, they grow to the largest band once and are reused after that
+    vector<float> current, next, scratch, blurred, transparency;
+    vector<RowRange> rows(num_stages + 1);
+
+    for (int band = p->first_band; band < num_bands; band += p->band_step) {
+        if (p->control && p->control->cancelled()) {
+            break;
+        }
+
+        int band_begin = output_rows.begin + band * p->band_height;
+        rows[num_stages] = {band_begin, min(band_begin + p->band_height, output_rows.end)};
+        for (int s = num_stages - 1; s >= 0; s--) {
+            rows[s] = input_rows(stages[s], rows[s + 1]);
+        }
+
+        // the input rows are contiguous, so the whole band converts in one call
+        current.resize((size_t)(rows[0].end - rows[0].begin) * in_width * CHANNELS);
+        row_kernels().bytes_to_floats((const uint8_t *)(p->input + (size_t)rows[0].begin * in_width), current.data(),
+                                      (rows[0].end - rows[0].begin) * in_width * CHANNELS);
+
+        for (int s = 0; s < num_stages; s++) {
+            const Stage &stage = stages[s];
+            next.resize((size_t)(rows[s + 1].end - rows[s + 1].begin) * stage.out_width * CHANNELS);
+            apply_stage(stage, current.data(), rows[s], next.data(), rows[s + 1], scratch, blurred, transparency,
+                        p->edge);
+            current.swap(next);
+        }
+
+        RowRange out = rows[num_stages];
+        row_kernels().floats_to_bytes(current.data(), (uint8_t *)(p->output + (size_t)out.begin * out_width),
+                                      (out.end - out.begin) * out_width * CHANNELS);
+
+        if (p->control) {
+            p->control->add_done((long long)(out.end - out.begin) * out_width);
+        }
+    }
+
+    return NULL;
+}
+
+bool Pipeline::run(const Pixel *input, Pixel *output) const { return run_rows(input, output, 0, output_height()); }
+
+bool Pipeline::run_rows(const Pixel *input, Pixel *output, int begin, int end) const {
+    if (stages_.empty()) {
+        copy(input + (size_t)begin * width_, input + (size_t)end * width_, output + (size_t)begin * width_);
+        if (control_) {
+            control_->add_done((long long)(end - begin) * width_);
+        }
+        return true;
+    }
+
+    // bands are dealt round-robin so every thread gets a share of the expensive border bands too
+    vector<PipelineParams> params(num_threads_);
+    for (int i = 0; i < num_threads_; i++) {
+        params[i] = {&stages_, input, output, edge_, {begin, end}, band_height_, i, num_threads_, control_};
+    }
+
+    run_threads(params, run_bands);
+    return control_ == NULL || !control_->cancelled();
+}
@@ -0,0 +1,117 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+
+#include "blur.h"
+#include "resize.h"
+
+enum StageType {
+    STAGE_BLUR,        // separable gaussian
+    STAGE_UNSHARP,     // in + amount * (in - blur(in))
+    STAGE_DOWNSCALE,   // box average over factor x factor blocks
+    STAGE_ADJUST,      // pointwise brightness / contrast / saturation
+    STAGE_RESIZE,      // separable resample with an optional gaussian prefilter folded into the taps
+    STAGE_ROTATED,     // anisotropic, rotated gaussian as a 1D axis pass and a pass along a sheared line
+    STAGE_MASKED,      // normalised convolution, blur(in * mask) / blur(mask) with the mask as a fourth channel
+    STAGE_BACKGROUND,  // blur where a feathered subject mask is below full, composited over the sharp input
+    STAGE_THRESHOLD,   // pointwise, keeps the part of each pixel whose luma is above a level
+};
+
+// one tap of the sheared pass, the source pixel is (x + dx, y + dy)
+struct ShearTap {
+    int dx, dy;
+    float weight;
+};
+
+struct Stage {
+    StageType type;
+    int radius;
+    std::vector<float> kernel;  // 1D gaussian for blur and unsharp
+    float amount;
+    int factor;
+    float brightness, contrast, saturation;
+    float threshold;
+    ResizeWeights x_weights, y_weights;
+    bool axis_vertical;           // rotated: the 1D kernel runs down the columns rather than along the rows
+    std::vector<ShearTap> taps;   // rotated: the line pass, radius is the rows it reaches with the axis pass
+    const uint8_t *mask;          // masked and background: in_width * in_height weights, not owned
+    std::vector<float> feather;   // background: 1D gaussian softening the subject mask, empty for none
+
+    // size of the frame this stage reads and writes
+    int in_width, in_height;
+    int out_width, out_height;
+};
+
+// bytes that would cross the memory bus running the chain as separate full-frame passes vs. the fused sweep
+struct PipelineTraffic {
+    long long unfused_bytes;
+    long long fused_bytes;
+    long long saved_bytes;
+};
+
+// Chains blur/unsharp/downscale/adjust stages and runs them as a single sweep over horizontal bands.
+// Each band pulls the rows it needs (plus the blur apron) through every stage in small per-thread
+// buffers, so the intermediates stay in cache and only the input and final output touch DRAM.
+//
+//     Pipeline p(width, height);
+//     p.blur(5).unsharp(2, 0.8f).downscale(2).adjust(10, 1.1f, 1.0f);
+//     p.run(image, output);
+class Pipeline {
+   public:
+    Pipeline(int width, int height);
+
+    Pipeline &blur(int radius);
+    Pipeline &blur(int radius, double sigma);
+    Pipeline &unsharp(int radius, float amount);
+    Pipeline &downscale(int factor);
+    Pipeline &adjust(float brightness, float contrast, float saturation);
+
+    // scales each pixel by (luma - level) / luma, and to black at or below level, so what is left keeps its hue
+    Pipeline &threshold(float level);
+    Pipeline &resize(int width, int height, ResizeFilter filter, double prefilter_sigma);
+
+    // gaussian with sigma_x along the direction theta degrees counter-clockwise from the x axis and sigma_y
+    // across it, at O(sigma) per pixel however it is turned (BMP rows go bottom up, so y points up)
+    Pipeline &rotated_blur(double sigma_x, double sigma_y, double theta);
+
+    // gaussian that only averages the valid pixels, mask holds a weight per pixel of the stage's input from 0
+    // (left out) to 255. Pixels no valid one reaches keep their value. The mask must outlive the pipeline.
+    Pipeline &masked_blur(int radius, const uint8_t *mask);
+
+    // portrait style: subject holds 255 where the input stays sharp and 0 where it is fully blurred, softened
+    // by a gaussian of feather_radius first. Tiles that come out fully subject are copied, not blurred.
+    Pipeline &background_blur(int radius, const uint8_t *subject, int feather_radius);
+
+    Pipeline &edge(EdgeMode mode);
+    Pipeline &threads(int num_threads);
+    Pipeline &band_height(int rows);
+
+    // progress is reported to control after every band and a cancel stops the run at the next band
+    Pipeline &control(JobControl *control);
+
+    int output_width() const;
+    int output_height() const;
+    const std::vector<Stage> &stages() const;
+
+    // output must hold output_width() * output_height() pixels, returns false if the job was cancelled
+    bool run(const Pixel *input, Pixel *output) const;
+
+    // only produces output rows [begin, end), so a caller can hand out finished rows while the rest are
+    // still to come. The rows are identical to the ones run() would produce.
+    bool run_rows(const Pixel *input, Pixel *output, int begin, int end) const;
+
+    PipelineTraffic traffic() const;
+
+   private:
+    Stage &add_stage(StageType type);
+
+    int width_, height_;
+    EdgeMode edge_;
+    int num_threads_;
+    int band_height_;
+    JobControl *control_;
+    std::vector<Stage> stages_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#include "memstats.h"
+#include "metrics.h"
+
+using namespace std;
+
+BufferPool::BufferPool(size_t max_bytes) : idle_bytes_(0), max_bytes_(max_bytes) {
+    pthread_mutex_init(&lock_, NULL);
+}
+
+BufferPool::~BufferPool() {
+    for (Entry &entry : idle_) {
+        free(entry.buffer);
+    }
+    pthread_mutex_destroy(&lock_);
+}
+
+Pixel *BufferPool::acquire(size_t pixels) {
+    pthread_mutex_lock(&lock_);
+
+    // smallest idle buffer that fits, but don't hand out something far too big for the job
+    int best = -1;
+    for (size_t i = 0; i < idle_.size(); i++) {
+        if (idle_[i].capacity >= pixels && idle_[i].capacity <= pixels * 2 &&
+            (best < 0 || idle_[i].capacity < idle_[best].capacity)) {
+            best = i;
+        }
+    }
+
+    Entry entry;
+    if (best >= 0) {
+        entry = idle_[best];
+        idle_.erase(idle_.begin() + best);
+        idle_bytes_ -= entry.capacity * sizeof(Pixel);
+        metrics().pool_hits.add(1);
+        metrics().pool_bytes.add(-(int64_t)(entry.capacity * sizeof(Pixel)));
+    } else {
+        entry.capacity = pixels;
+        entry.buffer = (Pixel *)malloc(sizeof(Pixel) * pixels);
+        mem_stats_record_alloc(sizeof(Pixel) * pixels);
+        metrics().pool_misses.add(1);
+    }
+
+    if (entry.buffer) {
+        in_use_.push_back(entry);
+    }
+    pthread_mutex_unlock(&lock_);
+    return entry.buffer;
+}
+
+void BufferPool::release(Pixel *buffer, size_t pixels) {
+    if (buffer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock_);
+
+    Entry entry = {buffer, pixels};
+    for (size_t i = 0; i < in_use_.size(); i++) {
+        if (in_use_[i].buffer == buffer) {
+            entry = in_use_[i];
+            in_use_.erase(in_use_.begin() + i);
+            break;
+        }
+    }
+
+    size_t bytes = entry.capacity * sizeof(Pixel);
+    if (idle_bytes_ + bytes <= max_bytes_) {
+        idle_.push_back(entry);
+        idle_bytes_ += bytes;
+        metrics().pool_bytes.add(bytes);
+    } else {
+        free(entry.buffer);
+    }
+
+    pthread_mutex_unlock(&lock_);
+}
@@ -0,0 +1,35 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "bmp.h"
+
+// Keeps released frame buffers around so back to back jobs of similar size don't go back to the
+// kernel for fresh pages every time. Buffers are handed out best fit, anything beyond max_bytes
+// of idle buffers is freed.
+class BufferPool {
+   public:
+    explicit BufferPool(size_t max_bytes);
+    ~BufferPool();
+
+    Pixel *acquire(size_t pixels);
+    void release(Pixel *buffer, size_t pixels);
+
+   private:
+    struct Entry {
+        Pixel *buffer;
+        size_t capacity;  // in pixels
+    };
+
+    pthread_mutex_t lock_;
+    std::vector<Entry> idle_;
+    std::vector<Entry> in_use_;
+    size_t idle_bytes_;
+    size_t max_bytes_;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "resize.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "blur.h"
+
+using namespace std;
+
+// https://en.wikipedia.org/wiki/Bicubic_interpolation#Bicubic_convolution_algorithm
+static double cubic(double t) {
+    const double a = -0.5;
+    t = fabs(t);
+    if (t < 1) {
+        return ((a + 2) * t - (a + 3)) * t * t + 1;
+    }
+    if (t < 2) {
+        return ((a * t - 5 * a) * t + 8 * a) * t - 4 * a;
+    }
+    return 0;
+}
+
+static double sinc(double t) {
+    if (t == 0) {
+        return 1;
+    }
+    return sin(M_PI * t) / (M_PI * t);
+}
+
+// https://en.wikipedia.org/wiki/Lanczos_resampling
+static double lanczos(double t) {
+    if (fabs(t) >= 3) {
+        return 0;
+    }
+    return sinc(t) * sinc(t / 3);
+}
+
+// raw (unnormalised, unclamped) resampling taps for output coordinate i, indexed from `first`
+static void resample_taps(int i, double scale, ResizeFilter filter, int &first, vector<double> &taps) {
+    taps.clear();
+
+    if (filter == FILTER_AREA) {
+        // output pixel i covers [i * scale, (i + 1) * scale) of the input
+        double lo = i * scale, hi = (i + 1) * scale;
+        first = (int)floor(lo);
+        for (int j = first; j < hi; j++) {
+            taps.push_back(min(hi, j + 1.0) - max(lo, (double)j));
+        }
+        return;
+    }
+
+    double support = filter == FILTER_BICUBIC ? 2 : 3;
+
+    // when shrinking, stretch the kernel over the input so it still band limits the result
+    double stretch = max(scale, 1.0);
+    double center = (i + 0.5) * scale - 0.5;
+
+    first = (int)floor(center - support * stretch) + 1;
+    int last = (int)ceil(center + support * stretch) - 1;
+    for (int j = first; j <= last; j++) {
+        double t = (j - center) / stretch;
+        taps.push_back(filter == FILTER_BICUBIC ? cubic(t) : lanczos(t));
+    }
+}
+
+ResizeWeights compute_resize_weights(int in_size, int out_size, ResizeFilter filter, double prefilter_sigma) {
+    double scale = (double)in_size / out_size;
+
+    int radius = prefilter_sigma > 0 ? (int)ceil(3 * prefilter_sigma) : 0;
+    vector<float> gauss = gen_gaussian_kernel_1d(radius, prefilter_sigma);
+
+    // first pass, convolve each output's resampling taps with the gaussian and fold them onto the image
+    vector<vector<double>> folded(out_size);
+    vector<int> start(out_size);
+    vector<double> taps;
+    int max_taps = 1;
+
+    for (int i = 0; i < out_size; i++) {
+        int first;
+        resample_taps(i, scale, filter, first, taps);
+
+        int lo = max(first - radius, 0);
+        int hi = min(first + (int)taps.size() - 1 + radius, in_size - 1);
+        vector<double> combined(hi - lo + 1, 0.0);
+
+        for (int t = 0; t < (int)taps.size(); t++) {
+            for (int g = -radius; g <= radius; g++) {
+                // clamp to edge, the weight of a tap that falls off the image lands on the border pixel
+                int j = min(max(first + t + g, lo), hi);
+                combined[j - lo] += taps[t] * gauss[g + radius];
+            }
+        }
+
+        double sum = 0;
+        for (double w : combined) {
+            sum += w;
+        }
+        for (double &w : combined) {
+            w /= sum;
+        }
+
+        start[i] = lo;
+        folded[i].swap(combined);
+        max_taps = max(max_taps, (int)folded[i].size());
+    }
+
+    ResizeWeights weights;
+    weights.in_size = in_size;
+    weights.out_size = out_size;
+    weights.max_taps = max_taps;
+    weights.start = start;
+    weights.count.resize(out_size);
+    weights.weights.assign((size_t)out_size * max_taps, 0.0f);
+
+    for (int i = 0; i < out_size; i++) {
+        weights.count[i] = folded[i].size();
+        for (int t = 0; t < (int)folded[i].size(); t++) {
+            weights.weights[(size_t)i * max_taps + t] = folded[i][t];
+        }
+    }
+
+    return weights;
+}
+
+HOT_KERNEL void resize_row(const float *src, float *dst, const ResizeWeights &weights, int channels) {
+    for (int x = 0; x < weights.out_size; x++) {
+        const float *w = weights.weights.data() + (size_t)x * weights.max_taps;
+        const float *s = src + (size_t)weights.start[x] * channels;
+        float *d = dst + (size_t)x * channels;
+
+        for (int c = 0; c < channels; c++) {
+            d[c] = 0;
+        }
+        for (int t = 0; t < weights.count[x]; t++) {
+            for (int c = 0; c < channels; c++) {
+                d[c] += s[t * channels + c] * w[t];
+            }
+        }
+    }
+}
+
+bool parse_resize_filter(const char *name, ResizeFilter &filter) {
+    if (strcmp(name, "area") == 0) {
+        filter = FILTER_AREA;
+    } else if (strcmp(name, "bicubic") == 0) {
+        filter = FILTER_BICUBIC;
+    } else if (strcmp(name, "lanczos") == 0) {
+        filter = FILTER_LANCZOS;
+    } else {
+        return false;
+    }
+    return true;
+}
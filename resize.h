@@ -0,0 +1,32 @@
+#ifndef RESIZE_H
+#define RESIZE_H
+
+#include <vector>
+
+enum ResizeFilter {
+    FILTER_AREA,     // exact pixel coverage, best for large integer-ish downscales
+    FILTER_BICUBIC,  // Keys cubic with a = -0.5
+    FILTER_LANCZOS,  // Lanczos with 3 lobes
+};
+
+// Precomputed taps for one axis. Output coordinate i reads `count[i]` input samples starting at `start[i]`
+// with weights[i * max_taps ...]. Out of range taps are already folded onto the edge pixel.
+struct ResizeWeights {
+    int in_size, out_size;
+    int max_taps;
+    std::vector<int> start;
+    std::vector<int> count;
+    std::vector<float> weights;
+};
+
+// prefilter_sigma is a gaussian (in input pixels) convolved into the taps, so blur-then-resize costs the
+// same as a plain resize and never needs the full size blurred frame. 0 disables it.
+ResizeWeights compute_resize_weights(int in_size, int out_size, ResizeFilter filter, double prefilter_sigma);
+
+// filters one row of interleaved float pixels along x
+void resize_row(const float *src, float *dst, const ResizeWeights &weights, int channels);
+
+// returns false if the name isn't area, bicubic or lanczos
+bool parse_resize_filter(const char *name, ResizeFilter &filter);
+
+#endif
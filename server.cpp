@@ -0,0 +1,445 @@
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "codec.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pool.h"
+
+using namespace std;
+
+static const size_t MAX_HEADER_BYTES = 16 * 1024;
+static const int SLAB_ROWS = 128;  // output rows blurred, encoded and sent per chunk
+static const size_t MAX_QUEUED_CONNECTIONS = 64;  // accepted but not yet picked up by a worker, 503 past it
+static const long long MAX_DRAIN_BYTES = 64 << 20;  // body read and dropped after an early error reply
+static const int DRAIN_TIMEOUT_MS = 1000;           // per read while draining
+
+struct Request {
+    string method;
+    string path;
+    string query;
+    long long content_length;  // -1 when missing
+    bool expect_continue;
+    bool chunked;
+};
+
+struct Server {
+    ServerOptions options;
+    BufferPool pool;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    deque<int> connections;
+
+    explicit Server(const ServerOptions &o) : options(o), pool(256 << 20) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&ready, NULL);
+    }
+};
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool send_chunk(int fd, const string &data) {
+    if (data.empty()) {
+        return true;
+    }
+    char size_line[32];
+    int length = snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+    return send_all(fd, size_line, length) && send_all(fd, data.data(), data.size()) && send_all(fd, "\r\n", 2);
+}
+
+static void send_response(int fd, int status, const char *reason, const char *content_type, const string &body) {
+    ostringstream head;
+    head << "HTTP/1.1 " << status << ' ' << reason << "\r\n";
+    head << "Content-Type: " << content_type << "\r\n";
+    head << "Content-Length: " << body.size() << "\r\n";
+    head << "Connection: close\r\n\r\n";
+    string text = head.str() + body;
+    send_all(fd, text.data(), text.size());
+}
+
+static void send_error(int fd, int status, const char *reason, const string &message) {
+    metrics().failed_jobs.add(1);
+    send_response(fd, status, reason, "text/plain", message + "\n");
+}
+
+// After an error reply sent before the body is read: closing with unread data resets the connection, and a
+// client still uploading then usually never sees the reply. So the write side is shut, which ends the reply,
+// and what is left of the body is read and dropped, up to MAX_DRAIN_BYTES and while it keeps arriving.
+static void drain_body(int fd, long long remaining) {
+    shutdown(fd, SHUT_WR);
+    char chunk[64 * 1024];
+    long long budget = min(remaining, MAX_DRAIN_BYTES);
+    pollfd readable = {fd, POLLIN, 0};
+    while (budget > 0 && poll(&readable, 1, DRAIN_TIMEOUT_MS) > 0) {
+        ssize_t n = recv(fd, chunk, min((long long)sizeof(chunk), budget), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        budget -= n;
+    }
+}
+
+// reads up to the blank line ending the headers, anything after it is the start of the body
+static bool read_request(int fd, Request &request, string &body_start) {
+    string buffer;
+    size_t end;
+    char chunk[4096];
+
+    while ((end = buffer.find("\r\n\r\n")) == string::npos) {
+        if (buffer.size() > MAX_HEADER_BYTES) {
+            return false;
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+
+    body_start = buffer.substr(end + 4);
+    buffer.resize(end);
+
+    istringstream lines(buffer);
+    string line, target, version;
+    getline(lines, line);
+    istringstream request_line(line);
+    if (!(request_line >> request.method >> target >> version)) {
+        return false;
+    }
+
+    size_t question = target.find('?');
+    request.path = target.substr(0, question);
+    request.query = question == string::npos ? "" : target.substr(question + 1);
+    request.content_length = -1;
+    request.expect_continue = false;
+    request.chunked = false;
+
+    while (getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t colon = line.find(':');
+        if (colon == string::npos) {
+            continue;
+        }
+        string name = line.substr(0, colon);
+        string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+            request.content_length = atoll(value.c_str());
+        } else if (strcasecmp(name.c_str(), "Expect") == 0) {
+            request.expect_continue = strcasecmp(value.c_str(), "100-continue") == 0;
+        } else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+            request.chunked = strcasecmp(value.c_str(), "identity") != 0;
+        }
+    }
+    return true;
+}
+
+// value of key in a query string like "radius=5&sigma=2", or fallback if it isn't there
+static string query_param(const string &query, const string &key, const string &fallback) {
+    istringstream pairs(query);
+    string pair;
+    while (getline(pairs, pair, '&')) {
+        size_t equals = pair.find('=');
+        if (pair.substr(0, equals) == key) {
+            return equals == string::npos ? "" : pair.substr(equals + 1);
+        }
+    }
+    return fallback;
+}
+
+struct DisconnectWatch {
+    int fd;
+    JobControl *control;
+    atomic<bool> finished;
+};
+
+// Polls the client socket while its job runs and cancels the job once the peer hangs up, so the workers
+// stop at the next band instead of blurring rows nobody will read. A client shutting down its write side
+// counts as gone too, the response is only sent after the whole body has been read.
+static void *watch_disconnect(void *arg) {
+    DisconnectWatch &watch = *(DisconnectWatch *)arg;
+    pollfd entry = {watch.fd, POLLRDHUP, 0};
+
+    while (!watch.finished.load(memory_order_relaxed)) {
+        entry.revents = 0;
+        if (poll(&entry, 1, 50) > 0 && (entry.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            watch.control->cancel();
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void handle_blur(Server &server, int fd, Request &request, string &body_start) {
+    if (request.method != "POST") {
+        send_error(fd, 405, "Method Not Allowed", "use POST with an image body");
+        return;
+    }
+    if (request.chunked || request.content_length < 0) {
+        send_error(fd, 411, "Length Required", "the request needs a Content-Length");
+        return;
+    }
+
+    int radius = atoi(query_param(request.query, "radius", "5").c_str());
+    double sigma = atof(query_param(request.query, "sigma", "0").c_str());
+    string edge = query_param(request.query, "edge", server.options.edge == EDGE_CLAMP ? "clamp" : "zero");
+    if (radius < 0 || radius > 1000 || sigma < 0 || (edge != "zero" && edge != "clamp")) {
+        send_error(fd, 400, "Bad Request", "radius must be 0..1000, sigma >= 0 and edge zero or clamp");
+        return;
+    }
+    if (sigma == 0) {
+        sigma = default_sigma(radius);
+    }
+
+    if (request.expect_continue) {
+        const char *go_ahead = "HTTP/1.1 100 Continue\r\n\r\n";
+        send_all(fd, go_ahead, strlen(go_ahead));
+    }
+
+    double start = now_seconds();
+    size_t input_pixels = 0;
+    StreamDecoder decoder([&](int width, int height) {
+        input_pixels = (size_t)width * height;
+        return server.pool.acquire(input_pixels);
+    });
+
+    // decode straight out of the socket, the encoded body is never held in full
+    long long remaining = request.content_length;
+    bool ok = true;
+    size_t first = min((long long)body_start.size(), remaining);
+    ok = decoder.feed((const uint8_t *)body_start.data(), first);
+    remaining -= first;
+
+    char chunk[64 * 1024];
+    while (ok && remaining > 0) {
+        ssize_t n = recv(fd, chunk, min((long long)sizeof(chunk), remaining), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        remaining -= n;
+        ok = decoder.feed((const uint8_t *)chunk, n);
+    }
+    metrics().bytes_in.add(request.content_length - remaining);
+
+    if (!ok || !decoder.done()) {
+        // a header that parsed but got no buffer is the server's fault, like the output buffer below
+        bool no_memory = decoder.width() > 0 && decoder.pixels() == NULL;
+        server.pool.release(decoder.pixels(), input_pixels);
+        if (no_memory) {
+            send_error(fd, 503, "Service Unavailable", "out of memory");
+        } else {
+            send_error(fd, 400, "Bad Request", ok ? "image body is truncated" : decoder.error());
+        }
+        drain_body(fd, remaining);
+        return;
+    }
+
+    int width = decoder.width(), height = decoder.height();
+    Pixel *output = server.pool.acquire((size_t)width * height);
+    if (output == NULL) {
+        server.pool.release(decoder.pixels(), input_pixels);
+        send_error(fd, 503, "Service Unavailable", "out of memory");
+        return;
+    }
+
+    JobControl control;
+    control.set_total((long long)width * height);
+
+    Pipeline pipeline(width, height);
+    pipeline.edge(edge == "clamp" ? EDGE_CLAMP : EDGE_ZERO)
+        .threads(server.options.threads)
+        .band_height(server.options.band_height)
+        .control(&control)
+        .blur(radius, sigma);
+
+    DisconnectWatch watch;
+    watch.fd = fd;
+    watch.control = &control;
+    watch.finished = false;
+    pthread_t watcher;
+    bool watching = pthread_create(&watcher, NULL, watch_disconnect, &watch) == 0;
+
+    string head = "HTTP/1.1 200 OK\r\nContent-Type: ";
+    head += format_mime_type(decoder.format());
+    head += "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+    bool connected = send_all(fd, head.data(), head.size());
+
+    StreamEncoder encoder(decoder.format(), width, height);
+    string encoded;
+    encoder.header(encoded);
+    long long bytes_out = 0;
+
+    // blur a slab, send it, repeat, so the first bytes go out long before the last rows are done
+    for (int row = 0; connected && row < height; row += SLAB_ROWS) {
+        int end = min(row + SLAB_ROWS, height);
+        if (!pipeline.run_rows(decoder.pixels(), output, row, end)) {
+            connected = false;
+            break;
+        }
+        encoder.rows(output, row, end, encoded);
+        connected = send_chunk(fd, encoded);
+        bytes_out += encoded.size();
+        encoded.clear();
+    }
+
+    if (connected) {
+        encoder.finish(encoded);
+        bytes_out += encoded.size();
+        connected = send_chunk(fd, encoded) && send_all(fd, "0\r\n\r\n", 5);
+    }
+
+    watch.finished = true;
+    if (watching) {
+        pthread_join(watcher, NULL);
+    }
+
+    server.pool.release(decoder.pixels(), input_pixels);
+    server.pool.release(output, (size_t)width * height);
+
+    metrics().bytes_out.add(bytes_out);
+    if (connected) {
+        metrics_record_job("separable", (uint64_t)width * height, now_seconds() - start);
+    } else if (control.cancelled()) {
+        metrics().cancelled_jobs.add(1);
+    } else {
+        metrics().failed_jobs.add(1);
+    }
+}
+
+static void handle_connection(Server &server, int fd) {
+    Request request;
+    string body_start;
+    if (!read_request(fd, request, body_start)) {
+        send_error(fd, 400, "Bad Request", "malformed request");
+        return;
+    }
+
+    if (request.path == "/metrics" && request.method == "GET") {
+        ostringstream text;
+        render_metrics(text);
+        send_response(fd, 200, "OK", "text/plain; version=0.0.4", text.str());
+    } else if (request.path == "/blur") {
+        metrics().active_jobs.add(1);
+        handle_blur(server, fd, request, body_start);
+        metrics().active_jobs.add(-1);
+    } else {
+        send_error(fd, 404, "Not Found", "try POST /blur or GET /metrics");
+    }
+}
+
+static void *worker_loop(void *arg) {
+    Server &server = *(Server *)arg;
+
+    while (true) {
+        pthread_mutex_lock(&server.lock);
+        while (server.connections.empty()) {
+            pthread_cond_wait(&server.ready, &server.lock);
+        }
+        int fd = server.connections.front();
+        server.connections.pop_front();
+        metrics().queue_depth.set(server.connections.size());
+        pthread_mutex_unlock(&server.lock);
+
+        handle_connection(server, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int run_server(const ServerOptions &options) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0) {
+        cerr << "Error: Unable to listen on 127.0.0.1:" << options.port << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    Server server(options);
+    vector<pthread_t> workers(max(options.workers, 1));
+    for (pthread_t &worker : workers) {
+        pthread_create(&worker, NULL, worker_loop, &server);
+    }
+
+    cout << "Listening on http://127.0.0.1:" << options.port << " (POST /blur, GET /metrics)" << endl;
+
+    while (true) {
+        int client = accept_client(listener);
+        if (client < 0) {
+            cerr << "Error: Unable to accept connections: " << strerror(errno) << '\n';
+            return 1;
+        }
+
+        // with every worker busy the queue would grow until the descriptors run out, turn the excess away
+        pthread_mutex_lock(&server.lock);
+        bool queued = server.connections.size() < MAX_QUEUED_CONNECTIONS;
+        if (queued) {
+            server.connections.push_back(client);
+            metrics().queue_depth.set(server.connections.size());
+            pthread_cond_signal(&server.ready);
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        if (!queued) {
+            send_error(client, 503, "Service Unavailable", "too many queued requests, try again later");
+            close(client);
+        }
+    }
+}
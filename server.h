@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "blur.h"
+
+struct ServerOptions {
+    int port;
+    int workers;      // connections handled at once
+    int threads;      // blur threads per connection
+    int band_height;  // rows per pipeline band
+    EdgeMode edge;
+};
+
+// Minimal HTTP/1.1 blur service on 127.0.0.1, one request per connection.
+//
+//   POST /blur?radius=5&sigma=1.5   body is a BMP, PPM or QOI image, the reply is the same format
+//   GET  /metrics                   Prometheus text format
+//
+// The request body is decoded into a pooled buffer as it arrives and the blurred image is sent back
+// with chunked transfer encoding, a slab of rows at a time as soon as each slab is blurred.
+// At most 64 connections wait for a worker, more get 503 straight away. Returns only if the socket
+// can't be set up or accepting fails for good.
+int run_server(const ServerOptions &options);
+
+#endif
@@ -0,0 +1,575 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Thin SIMD layer the row kernels are written against. Every instruction set gets a namespace with the
+// same names, so a kernel is written once and compiled per target (see kernels-inl.h):
+//
+//   Vf, F_LANES       float vector and its lane count
+//   Vi16, I16_LANES   int16 vector and its lane count
+//   zero_f, set1_f, load_f, store_f, load_partial_f(p, n), store_partial_f(p, v, n)
+//   add_f, sub_f, mul_f, mul_add_f (fused, so it rounds once on every target)
+//   zero_i16, set1_i16, load_i16, store_i16, load_partial_i16, store_partial_i16
+//   add_i16, sub_i16, shr_u16 (logical shift), shuffle_bytes (pshufb within each 16 byte block)
+//   load_u8_i16, load_partial_u8_i16   bytes widened to int16s, I16_LANES of them
+//   store_i16_u8, store_partial_i16_u8 int16s saturated to 0..255
+//   Vi32, I32_LANES   int32 vector, as many lanes as Vf
+//   set1_i32, load_i32, store_i32, load_partial_i32, store_partial_i32
+//   add_i32, sub_i32, mullo_i32 (low 32 bits of the product), shr_u32 (logical shift)
+//   load_u8_i32, load_partial_u8_i32   bytes widened to int32s, I32_LANES of them
+//   store_i32_u8, store_partial_i32_u8 int32s saturated to 0..255
+//   load_u8_f, load_partial_u8_f       bytes widened to floats, F_LANES of them
+//   store_f_u8, store_partial_f_u8     floats truncated toward zero and saturated to 0..255
+//
+// The vector targets also work on the integer register as raw bytes, BLOCKS 16 byte blocks of it:
+//
+//   load_u8, store_u8, load_partial_u8, store_partial_u8, or_u8
+//   set_blocks_u8(pattern)     the same 16 bytes in every block, for shuffle_bytes masks
+//   index_u32(index)           prepares the first 4 * BLOCKS entries of a dword permutation
+//   permute_u32(v, index)      dword i of the result is dword index[i] of v, across the whole register
+//   load_planes_u8(c0, c1, c2) 4 * BLOCKS bytes of each plane one after the other, the last quarter zero
+//
+// The partial loads and stores touch only the first n lanes, so they are safe on the last few elements of
+// a buffer. On AVX-512 they are masked loads and stores, elsewhere a lane mask or a small copy.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cmath>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+namespace simd_scalar {
+
+typedef float Vf;
+typedef int16_t Vi16;
+typedef int32_t Vi32;
+const int F_LANES = 1;
+const int I16_LANES = 1;
+const int I32_LANES = 1;
+
+static inline Vf zero_f() { return 0.0f; }
+static inline Vf set1_f(float x) { return x; }
+static inline Vf load_f(const float *p) { return *p; }
+static inline void store_f(float *p, Vf v) { *p = v; }
+static inline Vf load_partial_f(const float *p, int n) { return n > 0 ? *p : 0.0f; }
+static inline void store_partial_f(float *p, Vf v, int n) {
+    if (n > 0) {
+        *p = v;
+    }
+}
+static inline Vf add_f(Vf a, Vf b) { return a + b; }
+static inline Vf sub_f(Vf a, Vf b) { return a - b; }
+static inline Vf mul_f(Vf a, Vf b) { return a * b; }
+static inline Vf mul_add_f(Vf a, Vf b, Vf c) { return std::fma(a, b, c); }
+
+static inline Vi16 zero_i16() { return 0; }
+static inline Vi16 set1_i16(int16_t x) { return x; }
+static inline Vi16 load_i16(const int16_t *p) { return *p; }
+static inline void store_i16(int16_t *p, Vi16 v) { *p = v; }
+static inline Vi16 load_partial_i16(const int16_t *p, int n) { return n > 0 ? *p : 0; }
+static inline void store_partial_i16(int16_t *p, Vi16 v, int n) {
+    if (n > 0) {
+        *p = v;
+    }
+}
+static inline Vi16 add_i16(Vi16 a, Vi16 b) { return (int16_t)(a + b); }
+static inline Vi16 sub_i16(Vi16 a, Vi16 b) { return (int16_t)(a - b); }
+static inline Vi16 shr_u16(Vi16 a, int bits) { return (int16_t)((uint16_t)a >> bits); }
+static inline Vi16 load_u8_i16(const uint8_t *p) { return *p; }
+static inline Vi16 load_partial_u8_i16(const uint8_t *p, int n) { return n > 0 ? *p : 0; }
+static inline void store_i16_u8(uint8_t *p, Vi16 v) { *p = v < 0 ? 0 : v > 255 ? 255 : v; }
+static inline void store_partial_i16_u8(uint8_t *p, Vi16 v, int n) {
+    if (n > 0) {
+        store_i16_u8(p, v);
+    }
+}
+
+static inline Vi32 set1_i32(int32_t x) { return x; }
+static inline Vi32 load_i32(const int32_t *p) { return *p; }
+static inline void store_i32(int32_t *p, Vi32 v) { *p = v; }
+static inline Vi32 load_partial_i32(const int32_t *p, int n) { return n > 0 ? *p : 0; }
+static inline void store_partial_i32(int32_t *p, Vi32 v, int n) {
+    if (n > 0) {
+        *p = v;
+    }
+}
+static inline Vi32 add_i32(Vi32 a, Vi32 b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+static inline Vi32 sub_i32(Vi32 a, Vi32 b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+static inline Vi32 mullo_i32(Vi32 a, Vi32 b) { return (int32_t)((uint32_t)a * (uint32_t)b); }
+static inline Vi32 shr_u32(Vi32 a, int bits) { return (int32_t)((uint32_t)a >> bits); }
+static inline Vi32 load_u8_i32(const uint8_t *p) { return *p; }
+static inline Vi32 load_partial_u8_i32(const uint8_t *p, int n) { return n > 0 ? *p : 0; }
+static inline void store_i32_u8(uint8_t *p, Vi32 v) { *p = v < 0 ? 0 : v > 255 ? 255 : v; }
+static inline void store_partial_i32_u8(uint8_t *p, Vi32 v, int n) {
+    if (n > 0) {
+        store_i32_u8(p, v);
+    }
+}
+
+static inline Vf load_u8_f(const uint8_t *p) { return *p; }
+static inline Vf load_partial_u8_f(const uint8_t *p, int n) { return n > 0 ? *p : 0.0f; }
+static inline void store_f_u8(uint8_t *p, Vf v) {
+    int i = (int)v;
+    *p = i < 0 ? 0 : i > 255 ? 255 : i;
+}
+static inline void store_partial_f_u8(uint8_t *p, Vf v, int n) {
+    if (n > 0) {
+        store_f_u8(p, v);
+    }
+}
+
+// a one lane vector is a single 16 byte block of its own two bytes
+static inline Vi16 shuffle_bytes(Vi16 table, Vi16 index) {
+    uint8_t t[2], i[2], r[2];
+    memcpy(t, &table, 2);
+    memcpy(i, &index, 2);
+    for (int b = 0; b < 2; b++) {
+        r[b] = (i[b] & 0x80) ? 0 : t[i[b] & 1];
+    }
+    Vi16 result;
+    memcpy(&result, r, 2);
+    return result;
+}
+
+}  // namespace simd_scalar
+
+#ifdef SIMD_X86
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+namespace simd_sse {
+
+typedef __m128 Vf;
+typedef __m128i Vi16;
+typedef __m128i Vi32;
+const int F_LANES = 4;
+const int I16_LANES = 8;
+const int I32_LANES = 4;
+
+static inline Vf zero_f() { return _mm_setzero_ps(); }
+static inline Vf set1_f(float x) { return _mm_set1_ps(x); }
+static inline Vf load_f(const float *p) { return _mm_loadu_ps(p); }
+static inline void store_f(float *p, Vf v) { _mm_storeu_ps(p, v); }
+static inline Vf load_partial_f(const float *p, int n) {
+    float lanes[F_LANES] = {0};
+    memcpy(lanes, p, sizeof(float) * n);
+    return _mm_loadu_ps(lanes);
+}
+static inline void store_partial_f(float *p, Vf v, int n) {
+    float lanes[F_LANES];
+    _mm_storeu_ps(lanes, v);
+    memcpy(p, lanes, sizeof(float) * n);
+}
+static inline Vf add_f(Vf a, Vf b) { return _mm_add_ps(a, b); }
+static inline Vf sub_f(Vf a, Vf b) { return _mm_sub_ps(a, b); }
+static inline Vf mul_f(Vf a, Vf b) { return _mm_mul_ps(a, b); }
+
+// SSE has no FMA instruction, so go lane by lane through the correctly rounded library call
+static inline Vf mul_add_f(Vf a, Vf b, Vf c) {
+    float x[F_LANES], y[F_LANES], z[F_LANES];
+    _mm_storeu_ps(x, a);
+    _mm_storeu_ps(y, b);
+    _mm_storeu_ps(z, c);
+    for (int i = 0; i < F_LANES; i++) {
+        z[i] = std::fma(x[i], y[i], z[i]);
+    }
+    return _mm_loadu_ps(z);
+}
+
+static inline Vi16 zero_i16() { return _mm_setzero_si128(); }
+static inline Vi16 set1_i16(int16_t x) { return _mm_set1_epi16(x); }
+static inline Vi16 load_i16(const int16_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void store_i16(int16_t *p, Vi16 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline Vi16 load_partial_i16(const int16_t *p, int n) {
+    int16_t lanes[I16_LANES] = {0};
+    memcpy(lanes, p, sizeof(int16_t) * n);
+    return load_i16(lanes);
+}
+static inline void store_partial_i16(int16_t *p, Vi16 v, int n) {
+    int16_t lanes[I16_LANES];
+    store_i16(lanes, v);
+    memcpy(p, lanes, sizeof(int16_t) * n);
+}
+static inline Vi16 add_i16(Vi16 a, Vi16 b) { return _mm_add_epi16(a, b); }
+static inline Vi16 sub_i16(Vi16 a, Vi16 b) { return _mm_sub_epi16(a, b); }
+static inline Vi16 shr_u16(Vi16 a, int bits) { return _mm_srl_epi16(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi16 shuffle_bytes(Vi16 table, Vi16 index) { return _mm_shuffle_epi8(table, index); }
+static inline Vi16 load_u8_i16(const uint8_t *p) { return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)p)); }
+static inline Vi16 load_partial_u8_i16(const uint8_t *p, int n) {
+    uint8_t lanes[I16_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_i16(lanes);
+}
+static inline void store_i16_u8(uint8_t *p, Vi16 v) { _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(v, v)); }
+static inline void store_partial_i16_u8(uint8_t *p, Vi16 v, int n) {
+    uint8_t lanes[I16_LANES];
+    store_i16_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+static inline Vi32 set1_i32(int32_t x) { return _mm_set1_epi32(x); }
+static inline Vi32 load_i32(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void store_i32(int32_t *p, Vi32 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline Vi32 load_partial_i32(const int32_t *p, int n) {
+    int32_t lanes[I32_LANES] = {0};
+    memcpy(lanes, p, sizeof(int32_t) * n);
+    return load_i32(lanes);
+}
+static inline void store_partial_i32(int32_t *p, Vi32 v, int n) {
+    int32_t lanes[I32_LANES];
+    store_i32(lanes, v);
+    memcpy(p, lanes, sizeof(int32_t) * n);
+}
+static inline Vi32 add_i32(Vi32 a, Vi32 b) { return _mm_add_epi32(a, b); }
+static inline Vi32 sub_i32(Vi32 a, Vi32 b) { return _mm_sub_epi32(a, b); }
+static inline Vi32 mullo_i32(Vi32 a, Vi32 b) { return _mm_mullo_epi32(a, b); }
+static inline Vi32 shr_u32(Vi32 a, int bits) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi32 load_u8_i32(const uint8_t *p) {
+    int32_t bytes;
+    memcpy(&bytes, p, 4);
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+}
+static inline Vi32 load_partial_u8_i32(const uint8_t *p, int n) {
+    uint8_t lanes[I32_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_i32(lanes);
+}
+static inline void store_i32_u8(uint8_t *p, Vi32 v) {
+    int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(v, v), v));
+    memcpy(p, &bytes, 4);
+}
+static inline void store_partial_i32_u8(uint8_t *p, Vi32 v, int n) {
+    uint8_t lanes[I32_LANES];
+    store_i32_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+static inline Vf load_u8_f(const uint8_t *p) {
+    int32_t bytes;
+    memcpy(&bytes, p, 4);
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+}
+static inline Vf load_partial_u8_f(const uint8_t *p, int n) {
+    uint8_t lanes[F_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_f(lanes);
+}
+static inline void store_f_u8(uint8_t *p, Vf v) {
+    __m128i i = _mm_cvttps_epi32(v);
+    i = _mm_packus_epi16(_mm_packs_epi32(i, i), i);
+    int32_t bytes = _mm_cvtsi128_si32(i);
+    memcpy(p, &bytes, 4);
+}
+static inline void store_partial_f_u8(uint8_t *p, Vf v, int n) {
+    uint8_t lanes[F_LANES];
+    store_f_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+const int BLOCKS = 1;
+typedef __m128i Vidx;
+
+static inline Vi16 load_u8(const uint8_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void store_u8(uint8_t *p, Vi16 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline Vi16 load_partial_u8(const uint8_t *p, int n) {
+    uint8_t bytes[16] = {0};
+    memcpy(bytes, p, n);
+    return load_u8(bytes);
+}
+static inline void store_partial_u8(uint8_t *p, Vi16 v, int n) {
+    uint8_t bytes[16];
+    store_u8(bytes, v);
+    memcpy(p, bytes, n);
+}
+static inline Vi16 or_u8(Vi16 a, Vi16 b) { return _mm_or_si128(a, b); }
+static inline Vi16 set_blocks_u8(const uint8_t *pattern) { return load_u8(pattern); }
+
+// a single block, so the dword permutation is a byte shuffle
+static inline Vidx index_u32(const int32_t *index) {
+    uint8_t bytes[16];
+    for (int i = 0; i < 16; i++) {
+        bytes[i] = (index[i / 4] & 3) * 4 + i % 4;
+    }
+    return load_u8(bytes);
+}
+static inline Vi16 permute_u32(Vi16 v, Vidx index) { return _mm_shuffle_epi8(v, index); }
+static inline Vi16 load_planes_u8(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2) {
+    int32_t a, b, c;
+    memcpy(&a, c0, 4);
+    memcpy(&b, c1, 4);
+    memcpy(&c, c2, 4);
+    return _mm_setr_epi32(a, b, c, 0);
+}
+
+}  // namespace simd_sse
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace simd_avx2 {
+
+typedef __m256 Vf;
+typedef __m256i Vi16;
+typedef __m256i Vi32;
+const int F_LANES = 8;
+const int I16_LANES = 16;
+const int I32_LANES = 8;
+
+// all ones in the first n 32 bit lanes
+static inline __m256i lane_mask(int n) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+static inline Vf zero_f() { return _mm256_setzero_ps(); }
+static inline Vf set1_f(float x) { return _mm256_set1_ps(x); }
+static inline Vf load_f(const float *p) { return _mm256_loadu_ps(p); }
+static inline void store_f(float *p, Vf v) { _mm256_storeu_ps(p, v); }
+static inline Vf load_partial_f(const float *p, int n) { return _mm256_maskload_ps(p, lane_mask(n)); }
+static inline void store_partial_f(float *p, Vf v, int n) { _mm256_maskstore_ps(p, lane_mask(n), v); }
+static inline Vf add_f(Vf a, Vf b) { return _mm256_add_ps(a, b); }
+static inline Vf sub_f(Vf a, Vf b) { return _mm256_sub_ps(a, b); }
+static inline Vf mul_f(Vf a, Vf b) { return _mm256_mul_ps(a, b); }
+static inline Vf mul_add_f(Vf a, Vf b, Vf c) { return _mm256_fmadd_ps(a, b, c); }
+
+static inline Vi16 zero_i16() { return _mm256_setzero_si256(); }
+static inline Vi16 set1_i16(int16_t x) { return _mm256_set1_epi16(x); }
+static inline Vi16 load_i16(const int16_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void store_i16(int16_t *p, Vi16 v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline Vi16 load_partial_i16(const int16_t *p, int n) {
+    int16_t lanes[I16_LANES] = {0};
+    memcpy(lanes, p, sizeof(int16_t) * n);
+    return load_i16(lanes);
+}
+static inline void store_partial_i16(int16_t *p, Vi16 v, int n) {
+    int16_t lanes[I16_LANES];
+    store_i16(lanes, v);
+    memcpy(p, lanes, sizeof(int16_t) * n);
+}
+static inline Vi16 add_i16(Vi16 a, Vi16 b) { return _mm256_add_epi16(a, b); }
+static inline Vi16 sub_i16(Vi16 a, Vi16 b) { return _mm256_sub_epi16(a, b); }
+static inline Vi16 shr_u16(Vi16 a, int bits) { return _mm256_srl_epi16(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi16 shuffle_bytes(Vi16 table, Vi16 index) { return _mm256_shuffle_epi8(table, index); }
+static inline Vi16 load_u8_i16(const uint8_t *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p)); }
+static inline Vi16 load_partial_u8_i16(const uint8_t *p, int n) {
+    uint8_t lanes[I16_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_i16(lanes);
+}
+static inline void store_i16_u8(uint8_t *p, Vi16 v) {
+    __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128((__m128i *)p, bytes);
+}
+static inline void store_partial_i16_u8(uint8_t *p, Vi16 v, int n) {
+    uint8_t lanes[I16_LANES];
+    store_i16_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+static inline Vi32 set1_i32(int32_t x) { return _mm256_set1_epi32(x); }
+static inline Vi32 load_i32(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void store_i32(int32_t *p, Vi32 v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline Vi32 load_partial_i32(const int32_t *p, int n) { return _mm256_maskload_epi32(p, lane_mask(n)); }
+static inline void store_partial_i32(int32_t *p, Vi32 v, int n) { _mm256_maskstore_epi32(p, lane_mask(n), v); }
+static inline Vi32 add_i32(Vi32 a, Vi32 b) { return _mm256_add_epi32(a, b); }
+static inline Vi32 sub_i32(Vi32 a, Vi32 b) { return _mm256_sub_epi32(a, b); }
+static inline Vi32 mullo_i32(Vi32 a, Vi32 b) { return _mm256_mullo_epi32(a, b); }
+static inline Vi32 shr_u32(Vi32 a, int bits) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi32 load_u8_i32(const uint8_t *p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)); }
+static inline Vi32 load_partial_u8_i32(const uint8_t *p, int n) {
+    uint8_t lanes[I32_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_i32(lanes);
+}
+static inline void store_i32_u8(uint8_t *p, Vi32 v) {
+    // the packs work per 128 bit half, so each half ends up with its 4 bytes in its first dword
+    __m256i i = _mm256_packus_epi16(_mm256_packs_epi32(v, v), v);
+    i = _mm256_permutevar8x32_epi32(i, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i *)p, _mm256_castsi256_si128(i));
+}
+static inline void store_partial_i32_u8(uint8_t *p, Vi32 v, int n) {
+    uint8_t lanes[I32_LANES];
+    store_i32_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+static inline Vf load_u8_f(const uint8_t *p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+}
+static inline Vf load_partial_u8_f(const uint8_t *p, int n) {
+    uint8_t lanes[F_LANES] = {0};
+    memcpy(lanes, p, n);
+    return load_u8_f(lanes);
+}
+static inline void store_f_u8(uint8_t *p, Vf v) {
+    // the packs work per 128 bit half, so each half ends up with its 4 bytes in its first dword
+    __m256i i = _mm256_cvttps_epi32(v);
+    i = _mm256_packus_epi16(_mm256_packs_epi32(i, i), i);
+    i = _mm256_permutevar8x32_epi32(i, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i *)p, _mm256_castsi256_si128(i));
+}
+static inline void store_partial_f_u8(uint8_t *p, Vf v, int n) {
+    uint8_t lanes[F_LANES];
+    store_f_u8(lanes, v);
+    memcpy(p, lanes, n);
+}
+
+const int BLOCKS = 2;
+typedef __m256i Vidx;
+
+static inline Vi16 load_u8(const uint8_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void store_u8(uint8_t *p, Vi16 v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline Vi16 load_partial_u8(const uint8_t *p, int n) {
+    uint8_t bytes[32] = {0};
+    memcpy(bytes, p, n);
+    return load_u8(bytes);
+}
+static inline void store_partial_u8(uint8_t *p, Vi16 v, int n) {
+    uint8_t bytes[32];
+    store_u8(bytes, v);
+    memcpy(p, bytes, n);
+}
+static inline Vi16 or_u8(Vi16 a, Vi16 b) { return _mm256_or_si256(a, b); }
+static inline Vi16 set_blocks_u8(const uint8_t *pattern) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pattern));
+}
+static inline Vidx index_u32(const int32_t *index) { return _mm256_loadu_si256((const __m256i *)index); }
+static inline Vi16 permute_u32(Vi16 v, Vidx index) { return _mm256_permutevar8x32_epi32(v, index); }
+static inline Vi16 load_planes_u8(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2) {
+    long long a, b, c;
+    memcpy(&a, c0, 8);
+    memcpy(&b, c1, 8);
+    memcpy(&c, c2, 8);
+    return _mm256_setr_epi64x(a, b, c, 0);
+}
+
+}  // namespace simd_avx2
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,fma")
+
+namespace simd_avx512 {
+
+typedef __m512 Vf;
+typedef __m512i Vi16;
+typedef __m512i Vi32;
+const int F_LANES = 16;
+const int I16_LANES = 32;
+const int I32_LANES = 16;
+
+static inline __mmask16 mask_f(int n) { return n >= F_LANES ? (__mmask16)0xffff : (__mmask16)((1u << n) - 1); }
+static inline __mmask32 mask_i16(int n) { return n >= I16_LANES ? (__mmask32)~0u : (__mmask32)((1u << n) - 1); }
+
+static inline Vf zero_f() { return _mm512_setzero_ps(); }
+static inline Vf set1_f(float x) { return _mm512_set1_ps(x); }
+static inline Vf load_f(const float *p) { return _mm512_loadu_ps(p); }
+static inline void store_f(float *p, Vf v) { _mm512_storeu_ps(p, v); }
+static inline Vf load_partial_f(const float *p, int n) { return _mm512_maskz_loadu_ps(mask_f(n), p); }
+static inline void store_partial_f(float *p, Vf v, int n) { _mm512_mask_storeu_ps(p, mask_f(n), v); }
+static inline Vf add_f(Vf a, Vf b) { return _mm512_add_ps(a, b); }
+static inline Vf sub_f(Vf a, Vf b) { return _mm512_sub_ps(a, b); }
+static inline Vf mul_f(Vf a, Vf b) { return _mm512_mul_ps(a, b); }
+static inline Vf mul_add_f(Vf a, Vf b, Vf c) { return _mm512_fmadd_ps(a, b, c); }
+
+static inline Vi16 zero_i16() { return _mm512_setzero_si512(); }
+static inline Vi16 set1_i16(int16_t x) { return _mm512_set1_epi16(x); }
+static inline Vi16 load_i16(const int16_t *p) { return _mm512_loadu_si512(p); }
+static inline void store_i16(int16_t *p, Vi16 v) { _mm512_storeu_si512(p, v); }
+static inline Vi16 load_partial_i16(const int16_t *p, int n) { return _mm512_maskz_loadu_epi16(mask_i16(n), p); }
+static inline void store_partial_i16(int16_t *p, Vi16 v, int n) { _mm512_mask_storeu_epi16(p, mask_i16(n), v); }
+static inline Vi16 add_i16(Vi16 a, Vi16 b) { return _mm512_add_epi16(a, b); }
+static inline Vi16 sub_i16(Vi16 a, Vi16 b) { return _mm512_sub_epi16(a, b); }
+static inline Vi16 shr_u16(Vi16 a, int bits) { return _mm512_srl_epi16(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi16 shuffle_bytes(Vi16 table, Vi16 index) { return _mm512_shuffle_epi8(table, index); }
+
+static inline __mmask64 mask_u8(int n) { return n >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << n) - 1; }
+
+static inline Vi16 load_u8_i16(const uint8_t *p) {
+    return _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)p));
+}
+static inline Vi16 load_partial_u8_i16(const uint8_t *p, int n) {
+    return _mm512_cvtepu8_epi16(_mm512_castsi512_si256(_mm512_maskz_loadu_epi8(mask_u8(n), p)));
+}
+static inline __m512i clamp_i16_u8(Vi16 v) {
+    return _mm512_min_epi16(_mm512_max_epi16(v, _mm512_setzero_si512()), _mm512_set1_epi16(255));
+}
+static inline void store_i16_u8(uint8_t *p, Vi16 v) {
+    _mm256_storeu_si256((__m256i *)p, _mm512_cvtepi16_epi8(clamp_i16_u8(v)));
+}
+static inline void store_partial_i16_u8(uint8_t *p, Vi16 v, int n) {
+    _mm512_mask_cvtepi16_storeu_epi8(p, mask_i16(n), clamp_i16_u8(v));
+}
+
+static inline Vi32 set1_i32(int32_t x) { return _mm512_set1_epi32(x); }
+static inline Vi32 load_i32(const int32_t *p) { return _mm512_loadu_si512(p); }
+static inline void store_i32(int32_t *p, Vi32 v) { _mm512_storeu_si512(p, v); }
+static inline Vi32 load_partial_i32(const int32_t *p, int n) { return _mm512_maskz_loadu_epi32(mask_f(n), p); }
+static inline void store_partial_i32(int32_t *p, Vi32 v, int n) { _mm512_mask_storeu_epi32(p, mask_f(n), v); }
+static inline Vi32 add_i32(Vi32 a, Vi32 b) { return _mm512_add_epi32(a, b); }
+static inline Vi32 sub_i32(Vi32 a, Vi32 b) { return _mm512_sub_epi32(a, b); }
+static inline Vi32 mullo_i32(Vi32 a, Vi32 b) { return _mm512_mullo_epi32(a, b); }
+static inline Vi32 shr_u32(Vi32 a, int bits) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(bits)); }
+static inline Vi32 load_u8_i32(const uint8_t *p) { return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p)); }
+static inline Vi32 load_partial_u8_i32(const uint8_t *p, int n) {
+    return _mm512_cvtepu8_epi32(_mm512_castsi512_si128(_mm512_maskz_loadu_epi8(mask_u8(n), p)));
+}
+static inline __m512i clamp_i32_u8(Vi32 v) {
+    return _mm512_min_epi32(_mm512_max_epi32(v, _mm512_setzero_si512()), _mm512_set1_epi32(255));
+}
+static inline void store_i32_u8(uint8_t *p, Vi32 v) {
+    _mm_storeu_si128((__m128i *)p, _mm512_cvtepi32_epi8(clamp_i32_u8(v)));
+}
+static inline void store_partial_i32_u8(uint8_t *p, Vi32 v, int n) {
+    _mm512_mask_cvtepi32_storeu_epi8(p, mask_f(n), clamp_i32_u8(v));
+}
+
+static inline Vf load_u8_f(const uint8_t *p) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+static inline Vf load_partial_u8_f(const uint8_t *p, int n) {
+    __m128i bytes = _mm512_castsi512_si128(_mm512_maskz_loadu_epi8(mask_u8(n), p));
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+}
+static inline __m512i clamp_u8(Vf v) {
+    __m512i i = _mm512_cvttps_epi32(v);
+    return _mm512_min_epi32(_mm512_max_epi32(i, _mm512_setzero_si512()), _mm512_set1_epi32(255));
+}
+static inline void store_f_u8(uint8_t *p, Vf v) { _mm_storeu_si128((__m128i *)p, _mm512_cvtepi32_epi8(clamp_u8(v))); }
+static inline void store_partial_f_u8(uint8_t *p, Vf v, int n) {
+    _mm512_mask_cvtepi32_storeu_epi8(p, mask_f(n), clamp_u8(v));
+}
+
+const int BLOCKS = 4;
+typedef __m512i Vidx;
+
+static inline Vi16 load_u8(const uint8_t *p) { return _mm512_loadu_si512(p); }
+static inline void store_u8(uint8_t *p, Vi16 v) { _mm512_storeu_si512(p, v); }
+static inline Vi16 load_partial_u8(const uint8_t *p, int n) { return _mm512_maskz_loadu_epi8(mask_u8(n), p); }
+static inline void store_partial_u8(uint8_t *p, Vi16 v, int n) { _mm512_mask_storeu_epi8(p, mask_u8(n), v); }
+static inline Vi16 or_u8(Vi16 a, Vi16 b) { return _mm512_or_si512(a, b); }
+static inline Vi16 set_blocks_u8(const uint8_t *pattern) {
+    return _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)pattern));
+}
+static inline Vidx index_u32(const int32_t *index) { return _mm512_loadu_si512(index); }
+static inline Vi16 permute_u32(Vi16 v, Vidx index) { return _mm512_permutexvar_epi32(index, v); }
+static inline Vi16 load_planes_u8(const uint8_t *c0, const uint8_t *c1, const uint8_t *c2) {
+    __m512i v = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)c0));
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *)c1), 1);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128((const __m128i *)c2), 2);
+    return _mm512_inserti32x4(v, _mm_setzero_si128(), 3);
+}
+
+}  // namespace simd_avx512
+
+#pragma GCC pop_options
+
+#endif
+
+#endif
@@ -0,0 +1,1465 @@
+/*
+Regression tests
+----------------
+Runs every backend, edge mode and thread count over synthetic images of awkward sizes and
+checks the output against stored golden hashes (for the bit-exact backends) or against the
+exact 2D blur within a tolerance (for the float backends).
+
+Usage: make test
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "approx.h"
+#include "backends.h"
+#include "blur.h"
+#include "bmp.h"
+#include "codec.h"
+#include "effects.h"
+#include "kernels.h"
+#include "pipeline.h"
+#include "resize.h"
+
+using namespace std;
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(cond, ...)                                         \
+    do {                                                         \
+        checks++;                                                \
+        if (!(cond)) {                                           \
+            failures++;                                          \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                        \
+            fprintf(stderr, "\n");                               \
+        }                                                        \
+    } while (0)
+
+static const int THREAD_COUNTS[] = {1, 2, 3, 4, 7, 64};
+
+// widths 1, 2, 3, 5, 7 and 13 all leave 1 to 3 bytes of row padding
+static const int SIZES[][2] = {{1, 1}, {2, 3}, {3, 7}, {5, 4}, {7, 5}, {13, 11}, {16, 9}, {33, 17}};
+
+typedef vector<Pixel> Image;
+
+// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+static uint64_t fnv1a(const Image &image) {
+    uint64_t hash = 14695981039346656037ULL;
+    const uint8_t *bytes = (const uint8_t *)image.data();
+    for (size_t i = 0; i < image.size() * sizeof(Pixel); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// gradients with hard edges and a little noise, so blur, edges and rounding all show up
+static Image synthetic_image(int width, int height, uint32_t seed) {
+    Image image(width * height);
+    uint32_t state = seed;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            state = state * 1664525u + 1013904223u;
+            Pixel &p = image[y * width + x];
+            p.red = (x * 255) / max(width - 1, 1);
+            p.green = ((x / 3 + y / 2) % 2) ? 220 : 30;
+            p.blue = (state >> 24);
+        }
+    }
+    return image;
+}
+
+static int max_difference(const Image &a, const Image &b) {
+    int result = 0;
+    const uint8_t *pa = (const uint8_t *)a.data(), *pb = (const uint8_t *)b.data();
+    for (size_t i = 0; i < a.size() * sizeof(Pixel); i++) {
+        result = max(result, abs(pa[i] - pb[i]));
+    }
+    return result;
+}
+
+static double mean_difference(const Image &a, const Image &b) {
+    double sum = 0;
+    const uint8_t *pa = (const uint8_t *)a.data(), *pb = (const uint8_t *)b.data();
+    for (size_t i = 0; i < a.size() * sizeof(Pixel); i++) {
+        sum += abs(pa[i] - pb[i]);
+    }
+    return sum / (a.size() * sizeof(Pixel));
+}
+
+static Image run_exact(Image &input, int width, int height, int radius, EdgeMode edge, int threads) {
+    BMPHeader header = make_bmp_header(width, height);
+    auto kernel = gen_gaussian_kernel(radius);
+    Image output(width * height);
+    blur_image(header, input.data(), output.data(), kernel, threads, edge);
+    return output;
+}
+
+static Image run_pipeline(const Pipeline &pipeline, const Image &input) {
+    Image output(pipeline.output_width() * pipeline.output_height());
+    pipeline.run(input.data(), output.data());
+    return output;
+}
+
+struct Golden {
+    int width, height, radius;
+    EdgeMode edge;
+    uint64_t hash;
+};
+
+// exact backend, any thread count. Regenerate with `./blur_tests --print-golden` and paste the output
+// here only when a change to the exact output is intended.
+static const Golden EXACT_GOLDEN[] = {
+    {1, 1, 0, EDGE_ZERO, 0xd8e6f7186bb84ea4ULL},
+    {1, 1, 0, EDGE_CLAMP, 0xd8e6f7186bb84ea4ULL},
+    {1, 1, 1, EDGE_ZERO, 0xd8edf6186bbe6b9fULL},
+    {1, 1, 1, EDGE_CLAMP, 0xd8e6f7186bb84ea4ULL},
+    {1, 1, 2, EDGE_ZERO, 0xd92b20186bf2611bULL},
+    {1, 1, 2, EDGE_CLAMP, 0xd8e6f7186bb84ea4ULL},
+    {1, 1, 5, EDGE_ZERO, 0xd949ab186c0c4adbULL},
+    {1, 1, 5, EDGE_CLAMP, 0xd8e6f7186bb84ea4ULL},
+    {2, 3, 0, EDGE_ZERO, 0xf6acbea636f3ce60ULL},
+    {2, 3, 0, EDGE_CLAMP, 0xf6acbea636f3ce60ULL},
+    {2, 3, 1, EDGE_ZERO, 0x5b0a805d5ccaa269ULL},
+    {2, 3, 1, EDGE_CLAMP, 0xff2a43004c3090c1ULL},
+    {2, 3, 2, EDGE_ZERO, 0x2b5ca67ff968fe27ULL},
+    {2, 3, 2, EDGE_CLAMP, 0x904249c0bbc1c461ULL},
+    {2, 3, 5, EDGE_ZERO, 0x68d50fc774dcb815ULL},
+    {2, 3, 5, EDGE_CLAMP, 0x10a535181188b4c4ULL},
+    {3, 7, 0, EDGE_ZERO, 0x7875da50c5ddf2ccULL},
+    {3, 7, 0, EDGE_CLAMP, 0x7875da50c5ddf2ccULL},
+    {3, 7, 1, EDGE_ZERO, 0x0b95fb09e8f36d53ULL},
+    {3, 7, 1, EDGE_CLAMP, 0xf17e6d1c1c80f384ULL},
+    {3, 7, 2, EDGE_ZERO, 0x6282cfde35a9190dULL},
+    {3, 7, 2, EDGE_CLAMP, 0x1a4ae6393b61ad06ULL},
+    {3, 7, 5, EDGE_ZERO, 0x3046be1eaf26e4dbULL},
+    {3, 7, 5, EDGE_CLAMP, 0x32e0a728b2292794ULL},
+    {5, 4, 0, EDGE_ZERO, 0xc476d637d84f3095ULL},
+    {5, 4, 0, EDGE_CLAMP, 0xc476d637d84f3095ULL},
+    {5, 4, 1, EDGE_ZERO, 0x627bcb71bde0199eULL},
+    {5, 4, 1, EDGE_CLAMP, 0xd0c7cd168c61ea41ULL},
+    {5, 4, 2, EDGE_ZERO, 0xc7c14f27f551a628ULL},
+    {5, 4, 2, EDGE_CLAMP, 0xa68c13f26acce837ULL},
+    {5, 4, 5, EDGE_ZERO, 0x3b13b763fa943012ULL},
+    {5, 4, 5, EDGE_CLAMP, 0x287189aeba3f154bULL},
+    {7, 5, 0, EDGE_ZERO, 0x5d8129eb3f958d5dULL},
+    {7, 5, 0, EDGE_CLAMP, 0x5d8129eb3f958d5dULL},
+    {7, 5, 1, EDGE_ZERO, 0x5e23f59de490868dULL},
+    {7, 5, 1, EDGE_CLAMP, 0xcde2ec5091294f20ULL},
+    {7, 5, 2, EDGE_ZERO, 0x450639b9eebf636dULL},
+    {7, 5, 2, EDGE_CLAMP, 0xf3ca504ac61ae337ULL},
+    {7, 5, 5, EDGE_ZERO, 0x8c7a661760fb79c3ULL},
+    {7, 5, 5, EDGE_CLAMP, 0xd7b7e24b01128522ULL},
+    {13, 11, 0, EDGE_ZERO, 0x624d973137c16ae6ULL},
+    {13, 11, 0, EDGE_CLAMP, 0x624d973137c16ae6ULL},
+    {13, 11, 1, EDGE_ZERO, 0xb801c9eb914626fbULL},
+    {13, 11, 1, EDGE_CLAMP, 0x0052464318177009ULL},
+    {13, 11, 2, EDGE_ZERO, 0x898a66dea58b95f9ULL},
+    {13, 11, 2, EDGE_CLAMP, 0xc4ca7555390d4a27ULL},
+    {13, 11, 5, EDGE_ZERO, 0xd6e65a1329f59a91ULL},
+    {13, 11, 5, EDGE_CLAMP, 0x5a3910f09948742dULL},
+    {16, 9, 0, EDGE_ZERO, 0x3c7ee55c476ade38ULL},
+    {16, 9, 0, EDGE_CLAMP, 0x3c7ee55c476ade38ULL},
+    {16, 9, 1, EDGE_ZERO, 0x49c0fc1f290eea88ULL},
+    {16, 9, 1, EDGE_CLAMP, 0x2792247d67e87477ULL},
+    {16, 9, 2, EDGE_ZERO, 0xa6192a824c921fc2ULL},
+    {16, 9, 2, EDGE_CLAMP, 0x964cbb36305ea9deULL},
+    {16, 9, 5, EDGE_ZERO, 0xb36ba08690d5c3b5ULL},
+    {16, 9, 5, EDGE_CLAMP, 0xd7a83e257f3849ddULL},
+    {33, 17, 0, EDGE_ZERO, 0x34372e66c1b9175bULL},
+    {33, 17, 0, EDGE_CLAMP, 0x34372e66c1b9175bULL},
+    {33, 17, 1, EDGE_ZERO, 0x3264ee83b9ccf944ULL},
+    {33, 17, 1, EDGE_CLAMP, 0xecc53425a7c86c4cULL},
+    {33, 17, 2, EDGE_ZERO, 0x6a52fac613cf5968ULL},
+    {33, 17, 2, EDGE_CLAMP, 0x4d16970a528fb74aULL},
+    {33, 17, 5, EDGE_ZERO, 0x18670b43dec60001ULL},
+    {33, 17, 5, EDGE_CLAMP, 0x9b5533fc2111c6a2ULL},
+};
+
+static void test_exact_golden(bool print) {
+    for (const Golden &golden : EXACT_GOLDEN) {
+        Image input = synthetic_image(golden.width, golden.height, golden.width * 31 + golden.height);
+
+        for (int threads : THREAD_COUNTS) {
+            Image output = run_exact(input, golden.width, golden.height, golden.radius, golden.edge, threads);
+            uint64_t hash = fnv1a(output);
+            if (print && threads == 1) {
+                printf("    {%d, %d, %d, %s, 0x%016llxULL},\n", golden.width, golden.height, golden.radius,
+                       golden.edge == EDGE_ZERO ? "EDGE_ZERO" : "EDGE_CLAMP", (unsigned long long)hash);
+            }
+            CHECK(print || hash == golden.hash, "exact %dx%d r=%d edge=%d threads=%d: hash %016llx != golden %016llx",
+                  golden.width, golden.height, golden.radius, golden.edge, threads, (unsigned long long)hash,
+                  (unsigned long long)golden.hash);
+        }
+    }
+}
+
+// flat colour with a noisy patch and a second colour on the right, like a scan or a screenshot
+static Image document_image(int width, int height) {
+    Image image(width * height);
+    Image noise = synthetic_image(width, height, 99);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            Pixel &p = image[y * width + x];
+            if (x >= 40 && x < 70 && y >= 30 && y < 55) {
+                p = noise[y * width + x];
+            } else if (x >= 3 * width / 4) {
+                p = {20, 40, 60};
+            } else {
+                p = {237, 231, 219};
+            }
+        }
+    }
+    return image;
+}
+
+// skipping uniform tiles must give the bytes blurring them would, whatever the edge mode and threads
+static void test_uniform_tiles() {
+    int width = 251, height = 203;
+    Image input = document_image(width, height);
+    BMPHeader header = make_bmp_header(width, height);
+
+    for (int radius : {0, 1, 5, 20, 40}) {
+        auto kernel = gen_gaussian_kernel(radius);
+        for (EdgeMode edge : {EDGE_ZERO, EDGE_CLAMP}) {
+            // apply_blur without tiles is the plain per pixel blur
+            Image reference(width * height);
+            vector<BlurParams> params(1);
+            params[0] = {header, input.data(), reference.data(), kernel, 0, width * height, edge, NULL, NULL, NULL};
+            run_threads(params, apply_blur);
+
+            for (int threads : {1, 3, 7}) {
+                Image output(width * height);
+                BlurStats stats = {0, 0};
+                blur_image(header, input.data(), output.data(), kernel, threads, edge, NULL, &stats);
+                CHECK(fnv1a(output) == fnv1a(reference), "uniform tiles r=%d edge=%d threads=%d changed the output",
+                      radius, edge, threads);
+                CHECK(stats.pixels == (long long)width * height && stats.skipped_pixels < stats.pixels,
+                      "uniform tiles r=%d: skipped %lld of %lld", radius, stats.skipped_pixels, stats.pixels);
+                CHECK(radius > 5 || stats.skipped_pixels > 0, "uniform tiles r=%d: nothing skipped", radius);
+            }
+        }
+    }
+
+    // a flat frame is skipped whole with clamped edges, and only away from the border with black ones
+    Image flat(width * height, Pixel{90, 90, 91});
+    UniformTiles clamped = find_uniform_tiles(flat.data(), width, height, 10, EDGE_CLAMP);
+    CHECK(clamped.skipped_pixels == (long long)width * height, "flat frame: %lld skipped", clamped.skipped_pixels);
+    UniformTiles zero = find_uniform_tiles(flat.data(), width, height, 10, EDGE_ZERO);
+    CHECK(zero.skipped_pixels == 32 * 32 * 6 * 5, "flat frame with black edges: %lld skipped", zero.skipped_pixels);
+
+    // detail everywhere leaves nothing to skip
+    Image noisy = synthetic_image(width, height, 7);
+    CHECK(find_uniform_tiles(noisy.data(), width, height, 2, EDGE_CLAMP).skipped_pixels == 0,
+          "noisy frame: tiles skipped");
+}
+
+// the separable pipeline must match the exact 2D blur to within rounding, and not depend on threads
+static void test_separable() {
+    for (auto &size : SIZES) {
+        int width = size[0], height = size[1];
+        Image input = synthetic_image(width, height, width * 31 + height);
+
+        for (int radius : {0, 1, 2, 5}) {
+            for (EdgeMode edge : {EDGE_ZERO, EDGE_CLAMP}) {
+                Image reference = run_exact(input, width, height, radius, edge, 1);
+                uint64_t first_hash = 0;
+
+                for (int threads : THREAD_COUNTS) {
+                    Pipeline pipeline(width, height);
+                    pipeline.edge(edge).threads(threads).band_height(3).blur(radius);
+                    Image output = run_pipeline(pipeline, input);
+
+                    CHECK(max_difference(output, reference) <= 1, "separable %dx%d r=%d edge=%d threads=%d: off by %d",
+                          width, height, radius, edge, threads, max_difference(output, reference));
+
+                    uint64_t hash = fnv1a(output);
+                    if (threads == THREAD_COUNTS[0]) {
+                        first_hash = hash;
+                    }
+                    CHECK(hash == first_hash, "separable %dx%d r=%d edge=%d: threads=%d changed the output", width,
+                          height, radius, edge, threads);
+                }
+            }
+        }
+    }
+}
+
+static void test_resize() {
+    for (auto &size : SIZES) {
+        int width = size[0], height = size[1];
+        Image input = synthetic_image(width, height, width * 31 + height);
+
+        for (ResizeFilter filter : {FILTER_AREA, FILTER_BICUBIC, FILTER_LANCZOS}) {
+            // resizing to the same size without a prefilter is the identity
+            Pipeline identity(width, height);
+            identity.resize(width, height, filter, 0.0);
+            CHECK(fnv1a(run_pipeline(identity, input)) == fnv1a(input), "resize %dx%d filter=%d is not the identity",
+                  width, height, filter);
+
+            // and with a prefilter it is the clamped gaussian blur
+            for (int radius : {1, 3}) {
+                Image reference = run_exact(input, width, height, radius, EDGE_CLAMP, 1);
+                Pipeline blurred(width, height);
+                blurred.resize(width, height, filter, default_sigma(radius));
+                int diff = max_difference(run_pipeline(blurred, input), reference);
+                CHECK(diff <= 1, "resize %dx%d filter=%d r=%d: off from the blur by %d", width, height, filter, radius,
+                      diff);
+            }
+
+            uint64_t first_hash = 0;
+            for (int threads : THREAD_COUNTS) {
+                Pipeline pipeline(width, height);
+                pipeline.threads(threads).band_height(2).resize(max(width / 2, 1), height * 2 - 1, filter, 0.8);
+                uint64_t hash = fnv1a(run_pipeline(pipeline, input));
+                if (threads == THREAD_COUNTS[0]) {
+                    first_hash = hash;
+                }
+                CHECK(hash == first_hash, "resize %dx%d filter=%d: threads=%d changed the output", width, height,
+                      filter, threads);
+            }
+        }
+    }
+}
+
+// area resize by an integer factor and the downscale stage compute the same box average
+static void test_downscale() {
+    Image input = synthetic_image(12, 10, 7);
+    for (int factor : {1, 2}) {
+        Pipeline box(12, 10), area(12, 10);
+        box.downscale(factor);
+        area.resize(12 / factor, 10 / factor, FILTER_AREA, 0.0);
+        CHECK(max_difference(run_pipeline(box, input), run_pipeline(area, input)) <= 1,
+              "downscale %d differs from the area resize", factor);
+    }
+
+    // smaller than the factor, the one output pixel averages the whole image
+    for (int size : {1, 3}) {
+        Image tiny = synthetic_image(size, size, 11);
+        Pipeline pipeline(size, size);
+        pipeline.downscale(4);
+        Image output = run_pipeline(pipeline, tiny);
+        int sum = 0;
+        for (const Pixel &p : tiny) {
+            sum += p.green;
+        }
+        int expected = (int)((float)sum / (size * size) + 0.5f);
+        CHECK(output.size() == 1 && abs(output[0].green - expected) <= 1, "downscale 4 of %dx%d gave %d, not %d",
+              size, size, output.empty() ? -1 : output[0].green, expected);
+    }
+}
+
+// the recurrence drifts from exp() by a few ulps a step, and the threaded kernel is the same numbers
+static void test_gaussian_kernels() {
+    for (int radius : {1, 5, 60, 200}) {
+        double sigma = default_sigma(radius);
+        vector<double> weights = gaussian_weights(radius, sigma);
+        double worst = 0;
+        for (int i = -radius; i <= radius; i++) {
+            double expected = exp(-(i * i) / (2 * sigma * sigma));
+            worst = max(worst, fabs(weights[i + radius] - expected) / expected);
+        }
+        CHECK(worst < 1e-12, "gaussian_weights r=%d is %g off exp()", radius, worst);
+    }
+
+    auto single = gen_gaussian_kernel(130), threaded = gen_gaussian_kernel(130, 7);
+    double sum = 0;
+    for (const vector<double> &row : single) {
+        for (double value : row) {
+            sum += value;
+        }
+    }
+    CHECK(single == threaded, "threaded gen_gaussian_kernel differs");
+    CHECK(fabs(sum - 1.0) < 1e-9, "gen_gaussian_kernel sums to %.12f", sum);
+}
+
+// the whole chain must give identical bytes for any thread count and band height
+static void test_partitions() {
+    int width = 29, height = 23;
+    Image input = synthetic_image(width, height, 99);
+    uint64_t expected = 0;
+
+    for (int threads : THREAD_COUNTS) {
+        for (int band_height : {1, 2, 5, 16, 64}) {
+            Pipeline pipeline(width, height);
+            pipeline.threads(threads).band_height(band_height).edge(EDGE_CLAMP);
+            pipeline.blur(2).unsharp(2, 0.7f).resize(17, 31, FILTER_LANCZOS, 0.5).downscale(2).adjust(5, 1.2f, 0.8f);
+
+            uint64_t hash = fnv1a(run_pipeline(pipeline, input));
+            if (expected == 0) {
+                expected = hash;
+            }
+            CHECK(hash == expected, "chain with threads=%d band_height=%d changed the output", threads, band_height);
+        }
+    }
+}
+
+// the decomposed rotated gaussian against the full 2D one, with the edges clamped
+static void test_rotated_blur() {
+    int width = 41, height = 37;
+    Image input = synthetic_image(width, height, 5);
+    const double cases[][3] = {{3, 1, 30}, {4, 0.5, 100}, {2, 2, 0}, {5, 1.5, -60}, {3, 0, 45}, {1, 6, 170}};
+
+    for (const auto &params : cases) {
+        double sx = params[0], sy = params[1], theta = params[2] * M_PI / 180;
+        double c = cos(theta), s = sin(theta);
+        int reach = (int)ceil(3 * max(sx, sy)) + 1;
+
+        // a tiny sigma stands in for a zero one, it only has to keep the inverse finite
+        double ax = max(sx, 0.05), ay = max(sy, 0.05);
+        vector<double> kernel((2 * reach + 1) * (2 * reach + 1));
+        double total = 0;
+        for (int dy = -reach; dy <= reach; dy++) {
+            for (int dx = -reach; dx <= reach; dx++) {
+                double u = dx * c + dy * s, v = -dx * s + dy * c;
+                double weight = exp(-0.5 * (u * u / (ax * ax) + v * v / (ay * ay)));
+                kernel[(dy + reach) * (2 * reach + 1) + dx + reach] = weight;
+                total += weight;
+            }
+        }
+
+        Image reference(width * height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                double sum[3] = {0, 0, 0};
+                for (int dy = -reach; dy <= reach; dy++) {
+                    for (int dx = -reach; dx <= reach; dx++) {
+                        int sx_ = min(max(x + dx, 0), width - 1), sy_ = min(max(y + dy, 0), height - 1);
+                        const uint8_t *p = (const uint8_t *)&input[sy_ * width + sx_];
+                        double weight = kernel[(dy + reach) * (2 * reach + 1) + dx + reach] / total;
+                        for (int ch = 0; ch < 3; ch++) {
+                            sum[ch] += p[ch] * weight;
+                        }
+                    }
+                }
+                uint8_t *q = (uint8_t *)&reference[y * width + x];
+                for (int ch = 0; ch < 3; ch++) {
+                    q[ch] = (uint8_t)min(sum[ch] + 0.5, 255.0);
+                }
+            }
+        }
+
+        uint64_t first_hash = 0;
+        for (int threads : {1, 3}) {
+            for (int band_height : {1, 7, 64}) {
+                Pipeline pipeline(width, height);
+                pipeline.edge(EDGE_CLAMP).threads(threads).band_height(band_height).rotated_blur(sx, sy, params[2]);
+                Image output = run_pipeline(pipeline, input);
+                if (first_hash == 0) {
+                    first_hash = fnv1a(output);
+                    double diff = mean_difference(output, reference);
+                    CHECK(diff <= 1.0, "rotated %.1f x %.1f at %.0f: off from the 2D gaussian by %.2f", sx, sy,
+                          params[2], diff);
+                }
+                CHECK(fnv1a(output) == first_hash, "rotated %.1f x %.1f at %.0f: threads=%d band_height=%d changed it",
+                      sx, sy, params[2], threads, band_height);
+            }
+        }
+    }
+}
+
+// the masked blur is blur(image * mask) / blur(mask) in one go, so it must match that computed directly in 2D
+static void test_masked_blur() {
+    int width = 45, height = 31, radius = 4;
+    Image input = synthetic_image(width, height, 11);
+
+    // a bright block that is masked out, a half weight stripe and a hole wider than the kernel
+    vector<uint8_t> mask(width * height, 255);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (x >= 10 && x < 16 && y >= 8 && y < 20) {
+                input[y * width + x] = {255, 255, 255};
+                mask[y * width + x] = 0;
+            } else if (x == 25) {
+                mask[y * width + x] = 128;
+            } else if (x >= 32 && y >= 15) {
+                mask[y * width + x] = 0;
+            }
+        }
+    }
+    vector<float> kernel = gen_gaussian_kernel_1d(radius, default_sigma(radius));
+
+    for (EdgeMode edge : {EDGE_ZERO, EDGE_CLAMP}) {
+        Image reference(width * height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                double sum[3] = {0, 0, 0}, weights = 0;
+                for (int dy = -radius; dy <= radius; dy++) {
+                    for (int dx = -radius; dx <= radius; dx++) {
+                        int sx = x + dx, sy = y + dy;
+                        if (sx < 0 || sx >= width || sy < 0 || sy >= height) {
+                            if (edge == EDGE_ZERO) {
+                                continue;
+                            }
+                            sx = min(max(sx, 0), width - 1);
+                            sy = min(max(sy, 0), height - 1);
+                        }
+                        double weight = (double)kernel[dy + radius] * kernel[dx + radius] * mask[sy * width + sx] / 255;
+                        const uint8_t *p = (const uint8_t *)&input[sy * width + sx];
+                        for (int ch = 0; ch < 3; ch++) {
+                            sum[ch] += p[ch] * weight;
+                        }
+                        weights += weight;
+                    }
+                }
+                const uint8_t *p = (const uint8_t *)&input[y * width + x];
+                uint8_t *q = (uint8_t *)&reference[y * width + x];
+                for (int ch = 0; ch < 3; ch++) {
+                    q[ch] = weights > 0 ? (uint8_t)min(sum[ch] / weights + 0.5, 255.0) : p[ch];
+                }
+            }
+        }
+
+        uint64_t first_hash = 0;
+        for (int threads : {1, 3}) {
+            for (int band_height : {1, 5, 64}) {
+                Pipeline pipeline(width, height);
+                pipeline.edge(edge).threads(threads).band_height(band_height).masked_blur(radius, mask.data());
+                Image output = run_pipeline(pipeline, input);
+                if (first_hash == 0) {
+                    first_hash = fnv1a(output);
+                    CHECK(max_difference(output, reference) <= 1, "masked edge=%d: off from blur(I*M)/blur(M) by %d",
+                          edge, max_difference(output, reference));
+                }
+                CHECK(fnv1a(output) == first_hash, "masked edge=%d: threads=%d band_height=%d changed it", edge,
+                      threads, band_height);
+            }
+        }
+    }
+
+    // an all valid mask is the plain blur
+    Image plain = synthetic_image(width, height, 12);
+    vector<uint8_t> valid(width * height, 255);
+    Pipeline blur(width, height), masked(width, height);
+    blur.edge(EDGE_CLAMP).blur(radius);
+    masked.edge(EDGE_CLAMP).masked_blur(radius, valid.data());
+    CHECK(max_difference(run_pipeline(masked, plain), run_pipeline(blur, plain)) <= 1,
+          "masked blur with a full mask is off from the blur by %d",
+          max_difference(run_pipeline(masked, plain), run_pipeline(blur, plain)));
+}
+
+// the background blur is the plain blur composited under the feathered subject, and the subject's core is
+// the input untouched
+static void test_background_blur() {
+    int width = 83, height = 57, radius = 5;
+    Image input = synthetic_image(width, height, 21);
+
+    vector<uint8_t> subject(width * height, 0);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int dx = x - 40, dy = y - 28;
+            subject[y * width + x] = dx * dx + dy * dy < 18 * 18 ? 255 : x > 75 ? 128 : 0;
+        }
+    }
+
+    for (int feather : {0, 3}) {
+        for (EdgeMode edge : {EDGE_ZERO, EDGE_CLAMP}) {
+            Pipeline plain(width, height);
+            plain.edge(edge).blur(radius);
+            Image blurred = run_pipeline(plain, input);
+
+            vector<float> kernel = gen_gaussian_kernel_1d(feather, default_sigma(feather));
+            Image reference(width * height);
+            vector<bool> core(width * height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    double t = 0;
+                    bool sharp = true;
+                    for (int dy = -feather; dy <= feather; dy++) {
+                        for (int dx = -feather; dx <= feather; dx++) {
+                            int sx = min(max(x + dx, 0), width - 1), sy = min(max(y + dy, 0), height - 1);
+                            int m = subject[sy * width + sx];
+                            t += (double)kernel[dy + feather] * kernel[dx + feather] * (255 - m) / 255;
+                            sharp = sharp && m == 255;
+                        }
+                    }
+                    core[y * width + x] = sharp;
+                    const uint8_t *p = (const uint8_t *)&input[y * width + x];
+                    const uint8_t *b = (const uint8_t *)&blurred[y * width + x];
+                    uint8_t *q = (uint8_t *)&reference[y * width + x];
+                    for (int ch = 0; ch < 3; ch++) {
+                        q[ch] = (uint8_t)(p[ch] + (b[ch] - p[ch]) * t + 0.5);
+                    }
+                }
+            }
+
+            uint64_t first_hash = 0;
+            for (int threads : {1, 3}) {
+                for (int band_height : {1, 5, 64}) {
+                    Pipeline pipeline(width, height);
+                    pipeline.edge(edge).threads(threads).band_height(band_height);
+                    pipeline.background_blur(radius, subject.data(), feather);
+                    Image output = run_pipeline(pipeline, input);
+                    if (first_hash == 0) {
+                        first_hash = fnv1a(output);
+                        CHECK(max_difference(output, reference) <= 1,
+                              "background feather=%d edge=%d: off from blur and composite by %d", feather, edge,
+                              max_difference(output, reference));
+                        bool kept = true;
+                        for (int i = 0; i < width * height; i++) {
+                            kept = kept && (!core[i] || memcmp(&output[i], &input[i], sizeof(Pixel)) == 0);
+                        }
+                        CHECK(kept, "background feather=%d edge=%d: the subject's core changed", feather, edge);
+                    }
+                    CHECK(fnv1a(output) == first_hash, "background feather=%d edge=%d: threads=%d band_height=%d "
+                          "changed it", feather, edge, threads, band_height);
+                }
+            }
+        }
+    }
+}
+
+// bloom only ever adds light, spreads it about as far as the radius and does nothing below the threshold
+static void test_bloom() {
+    CHECK(bloom_levels(1000, 1000, 4) == 1 && bloom_levels(1000, 1000, 100) == 5, "bloom levels %d and %d",
+          bloom_levels(1000, 1000, 4), bloom_levels(1000, 1000, 100));
+    CHECK(bloom_levels(40, 9, 1000) == 2, "bloom levels of a small frame %d", bloom_levels(40, 9, 1000));
+    CHECK(bloom_levels(1, 1, 1000) == 1 && bloom_levels(3, 7, 1000) == 1, "bloom levels of a tiny frame %d and %d",
+          bloom_levels(1, 1, 1000), bloom_levels(3, 7, 1000));
+
+    // frames smaller than the downscale factor, one pixel bright enough to glow
+    for (int size : {1, 2, 3}) {
+        Image tiny = synthetic_image(size, size, 17), glowing(tiny.size());
+        tiny[0] = {255, 255, 255};
+        bloom(size, size, tiny.data(), glowing.data(), 9, 100.0f, 1.0f, 2, 4, EDGE_CLAMP);
+        CHECK(glowing[0].green == 255, "bloom of a %dx%d frame lost its light", size, size);
+    }
+
+    int width = 97, height = 81, radius = 24;
+    Image input = synthetic_image(width, height, 31);
+    for (Pixel &p : input) {
+        p = {(uint8_t)(p.red / 4), (uint8_t)(p.green / 4), (uint8_t)(p.blue / 4)};
+    }
+    for (int y = 36; y < 44; y++) {
+        for (int x = 44; x < 52; x++) {
+            input[y * width + x] = {255, 255, 255};
+        }
+    }
+
+    uint64_t first_hash = 0;
+    for (int threads : {1, 3}) {
+        for (int band_height : {1, 8, 81}) {
+            Image output(width * height);
+            bloom(width, height, input.data(), output.data(), radius, 100.0f, 1.0f, threads, band_height, EDGE_CLAMP);
+            if (first_hash == 0) {
+                first_hash = fnv1a(output);
+
+                bool brighter = true;
+                const uint8_t *in = (const uint8_t *)input.data(), *out = (const uint8_t *)output.data();
+                for (size_t i = 0; i < input.size() * sizeof(Pixel); i++) {
+                    brighter = brighter && out[i] >= in[i];
+                }
+                CHECK(brighter, "bloom made a pixel darker");
+
+                // the glow half the radius from the square and none of it in the corners
+                int near = output[40 * width + 60].green - input[40 * width + 60].green;
+                int far = output[2 * width + 2].green - input[2 * width + 2].green;
+                CHECK(near >= 4 && far <= 1, "bloom glow %d near the light, %d in the corner", near, far);
+            }
+            CHECK(fnv1a(output) == first_hash, "bloom threads=%d band_height=%d changed the output", threads,
+                  band_height);
+        }
+    }
+
+    // nothing is above a threshold of 255 and an intensity of 0 adds nothing
+    Image output(width * height);
+    bloom(width, height, input.data(), output.data(), radius, 255.0f, 1.0f, 2, 16, EDGE_ZERO);
+    CHECK(fnv1a(output) == fnv1a(input), "bloom above every pixel changed the image");
+    bloom(width, height, input.data(), output.data(), radius, 0.0f, 0.0f, 2, 16, EDGE_ZERO);
+    CHECK(fnv1a(output) == fnv1a(input), "bloom of intensity 0 changed the image");
+}
+
+// The guided filter written out the slow way in doubles: every window's mean summed pixel by pixel with the
+// coordinates clamped, a and b from them, and a and b averaged over the windows again.
+static vector<uint8_t> reference_guided(int width, int height, const uint8_t *input, int channels,
+                                        const Pixel *guide, int radius, double eps) {
+    auto window_mean = [&](const vector<double> &values, int x, int y) {
+        double sum = 0;
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                int sx = min(max(x + dx, 0), width - 1), sy = min(max(y + dy, 0), height - 1);
+                sum += values[sy * width + sx];
+            }
+        }
+        return sum / ((2 * radius + 1) * (2 * radius + 1));
+    };
+
+    size_t pixels = (size_t)width * height;
+    vector<double> guide_values(pixels), guide_squares(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t *c = (const uint8_t *)&guide[i];
+        guide_values[i] = (0.114 * c[0] + 0.587 * c[1] + 0.299 * c[2]) / 255;
+        guide_squares[i] = guide_values[i] * guide_values[i];
+    }
+
+    vector<uint8_t> output(pixels * channels);
+    for (int c = 0; c < channels; c++) {
+        vector<double> values(pixels), products(pixels), a(pixels), b(pixels);
+        for (size_t i = 0; i < pixels; i++) {
+            values[i] = input[i * channels + c] / 255.0;
+            products[i] = values[i] * guide_values[i];
+        }
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                double mean_guide = window_mean(guide_values, x, y), mean_value = window_mean(values, x, y);
+                double variance = window_mean(guide_squares, x, y) - mean_guide * mean_guide;
+                double covariance = window_mean(products, x, y) - mean_guide * mean_value;
+                a[y * width + x] = covariance / (variance + eps);
+                b[y * width + x] = mean_value - a[y * width + x] * mean_guide;
+            }
+        }
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t i = (size_t)y * width + x;
+                double q = (window_mean(a, x, y) * guide_values[i] + window_mean(b, x, y)) * 255;
+                output[i * channels + c] = (uint8_t)min(max(q + 0.5, 0.0), 255.0);
+            }
+        }
+    }
+    return output;
+}
+
+// guided filtering matches the slow reference within a level, keeps a step edge and flattens the noise beside it
+static void test_guided_filter() {
+    int width = 37, height = 29;
+    Image input = synthetic_image(width, height, 5);
+    for (int radius : {1, 4}) {
+        for (float eps : {0.001f, 0.04f}) {
+            vector<uint8_t> bytes = reference_guided(width, height, (const uint8_t *)input.data(), 3, input.data(),
+                                                     radius, eps);
+            Image expected((Pixel *)bytes.data(), (Pixel *)bytes.data() + input.size());
+            uint64_t first_hash = 0;
+            for (int threads : {1, 3, 7}) {
+                Image output(input.size());
+                guided_filter(width, height, input.data(), input.data(), output.data(), radius, eps, threads);
+                first_hash = first_hash ? first_hash : fnv1a(output);
+                CHECK(fnv1a(output) == first_hash, "guided r=%d threads=%d changed the output", radius, threads);
+                CHECK(max_difference(output, expected) <= 1, "guided r=%d eps=%g is %d off the reference", radius,
+                      eps, max_difference(output, expected));
+            }
+        }
+    }
+
+    // a matte refined against the image it was cut from
+    vector<uint8_t> matte(input.size()), refined(input.size());
+    for (size_t i = 0; i < matte.size(); i++) {
+        matte[i] = (i % width) < (size_t)width / 2 ? 255 : 0;
+    }
+    guided_filter_plane(width, height, matte.data(), input.data(), refined.data(), 3, 0.01f, 2);
+    vector<uint8_t> expected = reference_guided(width, height, matte.data(), 1, input.data(), 3, 0.01);
+    int plane_diff = 0;
+    for (size_t i = 0; i < matte.size(); i++) {
+        plane_diff = max(plane_diff, abs(refined[i] - expected[i]));
+    }
+    CHECK(plane_diff <= 1, "guided matte is %d off the reference", plane_diff);
+
+    // a grey step with noise on both sides, far below the step's variance
+    Image step(width * height);
+    uint32_t state = 1;
+    for (int i = 0; i < width * height; i++) {
+        state = state * 1664525u + 1013904223u;
+        uint8_t level = (uint8_t)((i % width < width / 2 ? 60 : 200) + (int)(state >> 29) - 4);
+        step[i] = {level, level, level};
+    }
+    Image smooth(step.size());
+    guided_filter(width, height, step.data(), step.data(), smooth.data(), 4, 0.001f, 2);
+    int row = height / 2 * width, spread = 0;
+    for (int x = 0; x < width / 2 - 5; x++) {
+        spread = max(spread, abs(smooth[row + x].green - smooth[row].green));
+    }
+    int edge = smooth[row + width / 2].green - smooth[row + width / 2 - 1].green;
+    CHECK(spread <= 2 && edge >= 120, "guided step: noise spread %d, edge %d", spread, edge);
+}
+
+// non-local means the slow way, every patch distance summed pixel by pixel with the coordinates clamped
+static Image reference_nl_means(int width, int height, const Image &input, double sigma, int search, int patch) {
+    auto at = [&](int x, int y) {
+        return (const uint8_t *)&input[min(max(y, 0), height - 1) * width + min(max(x, 0), width - 1)];
+    };
+    double h = NL_MEANS_H * sigma, patch_size = 3.0 * (2 * patch + 1) * (2 * patch + 1);
+
+    Image output(input.size());
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double sums[3] = {0, 0, 0}, total = 0;
+            for (int dy = -search; dy <= search; dy++) {
+                for (int dx = -search; dx <= search; dx++) {
+                    double distance = 0;
+                    for (int py = -patch; py <= patch; py++) {
+                        for (int px = -patch; px <= patch; px++) {
+                            const uint8_t *a = at(x + px, y + py), *b = at(x + dx + px, y + dy + py);
+                            for (int c = 0; c < 3; c++) {
+                                distance += (a[c] - b[c]) * (a[c] - b[c]);
+                            }
+                        }
+                    }
+                    double weight = exp(-max(distance / patch_size - 2 * sigma * sigma, 0.0) / (h * h));
+                    const uint8_t *b = at(x + dx, y + dy);
+                    for (int c = 0; c < 3; c++) {
+                        sums[c] += weight * b[c];
+                    }
+                    total += weight;
+                }
+            }
+            uint8_t *dst = (uint8_t *)&output[y * width + x];
+            for (int c = 0; c < 3; c++) {
+                dst[c] = (uint8_t)min(sums[c] / total + 0.5, 255.0);
+            }
+        }
+    }
+    return output;
+}
+
+// non-local means matches the slow reference within a level whatever the split, and brings a noisy pattern
+// closer to the clean one
+static void test_nl_means() {
+    int width = 45, height = 38;
+    Image clean(width * height), noisy(clean.size());
+    uint32_t state = 3;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t level = ((x / 6 + y / 6) % 2) ? 180 : 70;
+            clean[y * width + x] = {level, (uint8_t)(level - 30), (uint8_t)(255 - level)};
+            const uint8_t *c = (const uint8_t *)&clean[y * width + x];
+            uint8_t *n = (uint8_t *)&noisy[y * width + x];
+            for (int k = 0; k < 3; k++) {
+                state = state * 1664525u + 1013904223u;
+                n[k] = (uint8_t)min(max(c[k] + (int)(state >> 27) - 16, 0), 255);
+            }
+        }
+    }
+
+    for (int patch : {1, 2}) {
+        Image expected = reference_nl_means(width, height, noisy, 10.0, 3, patch);
+        uint64_t first_hash = 0;
+        for (int threads : {1, 2, 5}) {
+            Image output(noisy.size());
+            nl_means(width, height, noisy.data(), output.data(), 10.0f, 3, patch, threads);
+            first_hash = first_hash ? first_hash : fnv1a(output);
+            CHECK(fnv1a(output) == first_hash, "nl means patch=%d threads=%d changed the output", patch, threads);
+            CHECK(max_difference(output, expected) <= 1, "nl means patch=%d is %d off the reference", patch,
+                  max_difference(output, expected));
+        }
+    }
+
+    // the mean error against the clean pattern at least halves
+    Image output(noisy.size());
+    nl_means(width, height, noisy.data(), output.data(), 10.0f, 5, 1, 2);
+    double before = 0, after = 0;
+    for (size_t i = 0; i < clean.size() * 3; i++) {
+        int c = ((const uint8_t *)clean.data())[i];
+        before += abs(((const uint8_t *)noisy.data())[i] - c);
+        after += abs(((const uint8_t *)output.data())[i] - c);
+    }
+    CHECK(after * 2 <= before, "nl means error %.0f after against %.0f before", after, before);
+
+    // a sigma of 0 only averages identical patches, a flat image then stays as it is
+    Image flat(width * height, Pixel{12, 34, 56});
+    nl_means(width, height, flat.data(), output.data(), 0.0f, 2, 1, 3);
+    CHECK(fnv1a(output) == fnv1a(flat), "nl means changed a flat image");
+}
+
+// a control only watches: the output stays the same, progress ends at the total and a cancelled job stops
+static void test_job_control() {
+    int width = 29, height = 23;
+    Image input = synthetic_image(width, height, 5);
+    BMPHeader header = make_bmp_header(width, height);
+    auto kernel = gen_gaussian_kernel(3);
+
+    for (int threads : THREAD_COUNTS) {
+        JobControl control;
+        control.set_total(width * height);
+        Image output(width * height);
+        bool finished = blur_image(header, input.data(), output.data(), kernel, threads, EDGE_CLAMP, &control);
+        CHECK(finished && control.done() == control.total(), "exact threads=%d: done %lld of %lld", threads,
+              control.done(), control.total());
+        CHECK(fnv1a(output) == fnv1a(run_exact(input, width, height, 3, EDGE_CLAMP, 1)),
+              "exact threads=%d: the control changed the output", threads);
+
+        JobControl cancelled;
+        cancelled.cancel();
+        finished = blur_image(header, input.data(), output.data(), kernel, threads, EDGE_CLAMP, &cancelled);
+        CHECK(!finished && cancelled.done() == 0, "exact threads=%d: a cancelled job still ran", threads);
+
+        for (int band_height : {1, 5, 64}) {
+            Pipeline plain(width, height);
+            plain.threads(threads).band_height(band_height).blur(3).downscale(2);
+
+            JobControl watched;
+            watched.set_total(plain.output_width() * plain.output_height());
+            Pipeline pipeline = plain;
+            pipeline.control(&watched);
+            Image result(pipeline.output_width() * pipeline.output_height());
+            finished = pipeline.run(input.data(), result.data());
+            CHECK(finished && watched.done() == watched.total() && watched.fraction() == 1.0,
+                  "pipeline threads=%d band_height=%d: done %lld of %lld", threads, band_height, watched.done(),
+                  watched.total());
+            CHECK(fnv1a(result) == fnv1a(run_pipeline(plain, input)),
+                  "pipeline threads=%d band_height=%d: the control changed the output", threads, band_height);
+
+            JobControl stopped;
+            stopped.cancel();
+            pipeline.control(&stopped);
+            CHECK(!pipeline.run(input.data(), result.data()) && stopped.done() == 0,
+                  "pipeline threads=%d band_height=%d: a cancelled job still ran", threads, band_height);
+        }
+    }
+}
+
+// the cheap backends only approximate the gaussian, but must stay close to it and never depend on threads
+static void test_approx_backends() {
+    int width = 61, height = 47;
+    Image input = synthetic_image(width, height, 17);
+    const Backend backends[] = {BACKEND_BOX, BACKEND_STACK, BACKEND_PYRAMID, BACKEND_KAWASE};
+    const double tolerances[] = {2.5, 2.5, 2.0, 4.0};
+
+    for (int i = 0; i < 4; i++) {
+        for (int radius : {1, 5, 9, 15}) {
+            Image reference = run_exact(input, width, height, radius, EDGE_CLAMP, 1);
+            uint64_t first_hash = 0;
+
+            for (int threads : THREAD_COUNTS) {
+                JobControl control;
+                Image output(width * height);
+                bool finished = run_backend(backends[i], width, height, input.data(), output.data(), radius, threads,
+                                            5, EDGE_CLAMP, &control);
+                CHECK(finished && control.done() == control.total(), "%s r=%d threads=%d: done %lld of %lld",
+                      backend_name(backends[i]), radius, threads, control.done(), control.total());
+
+                double diff = mean_difference(output, reference);
+                CHECK(diff <= tolerances[i], "%s r=%d: off from the gaussian by %.2f on average",
+                      backend_name(backends[i]), radius, diff);
+
+                uint64_t hash = fnv1a(output);
+                if (threads == THREAD_COUNTS[0]) {
+                    first_hash = hash;
+                }
+                CHECK(hash == first_hash, "%s r=%d: threads=%d changed the output", backend_name(backends[i]),
+                      radius, threads);
+            }
+
+            JobControl cancelled;
+            cancelled.cancel();
+            Image output(width * height);
+            CHECK(!run_backend(backends[i], width, height, input.data(), output.data(), radius, 2, 5, EDGE_CLAMP,
+                               &cancelled),
+                  "%s r=%d: a cancelled job still finished", backend_name(backends[i]), radius);
+        }
+    }
+
+    // The binomial fast path covers the small radii. Its variance matches but at sigma < 1 the shape can't,
+    // which shows on the pixel wide checks and noise here (on photos the mean difference is about half a level).
+    for (int radius = 2; radius <= 4; radius++) {
+        CHECK(backend_supports(BACKEND_BINOMIAL, radius), "binomial should take radius %d", radius);
+        Image reference = run_exact(input, width, height, radius, EDGE_CLAMP, 1);
+        uint64_t first_hash = 0;
+        for (int threads : THREAD_COUNTS) {
+            Image output(width * height);
+            run_backend(BACKEND_BINOMIAL, width, height, input.data(), output.data(), radius, threads, 5, EDGE_CLAMP);
+            CHECK(mean_difference(output, reference) <= 6.0, "binomial r=%d: off from the gaussian by %.2f", radius,
+                  mean_difference(output, reference));
+            if (threads == THREAD_COUNTS[0]) {
+                first_hash = fnv1a(output);
+            }
+            CHECK(fnv1a(output) == first_hash, "binomial r=%d: threads=%d changed the output", radius, threads);
+        }
+    }
+    CHECK(!backend_supports(BACKEND_BINOMIAL, 5), "binomial sums overflow 16 bits past radius 4");
+
+    // radius 1 rounds to m = 0, a copy, so the default for it stays the exact blur and really blurs
+    CHECK(!backend_supports(BACKEND_BINOMIAL, 1), "binomial shouldn't take radius 1");
+    CHECK(default_backend(1) == BACKEND_EXACT && default_backend(3) == BACKEND_BINOMIAL &&
+              default_backend(5) == BACKEND_EXACT,
+          "default backends %s, %s and %s", backend_name(default_backend(1)), backend_name(default_backend(3)),
+          backend_name(default_backend(5)));
+    {
+        Image output(width * height);
+        run_backend(default_backend(1), width, height, input.data(), output.data(), 1, 2, 5, EDGE_ZERO);
+        CHECK(fnv1a(output) != fnv1a(input), "the default radius 1 blur left the image as it was");
+    }
+
+    // the pieces add up to the gaussian's variance
+    for (double sigma : {1.0, 2.0, 5.0, 20.0}) {
+        double box = 0, stack = 0, kawase = 0;
+        for (int r : box_radii(sigma)) {
+            box += ((2 * r + 1) * (2 * r + 1) - 1) / 12.0;
+        }
+        for (int r : stack_radii(sigma)) {
+            stack += r * (r + 2) / 6.0;
+        }
+        for (int d : kawase_offsets(sigma)) {
+            kawase += (d * d + (d + 1) * (d + 1)) / 2.0;
+        }
+        CHECK(fabs(box - sigma * sigma) <= 0.1 * sigma * sigma + 0.5, "box variance %.2f for sigma %.1f", box, sigma);
+        CHECK(fabs(stack - sigma * sigma) <= 0.1 * sigma * sigma + 0.5, "stack variance %.2f for sigma %.1f", stack,
+              sigma);
+        CHECK(fabs(kawase - sigma * sigma) <= 0.5, "kawase variance %.2f for sigma %.1f", kawase, sigma);
+    }
+
+    // the stack blur's integer rounding keeps a flat image flat, even past the widest single pass
+    for (int radius : {3, 200, 500}) {
+        Image flat(17 * 9), output(flat.size());
+        for (Pixel &p : flat) {
+            p.red = 255;
+            p.green = 1;
+            p.blue = 128;
+        }
+        stack_blur(17, 9, flat.data(), output.data(), default_sigma(radius), 3, EDGE_CLAMP);
+        CHECK(fnv1a(output) == fnv1a(flat), "stack blur r=%d changed a flat image", radius);
+    }
+}
+
+// blurring one plane is the stack blur of a grey image, channel for channel
+static void test_stack_plane() {
+    int width = 53, height = 29;
+    Image grey = synthetic_image(width, height, 41);
+    vector<uint8_t> plane(width * height);
+    for (int i = 0; i < width * height; i++) {
+        plane[i] = grey[i].blue;
+        grey[i] = {grey[i].blue, grey[i].blue, grey[i].blue};
+    }
+
+    for (double sigma : {0.2, 1.0, 4.0, 60.0}) {
+        for (EdgeMode edge : {EDGE_ZERO, EDGE_CLAMP}) {
+            Image reference(width * height);
+            stack_blur(width, height, grey.data(), reference.data(), sigma, 1, edge);
+            for (int threads : {1, 3}) {
+                vector<uint8_t> output(width * height);
+                stack_blur_plane(width, height, plane.data(), output.data(), sigma, threads, edge);
+                bool same = true;
+                for (int i = 0; i < width * height; i++) {
+                    same = same && output[i] == reference[i].green;
+                }
+                CHECK(same, "stack plane sigma=%.1f edge=%d threads=%d differs from the pixel blur", sigma, edge,
+                      threads);
+            }
+        }
+    }
+}
+
+static void test_cost_model() {
+    for (int i = 0; i < BACKEND_COUNT; i++) {
+        Backend parsed = BACKEND_EXACT;
+        CHECK(parse_backend(backend_name((Backend)i), parsed) && parsed == i, "backend %d does not parse back", i);
+    }
+    Backend unknown;
+    CHECK(!parse_backend("gaussian", unknown), "an unknown backend parsed");
+
+    CostModel model = calibrate_cost_model(4);
+    CHECK(model.exact_tap > 0 && model.separable_tap > 0 && model.box_pixel > 0 && model.stack_pixel > 0 &&
+              model.resize_pixel > 0 &&
+              model.kawase_pass_pixel > 0,
+          "a calibrated cost is zero");
+
+    // the exact blur grows with the radius squared, the box blur not at all
+    double exact_small = predict_seconds(model, BACKEND_EXACT, 1000, 1000, 5, 32);
+    double exact_large = predict_seconds(model, BACKEND_EXACT, 1000, 1000, 50, 32);
+    CHECK(exact_large > 50 * exact_small, "exact r=50 predicted only %.1fx r=5", exact_large / exact_small);
+    CHECK(predict_seconds(model, BACKEND_BOX, 1000, 1000, 50, 32) < exact_large, "box predicted slower than exact");
+
+    // all the time in the world gets the exact blur, none at all the fastest prediction
+    CHECK(choose_backend(model, 1000, 1000, 20, 32, 1e9) == BACKEND_EXACT, "an unlimited budget is not exact");
+    Backend fastest = choose_backend(model, 1000, 1000, 20, 32, 0.0);
+    for (int i = 0; i < BACKEND_COUNT; i++) {
+        CHECK(predict_seconds(model, fastest, 1000, 1000, 20, 32) <=
+                  predict_seconds(model, (Backend)i, 1000, 1000, 20, 32),
+              "no budget picked %s over the faster %s", backend_name(fastest), backend_name((Backend)i));
+    }
+
+    // and a budget between two predictions the better backend that fits
+    double separable = predict_seconds(model, BACKEND_SEPARABLE, 1000, 1000, 20, 32);
+    Backend chosen = choose_backend(model, 1000, 1000, 20, 32, separable * 1.01);
+    CHECK(chosen == BACKEND_SEPARABLE || chosen == BACKEND_EXACT, "a budget that fits separable got %s",
+          backend_name(chosen));
+}
+
+// save_image followed by load_image must give back the same pixels whatever the row padding
+static void test_bmp_round_trip() {
+    for (int width = 1; width <= 8; width++) {
+        int height = 3;
+        Image image = synthetic_image(width, height, width);
+        BMPHeader header = make_bmp_header(width, height);
+        string path = "blur_tests_round_trip.bmp";
+
+        ofstream out(path, ios::binary);
+        save_image(out, header, image.data());
+        out.close();
+
+        ifstream in(path, ios::binary);
+        BMPHeader loaded_header;
+        bool ok = read_bmp_file(in, loaded_header);
+        CHECK(ok, "width %d: header did not read back", width);
+        if (!ok) {
+            continue;
+        }
+
+        Image loaded(width * height);
+        load_image(in, loaded_header, loaded.data());
+        in.close();
+        remove(path.c_str());
+
+        CHECK(loaded_header.biWidth == (uint32_t)width && loaded_header.biHeight == (uint32_t)height,
+              "width %d: wrong size read back", width);
+        CHECK(fnv1a(loaded) == fnv1a(image), "width %d: pixels changed on the round trip", width);
+    }
+}
+
+// the mapped path, padding of 0 to 3 bytes (width * 3 % 4 is 0, 3, 2, 1 for widths 4, 5, 6, 7)
+static void test_bmp_mapped_round_trip() {
+    string path = "blur_tests_mapped.bmp";
+
+    for (int width = 1; width <= 12; width++) {
+        int height = 5;
+        int stride = bmp_row_stride(width);
+        Image image = synthetic_image(width, height, width * 3);
+        BMPHeader header = make_bmp_header(width, height);
+        CHECK(save_image(path, header, image.data()), "width %d: mapped save failed", width);
+
+        bool ok;
+        Image loaded(width * height);
+        {
+            MappedFile file(path);
+            BMPHeader loaded_header;
+            ok = read_bmp_file(file, loaded_header);
+            CHECK(ok && file.size() == sizeof(BMPHeader) + (size_t)stride * height, "width %d: wrong file size",
+                  width);
+            if (!ok) {
+                continue;
+            }
+
+            bool zeroed = true;
+            for (int y = 0; y < height; y++) {
+                for (int i = width * 3; i < stride; i++) {
+                    zeroed = zeroed && file.data()[sizeof(BMPHeader) + y * stride + i] == 0;
+                }
+            }
+            CHECK(zeroed, "width %d: row padding is not zero", width);
+            load_image(file, loaded_header, loaded.data());
+        }
+        CHECK(fnv1a(loaded) == fnv1a(image), "width %d: pixels changed on the mapped round trip", width);
+
+        // the stream reader must agree with the mapped writer
+        ifstream in(path, ios::binary);
+        BMPHeader stream_header;
+        Image streamed(width * height);
+        if (read_bmp_file(in, stream_header)) {
+            load_image(in, stream_header, streamed.data());
+        }
+        CHECK(fnv1a(streamed) == fnv1a(image), "width %d: stream load of a mapped save differs", width);
+    }
+
+    // a pixel array cut short is an error, not a read past the mapping
+    {
+        ofstream out(path, ios::binary);
+        BMPHeader header = make_bmp_header(7, 7);
+        out.write((const char *)&header, sizeof(header));
+        out << string(7 * 7 * 3, 'x');
+    }
+    MappedFile file(path);
+    BMPHeader header;
+    streambuf *stderr_buffer = cerr.rdbuf(NULL);  // the error message is expected, keep it out of the log
+    bool accepted = read_bmp_file(file, header);
+    cerr.rdbuf(stderr_buffer);
+    cerr.clear();
+    CHECK(!accepted, "a truncated file was accepted");
+    remove(path.c_str());
+}
+
+// an 8-bit mask goes through its palette, a 24-bit one is the grey of each pixel
+static void test_mask_file() {
+    string path = "blur_tests_mask.bmp";
+    int width = 5, height = 3, stride = 8;
+
+    {
+        BMPHeader header = make_bmp_header(width, height);
+        header.biBitCount = 8;
+        header.biClrUsed = 256;
+        header.bfOffBits = sizeof(BMPHeader) + 256 * 4;
+        header.biSizeImage = stride * height;
+        header.bfSize = header.bfOffBits + header.biSizeImage;
+        ofstream out(path, ios::binary);
+        out.write((const char *)&header, sizeof(header));
+        for (int i = 0; i < 256; i++) {
+            uint8_t grey = 255 - i, entry[4] = {grey, grey, grey, 0};
+            out.write((const char *)entry, 4);
+        }
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < stride; x++) {
+                out.put((char)(x < width ? y * width + x : 0));
+            }
+        }
+    }
+    {
+        MappedFile file(path);
+        vector<uint8_t> mask;
+        bool ok = load_mask(file, width, height, mask);
+        CHECK(ok, "8-bit mask was rejected");
+        for (int i = 0; ok && i < width * height; i++) {
+            CHECK(mask[i] == 255 - i, "8-bit mask pixel %d is %d, not %d", i, mask[i], 255 - i);
+        }
+
+        streambuf *stderr_buffer = cerr.rdbuf(NULL);  // the error message is expected, keep it out of the log
+        bool accepted = load_mask(file, width + 1, height, mask);
+        cerr.rdbuf(stderr_buffer);
+        cerr.clear();
+        CHECK(!accepted, "a mask of the wrong size was accepted");
+    }
+
+    Image image(width * height, Pixel{30, 60, 90});
+    save_image(path, make_bmp_header(width, height), image.data());
+    {
+        MappedFile file(path);
+        vector<uint8_t> mask;
+        CHECK(load_mask(file, width, height, mask) && mask[7] == 60, "24-bit mask is not the grey of its pixels");
+    }
+    remove(path.c_str());
+}
+
+// the alpha goes out in a 32-bit layer or an 8-bit mask and comes back the same, a 24-bit file has none
+static void test_alpha_files() {
+    string path = "blur_tests_alpha.bmp";
+    int width = 7, height = 4;
+    vector<uint8_t> alpha(width * height);
+    for (size_t i = 0; i < alpha.size(); i++) {
+        alpha[i] = i * 37;
+    }
+
+    CHECK(save_tinted(path, width, height, alpha.data(), Pixel{1, 2, 3}), "tinted save failed");
+    {
+        MappedFile file(path);
+        BMPHeader header;
+        vector<uint8_t> loaded;
+        CHECK(load_alpha(file, header, loaded) && loaded == alpha, "alpha changed on the tinted round trip");
+        CHECK(file.size() > 60 && file.data()[header.bfOffBits + 4] == 1 && file.data()[header.bfOffBits + 6] == 3,
+              "tinted pixels aren't the tint");
+    }
+
+    CHECK(save_mask(path, width, height, alpha.data()), "mask save failed");
+    {
+        MappedFile file(path);
+        vector<uint8_t> loaded;
+        CHECK(load_mask(file, width, height, loaded) && loaded == alpha, "alpha changed on the mask round trip");
+    }
+
+    Image image(width * height);
+    save_image(path, make_bmp_header(width, height), image.data());
+    {
+        MappedFile file(path);
+        BMPHeader header;
+        vector<uint8_t> loaded;
+        streambuf *stderr_buffer = cerr.rdbuf(NULL);  // the error message is expected, keep it out of the log
+        bool accepted = load_alpha(file, header, loaded);
+        cerr.rdbuf(stderr_buffer);
+        cerr.clear();
+        CHECK(!accepted, "a 24-bit file was read for its alpha");
+    }
+    remove(path.c_str());
+}
+
+// every format must survive encode -> decode even when the bytes arrive a few at a time
+static void test_codec_round_trip() {
+    for (ImageFormat format : {FORMAT_BMP, FORMAT_PPM, FORMAT_QOI}) {
+        for (auto &size : SIZES) {
+            int width = size[0], height = size[1];
+            Image image = synthetic_image(width, height, width + height);
+            // flat runs so the QOI run and index ops get exercised as well
+            for (int i = 0; i < width * height / 3; i++) {
+                image[i] = image[0];
+            }
+
+            StreamEncoder encoder(format, width, height);
+            string encoded;
+            encoder.header(encoded);
+            for (int y = 0; y < height; y += 2) {
+                encoder.rows(image.data(), y, min(y + 2, height), encoded);
+            }
+            encoder.finish(encoded);
+
+            Image decoded;
+            StreamDecoder decoder([&](int w, int h) {
+                decoded.resize(w * h);
+                return decoded.data();
+            });
+            bool ok = true;
+            for (size_t i = 0, step = 1; ok && i < encoded.size(); i += step, step = step % 7 + 1) {
+                ok = decoder.feed((const uint8_t *)encoded.data() + i, min(step, encoded.size() - i));
+            }
+
+            CHECK(ok && decoder.done(), "format %d %dx%d: decode failed: %s", format, width, height,
+                  decoder.error().c_str());
+            CHECK(decoder.format() == format && decoder.width() == width && decoder.height() == height,
+                  "format %d %dx%d: wrong header decoded", format, width, height);
+            CHECK(decoded.size() == image.size() && fnv1a(decoded) == fnv1a(image),
+                  "format %d %dx%d: pixels changed on the round trip", format, width, height);
+        }
+    }
+}
+
+// every vector width must give the scalar bytes, including rows whose length isn't a multiple of it
+static void test_simd_kernels() {
+    vector<float> src(200), kernel = gen_gaussian_kernel_1d(5, 2.0);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = (i * 37 % 256) + 0.25f * (i % 3);
+    }
+    const RowKernels &scalar = row_kernels(SIMD_SCALAR);
+
+    for (SimdLevel level : {SIMD_SSE, SIMD_AVX2, SIMD_AVX512}) {
+        if (!simd_supported(level)) {
+            continue;
+        }
+        const RowKernels &kernels = row_kernels(level);
+
+        for (int count = 0; count <= 70; count++) {
+            for (int radius : {0, 1, 5}) {
+                vector<float> expected(count + 1, -1.0f), actual(count + 1, -1.0f);
+                int offset = radius * 3;
+                scalar.convolve(src.data() + offset, expected.data(), count, kernel.data() + 5 - radius, radius, 3);
+                kernels.convolve(src.data() + offset, actual.data(), count, kernel.data() + 5 - radius, radius, 3);
+                CHECK(memcmp(expected.data(), actual.data(), actual.size() * sizeof(float)) == 0,
+                      "%s convolve count=%d radius=%d differs from scalar", simd_level_name(level), count, radius);
+            }
+
+            vector<float> expected(src.begin(), src.begin() + count + 1), actual = expected;
+            scalar.add_scaled(expected.data(), src.data() + 50, 0.3f, count);
+            kernels.add_scaled(actual.data(), src.data() + 50, 0.3f, count);
+            CHECK(memcmp(expected.data(), actual.data(), actual.size() * sizeof(float)) == 0,
+                  "%s add_scaled count=%d differs from scalar", simd_level_name(level), count);
+
+            expected.assign(src.begin(), src.begin() + count + 1);
+            actual = expected;
+            scalar.multiply_add(expected.data(), src.data() + 50, src.data() + 120, count);
+            kernels.multiply_add(actual.data(), src.data() + 50, src.data() + 120, count);
+            CHECK(memcmp(expected.data(), actual.data(), actual.size() * sizeof(float)) == 0,
+                  "%s multiply_add count=%d differs from scalar", simd_level_name(level), count);
+        }
+
+        // pixel format conversions, every length up to a few registers so each tail case comes up
+        vector<uint8_t> bytes(80 * 4);
+        vector<float> floats(bytes.size());
+        for (size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = i * 73 + 11;
+            floats[i] = (int)(i % 300) - 20 + (i % 4) * 0.25f;
+        }
+        for (int pixels = 0; pixels <= 70; pixels++) {
+            int count = pixels * 3;
+            vector<float> expected_f(count + 1, -1.0f), actual_f = expected_f;
+            scalar.bytes_to_floats(bytes.data(), expected_f.data(), count);
+            kernels.bytes_to_floats(bytes.data(), actual_f.data(), count);
+            CHECK(expected_f == actual_f, "%s bytes_to_floats count=%d", simd_level_name(level), count);
+
+            vector<uint8_t> expected(pixels * 4 + 1, 7), actual = expected;
+            scalar.floats_to_bytes(floats.data(), expected.data(), count);
+            kernels.floats_to_bytes(floats.data(), actual.data(), count);
+            CHECK(expected == actual, "%s floats_to_bytes count=%d", simd_level_name(level), count);
+
+            // the product wraps past 2^31, which the shift must treat as unsigned
+            vector<int32_t> sums(count * 3 + 1);
+            for (size_t i = 0; i < sums.size(); i++) {
+                sums[i] = 4000000 + i * 1013 % 70000;
+            }
+            vector<int32_t> sums_actual = sums;
+            expected.assign(count + 1, 7);
+            actual = expected;
+            scalar.stack_step(bytes.data(), bytes.data() + 5, bytes.data() + 9, sums.data(), sums.data() + count,
+                              sums.data() + 2 * count, expected.data(), count, 1000, 24);
+            kernels.stack_step(bytes.data(), bytes.data() + 5, bytes.data() + 9, sums_actual.data(),
+                               sums_actual.data() + count, sums_actual.data() + 2 * count, actual.data(), count, 1000,
+                               24);
+            CHECK(expected == actual && sums == sums_actual, "%s stack_step count=%d", simd_level_name(level), count);
+
+            for (int radius = 0; radius <= MAX_BINOMIAL_RADIUS; radius++) {
+                vector<uint16_t> scratch(count + 2 * radius * 3 + 1);
+                expected.assign(count + 1, 7);
+                actual = expected;
+                scalar.binomial_row(bytes.data(), expected.data(), scratch.data(), count, radius, 3);
+                kernels.binomial_row(bytes.data(), actual.data(), scratch.data(), count, radius, 3);
+                CHECK(expected == actual, "%s binomial_row count=%d radius=%d", simd_level_name(level), count,
+                      radius);
+
+                // a few rows through the cascade, the last one has seen 2 radius before it
+                vector<uint16_t> levels(2 * radius * count + 1, 0), levels_actual = levels;
+                for (int row = 0; row <= 2 * radius; row++) {
+                    scalar.binomial_step(bytes.data() + row * 7, levels.data(), expected.data(), count, radius);
+                    kernels.binomial_step(bytes.data() + row * 7, levels_actual.data(), actual.data(), count, radius);
+                }
+                CHECK(expected == actual && levels == levels_actual, "%s binomial_step count=%d radius=%d",
+                      simd_level_name(level), count, radius);
+            }
+
+            vector<uint8_t> planes(pixels * 3 + 3, 7);
+            uint8_t *c0 = planes.data(), *c1 = c0 + pixels + 1, *c2 = c1 + pixels + 1;
+            kernels.rgb_to_planar(bytes.data(), c0, c1, c2, pixels);
+            bool split = planes[pixels] == 7 && planes[2 * pixels + 1] == 7 && planes.back() == 7;
+            for (int i = 0; i < pixels; i++) {
+                split = split && c0[i] == bytes[i * 3] && c1[i] == bytes[i * 3 + 1] && c2[i] == bytes[i * 3 + 2];
+            }
+            CHECK(split, "%s rgb_to_planar pixels=%d", simd_level_name(level), pixels);
+
+            actual.assign(pixels * 3 + 1, 7);
+            kernels.planar_to_rgb(c0, c1, c2, actual.data(), pixels);
+            CHECK(equal(bytes.begin(), bytes.begin() + count, actual.begin()) && actual.back() == 7,
+                  "%s planar_to_rgb pixels=%d", simd_level_name(level), pixels);
+        }
+
+        // and the whole engine, through the active kernel table
+        for (auto &size : SIZES) {
+            int width = size[0], height = size[1];
+            Image input = synthetic_image(width, height, width + height);
+            Pipeline pipeline(width, height);
+            pipeline.edge(EDGE_CLAMP).blur(3).resize(width / 2 + 1, height / 2 + 1, FILTER_LANCZOS, 1.0);
+
+            set_simd_level(SIMD_SCALAR);
+            Image expected = run_pipeline(pipeline, input);
+            set_simd_level(level);
+            Image actual = run_pipeline(pipeline, input);
+            CHECK(fnv1a(expected) == fnv1a(actual), "%s pipeline %dx%d differs from scalar", simd_level_name(level),
+                  width, height);
+        }
+        set_simd_level(best_simd_level());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool print = argc > 1 && string(argv[1]) == "--print-golden";
+
+    test_exact_golden(print);
+    if (print) {
+        return 0;
+    }
+
+    test_uniform_tiles();
+    test_separable();
+    test_simd_kernels();
+    test_resize();
+    test_downscale();
+    test_gaussian_kernels();
+    test_partitions();
+    test_rotated_blur();
+    test_masked_blur();
+    test_background_blur();
+    test_bloom();
+    test_guided_filter();
+    test_nl_means();
+    test_job_control();
+    test_approx_backends();
+    test_stack_plane();
+    test_cost_model();
+    test_bmp_round_trip();
+    test_bmp_mapped_round_trip();
+    test_mask_file();
+    test_alpha_files();
+    test_codec_round_trip();
+
+    printf("%d checks, %d failures\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}